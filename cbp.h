@@ -17,6 +17,8 @@
 #pragma once
 #include "lib/sim_common_structs.h"
 
+class snapshot_t;
+
 //
 // beginCondDirPredictor()
 // 
@@ -92,3 +94,12 @@ extern void notify_instr_commit(uint64_t seq_no, uint8_t piece, uint64_t pc, con
 // It can be used by the contestant to print out other contestant-specific measurements.
 //
 extern void endCondDirPredictor();
+
+//
+// snapshotCondDirPredictor(snapshot_t& s)
+//
+// This function is called by the simulator when it saves a snapshot (cbp --checkpoint), and when it
+// restores one (cbp --restore), after beginCondDirPredictor().
+// It passes the predictor state to s (see lib/snapshot.h): state it leaves out starts cold after a restore.
+//
+extern void snapshotCondDirPredictor(snapshot_t& s);
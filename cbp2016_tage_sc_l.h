@@ -10,11 +10,67 @@
 #include <unordered_map>
 #include <vector>
 #include <array>
+#include <utility>
+#if defined(__AVX2__) || defined(__SSE4_1__)
+#include <immintrin.h>
+#endif
 #include <iostream>
 
 
+// The 64KB and 192KB flavours of the predictor only differ by the sizes of their tables.
+// Those are given by a configuration class (TAGE_SC_L_64KB, TAGE_SC_L_192KB) that
+// CBP2016_TAGE_SC_L is instantiated with; the parameters below are common to both.
+struct TAGE_SC_L_64KB
+{
+    //To get the predictor storage budget on stderr set PRINTSIZE to true
+    static constexpr bool PRINTSIZE = false;
+    // Use the scalar statistical corrector code even when the SIMD one is available (see sc_lanes_t)
+    static constexpr bool SCALAR_SC = false;
+    // Use the scalar TAGE tag match even when the SIMD one is available (see tag_hits)
+    static constexpr bool SCALAR_TAG_MATCH = false;
+
+    static constexpr int LOGL = 5;          // loop predictor
+    static constexpr int LOGBIAS = 8;       // the three BIAS tables in the SC component
+    static constexpr int LOGINB = 8;        // 128-entry
+    static constexpr int LOGIMNB = 9;       // 2 * 256-entry
+    static constexpr int LOGGNB = 10;       // 1 1K + 2 * 512-entry tables
+    static constexpr int LOGPNB = 9;        // 1 512 + 2 * 256-entry tables
+    static constexpr int LOGLNB = 10;       // 1 1K + 2 * 512-entry tables
+    static constexpr int LOGLOCAL = 8;      // number of first local histories
+    static constexpr int LOGSNB = 9;        // 1 512 + 2 * 256-entry tables
+    static constexpr int LOGSECLOCAL = 4;   // number of second local histories
+    static constexpr int LOGTNB = 10;       // 2 * 512-entry tables
+    static constexpr int LOGTLOCAL = 4;     // number of third local histories
+    static constexpr int LOGG = 10;         // logsize of the  banks in the  tagged TAGE tables
+    static constexpr int TBITS = 8;         // minimum width of the tags  (low history lengths), +4 for high history lengths
+    static constexpr int LOGB = 13;         // log of number of entries in bimodal predictor
+};
+
+struct TAGE_SC_L_192KB
+{
+    static constexpr bool PRINTSIZE = true;
+    static constexpr bool SCALAR_SC = false;
+    static constexpr bool SCALAR_TAG_MATCH = false;
+
+    static constexpr int LOGL = 8;
+    static constexpr int LOGBIAS = 11;
+    static constexpr int LOGINB = 10;       // 512-entry
+    static constexpr int LOGIMNB = 11;      // 2 * 1K-entry
+    static constexpr int LOGGNB = 12;       // 1 4K + 2 * 2K-entry tables
+    static constexpr int LOGPNB = 11;       // 1 2K + 2 * 1K-entry tables
+    static constexpr int LOGLNB = 11;       // 1 2K + 2 * 1K-entry tables
+    static constexpr int LOGLOCAL = 9;
+    static constexpr int LOGSNB = 10;       // 1 1K + 2 * 512-entry tables
+    static constexpr int LOGSECLOCAL = 5;
+    static constexpr int LOGTNB = 11;       // 2 * 1K-entry tables
+    static constexpr int LOGTLOCAL = 5;
+    static constexpr int LOGG = 11;
+    static constexpr int TBITS = 10;
+    static constexpr int LOGB = 18;
+};
+
+
 //parameters of the loop predictor
-#define LOGL 5
 #define WIDTHNBITERLOOP 10  // we predict only loops with less than 1K iterations
 #define LOOPTAG 10      //tag width in the loop predictor
 
@@ -22,8 +78,6 @@
 #define UINT64 uint64_t
 
 #define BORNTICK  1024
-//To get the predictor storage budget on stderr  uncomment the next line
-//#define PRINTSIZE
 
 #define SC          // 8.2 % if TAGE alone
 #define IMLI            // 0.2 %
@@ -40,78 +94,29 @@
 //The statistical corrector components
 
 #define PERCWIDTH 6     //Statistical corrector  counter width 5 -> 6 : 0.6 %
-//The three BIAS tables in the SC component
-//We play with the TAGE  confidence here, with the number of the hitting bank
-#define LOGBIAS 8
-int8_t Bias[(1 << LOGBIAS)];
-int8_t BiasSK[(1 << LOGBIAS)];
-int8_t BiasBank[(1 << LOGBIAS)];
 
 //In all th GEHL components, the two tables with the shortest history lengths have only half of the entries.
 
 // IMLI-SIC -> Micro 2015  paper: a big disappointment on  CBP2016 traces
 #ifdef IMLI
-#define LOGINB 8        // 128-entry
 #define INB 1
-int Im[INB] = { 8 };
-int8_t IGEHLA[INB][(1 << LOGINB)] = { {0} };
-
-int8_t *IGEHL[INB];
-
-#define LOGIMNB 9       // 2 * 256-entry
 #define IMNB 2
-
-int IMm[IMNB] = { 10, 4 };
-int8_t IMGEHLA[IMNB][(1 << LOGIMNB)] = { {0} };
-
-int8_t *IMGEHL[IMNB];
-
 #endif
 
 //global branch GEHL
-#define LOGGNB 10       // 1 1K + 2 * 512-entry tables
 #define GNB 3
-int Gm[GNB] = { 40, 24, 10 };
-int8_t GGEHLA[GNB][(1 << LOGGNB)] = { {0} };
-
-int8_t *GGEHL[GNB];
 
 //variation on global branch history
 #define PNB 3
-#define LOGPNB 9        // 1 512 + 2 * 256-entry tables
-int Pm[PNB] = { 25, 16, 9 };
-int8_t PGEHLA[PNB][(1 << LOGPNB)] = { {0} };
-
-int8_t *PGEHL[PNB];
 
 //first local history
-#define LOGLNB  10      // 1 1K + 2 * 512-entry tables
 #define LNB 3
-int Lm[LNB] = { 11, 6, 3 };
-int8_t LGEHLA[LNB][(1 << LOGLNB)] = { {0} };
-
-int8_t *LGEHL[LNB];
-#define  LOGLOCAL 8
-#define NLOCAL (1<<LOGLOCAL)
 
 // second local history
-#define LOGSNB 9        // 1 512 + 2 * 256-entry tables
 #define SNB 3
-int Sm[SNB] = { 16, 11, 6 };
-int8_t SGEHLA[SNB][(1 << LOGSNB)] = { {0} };
-
-int8_t *SGEHL[SNB];
-#define LOGSECLOCAL 4
-#define NSECLOCAL (1<<LOGSECLOCAL)  //Number of second local histories
 
 //third local history
-#define LOGTNB 10       // 2 * 512-entry tables
 #define TNB 2
-int Tm[TNB] = { 9, 4 };
-int8_t TGEHLA[TNB][(1 << LOGTNB)] = { {0} };
-
-int8_t *TGEHL[TNB];
-#define NTLOCAL 16
 
 
 // playing with putting more weights (x2)  on some of the SC components
@@ -126,33 +131,14 @@ int8_t *TGEHL[TNB];
 #define LOGSIZEUP 0
 #endif
 #define LOGSIZEUPS  (LOGSIZEUP/2)
-int updatethreshold;
-int Pupdatethreshold[(1 << LOGSIZEUP)]; //size is fixed by LOGSIZEUP
 #define INDUPD (PC ^ (PC >>2)) & ((1 << LOGSIZEUP) - 1)
 #define INDUPDS ((PC ^ (PC >>2)) & ((1 << (LOGSIZEUPS)) - 1))
-int8_t WG[(1 << LOGSIZEUPS)];
-int8_t WL[(1 << LOGSIZEUPS)];
-int8_t WS[(1 << LOGSIZEUPS)];
-int8_t WT[(1 << LOGSIZEUPS)];
-int8_t WP[(1 << LOGSIZEUPS)];
-int8_t WI[(1 << LOGSIZEUPS)];
-int8_t WIM[(1 << LOGSIZEUPS)];
-int8_t WB[(1 << LOGSIZEUPS)];
 #define EWIDTH 6
-int LSUM;
-
-// The two counters used to choose between TAGE and SC on Low Conf SC
-int8_t FirstH, SecondH;
-bool MedConf;           // is the TAGE prediction medium confidence
 
 
 #define CONFWIDTH 7     //for the counters in the choser
 #define HISTBUFFERLENGTH 4096   // we use a 4K entries history buffer to store the branch history (this allows us to explore using history length up to 4K)
 
-// utility class for index computation
-// this is the cyclic shift register for folding 
-// a long global history into a smaller number of bits; see P. Michaud's PPM-like predictor at CBP-1
-
 class bentry            // TAGE bimodal table entry  
 {
     public:
@@ -194,8 +180,6 @@ class gentry            // TAGE global table entry
 #define NBANKLOW 10     // number of banks in the shared bank-interleaved for the low history lengths
 #define NBANKHIGH 20        // number of banks in the shared bank-interleaved for the  history lengths
 
-int SizeTable[NHIST + 1];
-
 
 #define BORN 13         // below BORN in the table for low history lengths, >= BORN in the table for high history lengths,
 
@@ -209,17 +193,9 @@ int SizeTable[NHIST + 1];
 #define MAXHIST 3000
 
 
-#define LOGG 10         /* logsize of the  banks in the  tagged TAGE tables */
-#define TBITS 8         //minimum width of the tags  (low history lengths), +4 for high history lengths
-
-
-bool NOSKIP[NHIST + 1];     // to manage the associativity for different history lengths
-
-
 
 #define NNN 1           // number of extra entries allocated on a TAGE misprediction (1+NNN)
 #define HYSTSHIFT 2     // bimodal hysteresis shared by 4 entries
-#define LOGB 13         // log of number of entries in bimodal predictor
 
 
 #define PHISTWIDTH 27       // width of the path history used in TAGE
@@ -229,20 +205,9 @@ bool NOSKIP[NHIST + 1];     // to manage the associativity for different history
 
 //the counter(s) to chose between longest match and alternate prediction on TAGE when weak counters
 #define LOGSIZEUSEALT 4
-bool AltConf;           // Confidence on the alternate prediction
 #define ALTWIDTH 5
 #define SIZEUSEALT  (1<<(LOGSIZEUSEALT))
 #define INDUSEALT (((((HitBank-1)/8)<<1)+AltConf) % (SIZEUSEALT-1))
-int8_t use_alt_on_na[SIZEUSEALT];
-//very marginal benefit
-int8_t BIM;
-
-int TICK;           // for the reset of the u counter
-//uint8_t ghist[HISTBUFFERLENGTH];
-//int ptghist;
-//uint64_t phist;      //path history
-//folded_history ch_i[NHIST + 1];   //utility for computing TAGE indices
-//folded_history ch_t[2][NHIST + 1];    //utility for computing TAGE tags
 
 class lentry            //loop predictor entry
 {
@@ -267,180 +232,506 @@ class lentry            //loop predictor entry
         }
 };
 
-//For the TAGE predictor
-bentry *btable;         //bimodal TAGE table
-gentry *gtable[NHIST + 1];  // tagged TAGE tables
-//lentry *ltable;
-int m[NHIST + 1];
-int TB[NHIST + 1];
-int logg[NHIST + 1];
 
-uint64_t Seed;           // for the pseudo-random number generator
+// The folded histories of one kind (index, first or second tag hash) for all the banks, as a
+// structure of arrays: lane i holds the folded register of bank i. Lane 0 and the padding lanes
+// are unused and stay 0. The widest registers (tags of the high history lengths) have 14 bits.
+#define NFOLDLANES 40       // NHIST + 1, rounded up to a multiple of 8
+using folded_comp_t = std::array<uint16_t, NFOLDLANES>;
 
-
-class folded_history
+// Per-lane constants of one kind of folded registers, see tage_fold_consts()
+struct fold_consts_t
 {
-    public:
-        unsigned comp;
-        int CLENGTH;
-        int OLENGTH;
-        int OUTPOINT;
-
-        folded_history ()
-        {
-        }
-
-        void init (int original_length, int compressed_length)
-        {
-            comp = 0;
-            OLENGTH = original_length;
-            CLENGTH = compressed_length;
-            OUTPOINT = OLENGTH % CLENGTH;
-
-        }
-
-        void update (std::array<uint8_t, HISTBUFFERLENGTH>&h, int PT)
-        {
-            comp = (comp << 1) ^ h[PT & (HISTBUFFERLENGTH - 1)];
-            comp ^= h[(PT + OLENGTH) & (HISTBUFFERLENGTH - 1)] << OUTPOINT;
-            comp ^= (comp >> CLENGTH);
-            comp = (comp) & ((1 << CLENGTH) - 1);
-        }
+    folded_comp_t outpoint;     // 1 << (OLENGTH % CLENGTH): where the bit leaving the history is folded in
+    folded_comp_t top;          // 1 << CLENGTH: the bit that wraps around to bit 0
+    folded_comp_t mask;         // (1 << CLENGTH) - 1
 };
-using tage_index_t = std::array<folded_history, NHIST+1>;
-using tage_tag_t = std::array<folded_history, NHIST+1>;
+
+// Shifts the history bit DIR into the folded registers of all the banks at once.
+// out[i] is all ones when the bit leaving the OLENGTH-long history of bank i is set.
+// Per lane, this is the cyclic shift register of P. Michaud's PPM-like predictor (CBP-1):
+//      comp = (comp << 1) ^ DIR; comp ^= out << OUTPOINT; comp ^= comp >> CLENGTH; comp &= mask
+// where comp >> CLENGTH is a single bit. The loop only uses per-lane constants, so it is vectorized.
+inline void fold_update (folded_comp_t& comp, const fold_consts_t& c, const folded_comp_t& out, uint16_t DIR)
+{
+    for (int i = 0; i < NFOLDLANES; i++)
+    {
+        uint16_t v = (uint16_t) ((comp[i] << 1) ^ DIR);
+        v ^= out[i] & c.outpoint[i];
+        v ^= (uint16_t) ((v & c.top[i]) != 0);
+        comp[i] = v & c.mask[i];
+    }
+}
 
 
-struct cbp_hist_t
+// Prediction-time checkpoint of a conditional branch.
+// Only the history that predict_using_given_hist reads is kept: the folded
+// registers, GHIST/phist, the local history slots selected by the PC, the IMLI
+// state and the 4 loop predictor ways probed by getloop. The rest of the loop
+// table is recovered through loop_undo_log_t when the branch mispredicts.
+struct cbp_ckpt_t
 {
-      // Begin Conventional Histories
+      uint64_t key;        // get_unique_inst_id(seq_no, piece); UINT64_MAX when free
       uint64_t GHIST;
-      std::array<uint8_t, HISTBUFFERLENGTH> ghist;
-      uint64_t phist;      //path history
-      int ptghist;
-      tage_index_t ch_i;
-      std::array<tage_tag_t, 2> ch_t;
-
-      std::array<uint64_t, NLOCAL> L_shist;
-      std::array<uint64_t, NSECLOCAL> S_slhist;
-      std::array<uint64_t, NTLOCAL> T_slhist;
-
-      std::array<uint64_t, 256> IMHIST;
-      uint64_t IMLIcount;      // use to monitor the iteration number
+      uint64_t phist;
+      folded_comp_t ch_i;
+      std::array<folded_comp_t, 2> ch_t;
+      uint64_t L_shist;
+      uint64_t S_slhist;
+      uint64_t T_slhist;
+      uint64_t IMHIST;
+      uint64_t IMLIcount;
 #ifdef LOOPPREDICTOR
-      std::vector<lentry> ltable;
+      std::array<lentry, 4> lways;
       int8_t WITHLOOP;
+      uint64_t ltable_mark;    // loop_undo_log_t position when the checkpoint was taken
 #endif
-      cbp_hist_t()
+      cbp_ckpt_t()
       {
-#ifdef LOOPPREDICTOR
-          ltable.resize(1 << (LOGL));
-          WITHLOOP = -1;
-#endif
+          key = UINT64_MAX;
       }
 };
 
+// Checkpoints of the in-flight conditional branches, indexed by seq_no.
+// Branches are predicted in program order, so live checkpoints always lie in
+// [oldest_seq, next_seq); the ring is doubled whenever that span reaches its size.
+class cbp_ckpt_ring_t
+{
+        std::vector<cbp_ckpt_t> slots;
+        uint64_t mask;
+        uint64_t oldest_seq;    // seq_no of the oldest live checkpoint
+        uint64_t next_seq;      // one past the seq_no of the youngest checkpoint
 
+        static uint64_t make_key(uint64_t seq_no, uint8_t piece)
+        {
+            assert(piece < 16);
+            return (seq_no << 4) | (piece & 0x000F);
+        }
 
-int predictorsize ()
-{
-    int STORAGESIZE = 0;
-    int inter = 0;
+        void grow()
+        {
+            std::vector<cbp_ckpt_t> grown(2 * slots.size());
+            const uint64_t grown_mask = grown.size() - 1;
+            for (uint64_t seq = oldest_seq; seq < next_seq; seq++)
+            {
+                const cbp_ckpt_t& ckpt = slots[seq & mask];
+                if ((ckpt.key != UINT64_MAX) && ((ckpt.key >> 4) == seq))
+                    grown[seq & grown_mask] = ckpt;
+            }
+            slots.swap(grown);
+            mask = grown_mask;
+        }
 
+    public:
+        cbp_ckpt_ring_t(uint64_t log2_size)
+        {
+            slots.resize(1ULL << log2_size);
+            mask = slots.size() - 1;
+            oldest_seq = 0;
+            next_seq = 0;
+        }
 
+        cbp_ckpt_t& allocate(uint64_t seq_no, uint8_t piece)
+        {
+            assert(seq_no >= next_seq || oldest_seq == next_seq);
+            if (oldest_seq == next_seq)
+                oldest_seq = seq_no;
+            next_seq = seq_no + 1;
+            while ((next_seq - oldest_seq) > slots.size())
+                grow();
+            cbp_ckpt_t& ckpt = slots[seq_no & mask];
+            assert(ckpt.key == UINT64_MAX && "one conditional branch checkpoint per seq_no expected");
+            ckpt.key = make_key(seq_no, piece);
+            return ckpt;
+        }
 
-    STORAGESIZE +=
-        NBANKHIGH * (1 << (logg[BORN])) * (CWIDTH + UWIDTH + TB[BORN]);
-    STORAGESIZE += NBANKLOW * (1 << (logg[1])) * (CWIDTH + UWIDTH + TB[1]);
+        const cbp_ckpt_t& at(uint64_t seq_no, uint8_t piece) const
+        {
+            const cbp_ckpt_t& ckpt = slots[seq_no & mask];
+            assert(ckpt.key == make_key(seq_no, piece));
+            return ckpt;
+        }
 
-    STORAGESIZE += (SIZEUSEALT) * ALTWIDTH;
-    STORAGESIZE += (1 << LOGB) + (1 << (LOGB - HYSTSHIFT));
-    STORAGESIZE += m[NHIST];
-    STORAGESIZE += PHISTWIDTH;
-    STORAGESIZE += 10;      //the TICK counter
+        void release(uint64_t seq_no, uint8_t piece)
+        {
+            cbp_ckpt_t& ckpt = slots[seq_no & mask];
+            assert(ckpt.key == make_key(seq_no, piece));
+            ckpt.key = UINT64_MAX;
+            while ((oldest_seq != next_seq) && (slots[oldest_seq & mask].key == UINT64_MAX))
+                oldest_seq++;
+        }
 
-    fprintf (stderr, " (TAGE %d) ", STORAGESIZE);
-#ifdef SC
-#ifdef LOOPPREDICTOR
+        // oldest live checkpoint, nullptr if none
+        const cbp_ckpt_t* oldest() const
+        {
+            return (oldest_seq == next_seq) ? nullptr : &slots[oldest_seq & mask];
+        }
 
-    inter = (1 << LOGL) * (2 * WIDTHNBITERLOOP + LOOPTAG + 4 + 4 + 1);
-    fprintf (stderr, " (LOOP %d) ", inter);
-    STORAGESIZE += inter;
-#endif
+        template <class SNAPSHOT>
+        void snapshot(SNAPSHOT& s)
+        {
+            snapshot_fields(s, slots, mask, oldest_seq, next_seq);
+        }
+};
 
-    inter += WIDTHRES;
-    inter += WIDTHRESP * ((1 << LOGSIZEUP)); //the update threshold counters
-    inter += 3 * EWIDTH * (1 << LOGSIZEUPS);    // the extra weight of the partial sums
-    inter += (PERCWIDTH) * 3 * (1 << (LOGBIAS));
+#ifdef LOOPPREDICTOR
+// Undo log of the speculative loop table writes done in spec_update.
+// A checkpoint records the log position at predict time; rewinding to it restores
+// the loop table as it was then. Rewinds are themselves logged, so younger
+// checkpoints can still be rewound to afterwards.
+class loop_undo_log_t
+{
+        struct record_t
+        {
+            uint16_t index;
+            lentry old;
+        };
+        std::vector<record_t> recs;
+        uint64_t mask;
+        uint64_t head;      // oldest position still needed
+        uint64_t tail;      // next position to write
 
-    inter +=
-        (GNB - 2) * (1 << (LOGGNB)) * (PERCWIDTH) +
-        (1 << (LOGGNB - 1)) * (2 * PERCWIDTH);
-    inter += Gm[0];     //global histories for SC
-    inter += (PNB - 2) * (1 << (LOGPNB)) * (PERCWIDTH) +
-        (1 << (LOGPNB - 1)) * (2 * PERCWIDTH);
-    //we use phist already counted for these tables
+        void grow()
+        {
+            std::vector<record_t> grown(2 * recs.size());
+            const uint64_t grown_mask = grown.size() - 1;
+            for (uint64_t pos = head; pos < tail; pos++)
+                grown[pos & grown_mask] = recs[pos & mask];
+            recs.swap(grown);
+            mask = grown_mask;
+        }
 
-#ifdef LOCALH
-    inter +=
-        (LNB - 2) * (1 << (LOGLNB)) * (PERCWIDTH) +
-        (1 << (LOGLNB - 1)) * (2 * PERCWIDTH);
-    inter += NLOCAL * Lm[0];
-    inter += EWIDTH * (1 << LOGSIZEUPS);
-#ifdef LOCALS
-    inter +=
-        (SNB - 2) * (1 << (LOGSNB)) * (PERCWIDTH) +
-        (1 << (LOGSNB - 1)) * (2 * PERCWIDTH);
-    inter += NSECLOCAL * (Sm[0]);
-    inter += EWIDTH * (1 << LOGSIZEUPS);
+    public:
+        loop_undo_log_t()
+        {
+            recs.resize(256);
+            mask = recs.size() - 1;
+            head = 0;
+            tail = 0;
+        }
 
-#endif
-#ifdef LOCALT
-    inter +=
-        (TNB - 2) * (1 << (LOGTNB)) * (PERCWIDTH) +
-        (1 << (LOGTNB - 1)) * (2 * PERCWIDTH);
-    inter += NTLOCAL * Tm[0];
-    inter += EWIDTH * (1 << LOGSIZEUPS);
-#endif
+        uint64_t mark() const
+        {
+            return tail;
+        }
 
+        void record(int index, const lentry& old)
+        {
+            if ((tail - head) == recs.size())
+                grow();
+            recs[tail & mask].index = index;
+            recs[tail & mask].old = old;
+            tail++;
+        }
 
+        template <size_t N>
+        void rewind(uint64_t pos, std::array<lentry, N>& ltable)
+        {
+            assert((pos >= head) && (pos <= tail));
+            for (uint64_t p = tail; p-- > pos;)
+            {
+                const record_t r = recs[p & mask];
+                record(r.index, ltable[r.index]);
+                ltable[r.index] = r.old;
+            }
+        }
 
+        void trim(uint64_t pos)
+        {
+            assert((pos >= head) && (pos <= tail));
+            head = pos;
+        }
 
+        template <class SNAPSHOT>
+        void snapshot(SNAPSHOT& s)
+        {
+            snapshot_fields(s, recs, mask, head, tail);
+        }
+};
+#endif
 
 
+// Compile-time natural logarithm and exponential, precise enough to reproduce the rounded
+// geometric history lengths that were computed with pow() at run time.
+constexpr double tage_constexpr_log (double x)
+{
+    // x = y * 2^e with y in [1, 2), then ln(y) = 2 atanh((y - 1) / (y + 1))
+    int e = 0;
+    while (x >= 2.0)
+    {
+        x /= 2.0;
+        e++;
+    }
+    while (x < 1.0)
+    {
+        x *= 2.0;
+        e--;
+    }
+    const double z = (x - 1.0) / (x + 1.0);
+    double term = z;
+    double sum = 0.0;
+    for (int k = 1; k < 60; k += 2)
+    {
+        sum += term / k;
+        term *= z * z;
+    }
+    return 2.0 * sum + e * 0.693147180559945309417232121458;
+}
 
+constexpr double tage_constexpr_exp (double x)
+{
+    // e^x = (e^(x / 2^n))^(2^n) with |x / 2^n| <= 1
+    int n = 0;
+    while ((x > 1.0) || (x < -1.0))
+    {
+        x /= 2.0;
+        n++;
+    }
+    double term = 1.0;
+    double sum = 1.0;
+    for (int k = 1; k < 30; k++)
+    {
+        term *= x / k;
+        sum += term;
+    }
+    for (int i = 0; i < n; i++)
+        sum *= sum;
+    return sum;
+}
 
+// history length of each TAGE bank: geometric series from MINHIST to MAXHIST, each length used by two banks
+constexpr std::array<int, NHIST + 1> tage_history_lengths ()
+{
+    std::array<int, NHIST + 1> m {};
+    m[1] = MINHIST;
+    m[NHIST / 2] = MAXHIST;
+    for (int i = 2; i <= NHIST / 2; i++)
+    {
+        m[i] =
+            (int) (((double) MINHIST *
+                        tage_constexpr_exp (tage_constexpr_log ((double) (MAXHIST) / (double) MINHIST) *
+                            (double) (i - 1) / (double) (((NHIST / 2) - 1)))) +
+                    0.5);
+    }
+    for (int i = NHIST; i > 1; i--)
+        m[i] = m[(i + 1) / 2];
+    return m;
+}
 
-#endif
+// banks that are looked up: to manage the associativity for different history lengths
+constexpr std::array<bool, NHIST + 1> tage_noskip ()
+{
+    std::array<bool, NHIST + 1> NOSKIP {};
+    for (int i = 1; i <= NHIST; i++)
+        NOSKIP[i] = ((i - 1) & 1) || ((i >= BORNINFASSOC) & (i < BORNSUPASSOC));
+
+    // just eliminate some extra tables (very very marginal)
+    NOSKIP[4] = 0;
+    NOSKIP[NHIST - 2] = 0;
+    NOSKIP[8] = 0;
+    NOSKIP[NHIST - 6] = 0;
+    return NOSKIP;
+}
 
+// NOSKIP as a bitmask, bit i for bank i
+constexpr uint64_t tage_noskip_mask ()
+{
+    const std::array<bool, NHIST + 1> NOSKIP = tage_noskip ();
+    uint64_t mask = 0;
+    for (int i = 1; i <= NHIST; i++)
+        if (NOSKIP[i])
+            mask |= 1ULL << i;
+    return mask;
+}
 
+// offset of each bank's table from gtable[1], in entries: high_offset from BORN on
+template <int LANES>
+constexpr std::array<int, LANES> tage_gtable_offsets (int high_offset)
+{
+    std::array<int, LANES> v {};
+    for (int i = BORN; i <= NHIST; i++)
+        v[i] = high_offset;
+    return v;
+}
 
-#ifdef IMLI
+// per-bank parameter that takes one value below BORN and another one from BORN on
+constexpr std::array<int, NHIST + 1> tage_per_bank (int low, int high)
+{
+    std::array<int, NHIST + 1> v {};
+    for (int i = 1; i <= NHIST; i++)
+        v[i] = (i >= BORN) ? high : low;
+    return v;
+}
 
-    inter += (1 << (LOGINB - 1)) * PERCWIDTH;
-    inter += Im[0];
+// fold_update() constants for banks with history lengths olength folded on clength - shorten bits
+constexpr fold_consts_t tage_fold_consts (const std::array<int, NHIST + 1>& olength,
+                                          const std::array<int, NHIST + 1>& clength, int shorten)
+{
+    fold_consts_t c {};
+    for (int i = 1; i <= NHIST; i++)
+    {
+        const int clen = clength[i] - shorten;
+        c.outpoint[i] = 1 << (olength[i] % clen);
+        c.top[i] = 1 << clen;
+        c.mask[i] = (1 << clen) - 1;
+    }
+    return c;
+}
 
-    inter += IMNB * (1 << (LOGIMNB - 1)) * PERCWIDTH;
-    inter += 2 * EWIDTH * (1 << LOGSIZEUPS);    // the extra weight of the partial sums
-    inter += 256 * IMm[0];
-#endif
-    inter += 2 * CONFWIDTH; //the 2 counters in the choser
-    STORAGESIZE += inter;
+// banks 2k - 1 and 2k have the same history length (see bank_pair_index)
+constexpr bool tage_paired_lengths (const std::array<int, NHIST + 1>& m)
+{
+    for (int i = 1; i <= NHIST; i += 2)
+        if (m[i] != m[i + 1])
+            return false;
+    return true;
+}
 
+// Statistical corrector components; each one has its own weight (VARTHRES)
+enum sc_group_t
+{
+    SC_BIAS,        // Bias, BiasSK, BiasBank
+    SC_GLOBAL,      // GGEHL
+    SC_PATH,        // PGEHL
+    SC_LOCAL,       // LGEHL
+    SC_SECLOCAL,    // SGEHL
+    SC_THIRDLOCAL,  // TGEHL
+    SC_IMLI_HIST,   // IMGEHL
+    SC_IMLI_COUNT,  // IGEHL
+    SC_GROUPS
+};
 
-    fprintf (stderr, " (SC %d) ", inter);
+// The statistical corrector counters read for one branch, one lane per table.
+// predict gathers them once (add), sums them with their component weights (sum) and update trains
+// the very same counters (group_sums, update) without recomputing the table indices. The lanes are
+// processed as one int8 vector with AVX2 or SSE4.1 (build with -march=native, see NATIVE in the
+// Makefile), or one at a time otherwise; both give the same results. VECTOR = false forces the
+// scalar code.
+template <bool VECTOR>
+struct sc_lanes_t
+{
+    static constexpr int LANES = 32;
+    static constexpr uint8_t NO_GROUP = 0x80;   // unused lane: selects a zero weight in sum()
+
+    alignas(32) int8_t ctr[LANES] = {};         // counter values
+    alignas(32) uint8_t group[LANES];           // sc_group_t of each lane
+    alignas(16) uint8_t weight[16] = {};        // weight of each sc_group_t, as set by predict
+    int8_t * ptr[LANES] = {};                   // where the counters live
+    int n = 0;                                  // lanes in use
+
+    sc_lanes_t()
+    {
+        memset(group, NO_GROUP, sizeof(group));
+    }
+
+    void clear()
+    {
+        memset(group, NO_GROUP, n);
+        n = 0;
+    }
+
+    void add(sc_group_t g, int8_t * p)
+    {
+        assert(n < LANES);
+        ptr[n] = p;
+        ctr[n] = *p;
+        group[n] = g;
+        n++;
+    }
+
+    // sum of (2 * ctr + 1) over all lanes, each weighted by its component's weight
+    int sum() const
+    {
+#if defined(__AVX2__)
+        if (VECTOR)
+        {
+            const __m256i c = _mm256_load_si256((const __m256i *) ctr);
+            const __m256i v = _mm256_add_epi8(_mm256_add_epi8(c, c), _mm256_set1_epi8(1));
+            const __m256i w = _mm256_shuffle_epi8(_mm256_broadcastsi128_si256(_mm_load_si128((const __m128i *) weight)),
+                                                  _mm256_load_si256((const __m256i *) group));
+            // |w * v| <= 2 * 63: neither the 16-bit pair sums nor the 32-bit sums can saturate
+            const __m256i s = _mm256_madd_epi16(_mm256_maddubs_epi16(w, v), _mm256_set1_epi16(1));
+            __m128i x = _mm_add_epi32(_mm256_castsi256_si128(s), _mm256_extracti128_si256(s, 1));
+            x = _mm_add_epi32(x, _mm_shuffle_epi32(x, 0x4E));
+            x = _mm_add_epi32(x, _mm_shuffle_epi32(x, 0xB1));
+            return _mm_cvtsi128_si32(x);
+        }
+#elif defined(__SSE4_1__)
+        if (VECTOR)
+        {
+            const __m128i wg = _mm_load_si128((const __m128i *) weight);
+            __m128i s = _mm_setzero_si128();
+            for (int h = 0; h < LANES; h += 16)
+            {
+                const __m128i c = _mm_load_si128((const __m128i *) &ctr[h]);
+                const __m128i v = _mm_add_epi8(_mm_add_epi8(c, c), _mm_set1_epi8(1));
+                const __m128i w = _mm_shuffle_epi8(wg, _mm_load_si128((const __m128i *) &group[h]));
+                s = _mm_add_epi32(s, _mm_madd_epi16(_mm_maddubs_epi16(w, v), _mm_set1_epi16(1)));
+            }
+            s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0x4E));
+            s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0xB1));
+            return _mm_cvtsi128_si32(s);
+        }
 #endif
-#ifdef PRINTSIZE
-    fprintf (stderr, " (TOTAL %d bits %d Kbits) ", STORAGESIZE,
-            STORAGESIZE / 1024);
-    fprintf (stdout, " (TOTAL %d bits %d Kbits) ", STORAGESIZE,
-            STORAGESIZE / 1024);
+        int s = 0;
+        for (int l = 0; l < n; l++)
+            s += weight[group[l]] * (2 * ctr[l] + 1);
+        return s;
+    }
+
+    // unweighted sum of (2 * ctr + 1) of each component
+    void group_sums(int (&s)[SC_GROUPS]) const
+    {
+        for (int g = 0; g < SC_GROUPS; g++)
+            s[g] = 0;
+        for (int l = 0; l < n; l++)
+            s[group[l]] += 2 * ctr[l] + 1;
+    }
+
+    // up-down saturating update (ctrupdate) of every PERCWIDTH counter, written back to the tables
+    void update(bool taken)
+    {
+#if defined(__AVX2__)
+        if (VECTOR)
+        {
+            const __m256i c = _mm256_add_epi8(_mm256_load_si256((const __m256i *) ctr), _mm256_set1_epi8(taken ? 1 : -1));
+            _mm256_store_si256((__m256i *) ctr, _mm256_max_epi8(_mm256_min_epi8(c, _mm256_set1_epi8((1 << (PERCWIDTH - 1)) - 1)),
+                                                                _mm256_set1_epi8(-(1 << (PERCWIDTH - 1)))));
+        }
+        else
+#elif defined(__SSE4_1__)
+        if (VECTOR)
+        {
+            for (int h = 0; h < LANES; h += 16)
+            {
+                const __m128i c = _mm_add_epi8(_mm_load_si128((const __m128i *) &ctr[h]), _mm_set1_epi8(taken ? 1 : -1));
+                _mm_store_si128((__m128i *) &ctr[h], _mm_max_epi8(_mm_min_epi8(c, _mm_set1_epi8((1 << (PERCWIDTH - 1)) - 1)),
+                                                                  _mm_set1_epi8(-(1 << (PERCWIDTH - 1)))));
+            }
+        }
+        else
 #endif
+        {
+            for (int l = 0; l < n; l++)
+            {
+                if (taken)
+                {
+                    if (ctr[l] < ((1 << (PERCWIDTH - 1)) - 1))
+                        ctr[l]++;
+                }
+                else
+                {
+                    if (ctr[l] > -(1 << (PERCWIDTH - 1)))
+                        ctr[l]--;
+                }
+            }
+        }
+        for (int l = 0; l < n; l++)
+            *ptr[l] = ctr[l];
+    }
+};
 
 
-    return (STORAGESIZE);
-}
-
 // The interface to the simulator is defined in cond_branch_predictor_interface.cc
 // This predictor is a modified version of CBP2016 Tage.
 // The CBP Tage predicted and updated the predictor right away.
@@ -449,17 +740,141 @@ int predictorsize ()
 // * spec_update -> This is used for updating the history. It provides the actual direction of the branch. This is invoked for all branches.
 // * notify_instr_execute_resolve -> This hook is used to update the predictor. This is invoked for all the instructions and provides all information available at execute.
 //    * Note: The history at update is different than history at predict. To ensure that the predictor is getting trained correctly, 
-//    at predict, we checkpoint the history in an unordered_map(pred_time_histories) using unique identifying id of the instruction. 
+//    at predict, we checkpoint the history in a ring(pred_time_ckpts) indexed by the unique identifying id of the instruction. 
 //    When updating the predicor, we recover the prediction time history.
 // There are a couple of other hooks that aren't used in the current implementation, but are available to exploit:
 // * notify_instr_decode 
 // * notify_instr_commit
+template <class CFG>
 class CBP2016_TAGE_SC_L
 {
     public:
+        // Table sizes of the configuration
+        static constexpr int LOGL = CFG::LOGL;
+        static constexpr int LOGBIAS = CFG::LOGBIAS;
+        static constexpr int LOGINB = CFG::LOGINB;
+        static constexpr int LOGIMNB = CFG::LOGIMNB;
+        static constexpr int LOGGNB = CFG::LOGGNB;
+        static constexpr int LOGPNB = CFG::LOGPNB;
+        static constexpr int LOGLNB = CFG::LOGLNB;
+        static constexpr int LOGLOCAL = CFG::LOGLOCAL;
+        static constexpr int NLOCAL = (1 << LOGLOCAL);
+        static constexpr int LOGSNB = CFG::LOGSNB;
+        static constexpr int LOGSECLOCAL = CFG::LOGSECLOCAL;
+        static constexpr int NSECLOCAL = (1 << LOGSECLOCAL);  //Number of second local histories
+        static constexpr int LOGTNB = CFG::LOGTNB;
+        static constexpr int NTLOCAL = (1 << CFG::LOGTLOCAL);  //Number of third local histories
+        static constexpr int LOGG = CFG::LOGG;
+        static constexpr int TBITS = CFG::TBITS;
+        static constexpr int LOGB = CFG::LOGB;
+
+        struct cbp_hist_t
+        {
+              // Begin Conventional Histories
+              uint64_t GHIST;
+              std::array<uint64_t, HISTBUFFERLENGTH / 64> ghist;  // one bit per branch: bit Y of the ring is bit Y % 64 of word Y / 64
+              uint64_t phist;      //path history
+              int ptghist;
+              folded_comp_t ch_i;
+              std::array<folded_comp_t, 2> ch_t;
+
+              std::array<uint64_t, NLOCAL> L_shist;
+              std::array<uint64_t, NSECLOCAL> S_slhist;
+              std::array<uint64_t, NTLOCAL> T_slhist = {};
+
+              std::array<uint64_t, 256> IMHIST = {};
+              uint64_t IMLIcount = 0;      // use to monitor the iteration number
+#ifdef LOOPPREDICTOR
+              std::array<lentry, (1 << LOGL)> ltable;
+              int8_t WITHLOOP;
+#endif
+              cbp_hist_t()
+              {
+#ifdef LOOPPREDICTOR
+                  WITHLOOP = -1;
+#endif
+              }
+        };
+
+        //The three BIAS tables in the SC component
+        //We play with the TAGE  confidence here, with the number of the hitting bank
+        int8_t Bias[(1 << LOGBIAS)] = {};
+        int8_t BiasSK[(1 << LOGBIAS)] = {};
+        int8_t BiasBank[(1 << LOGBIAS)] = {};
+
+#ifdef IMLI
+        static constexpr int Im[INB] = { 8 };
+        int8_t IGEHL[INB][(1 << LOGINB)] = { {0} };
+
+        static constexpr int IMm[IMNB] = { 10, 4 };
+        int8_t IMGEHL[IMNB][(1 << LOGIMNB)] = { {0} };
+#endif
+
+        static constexpr int Gm[GNB] = { 40, 24, 10 };
+        int8_t GGEHL[GNB][(1 << LOGGNB)] = { {0} };
+
+        static constexpr int Pm[PNB] = { 25, 16, 9 };
+        int8_t PGEHL[PNB][(1 << LOGPNB)] = { {0} };
+
+        static constexpr int Lm[LNB] = { 11, 6, 3 };
+        int8_t LGEHL[LNB][(1 << LOGLNB)] = { {0} };
+
+        static constexpr int Sm[SNB] = { 16, 11, 6 };
+        int8_t SGEHL[SNB][(1 << LOGSNB)] = { {0} };
+
+        static constexpr int Tm[TNB] = { 9, 4 };
+        int8_t TGEHL[TNB][(1 << LOGTNB)] = { {0} };
+
+        int updatethreshold = 0;
+        int Pupdatethreshold[(1 << LOGSIZEUP)] = {}; //size is fixed by LOGSIZEUP
+        int8_t WG[(1 << LOGSIZEUPS)] = {};
+        int8_t WL[(1 << LOGSIZEUPS)] = {};
+        int8_t WS[(1 << LOGSIZEUPS)] = {};
+        int8_t WT[(1 << LOGSIZEUPS)] = {};
+        int8_t WP[(1 << LOGSIZEUPS)] = {};
+        int8_t WI[(1 << LOGSIZEUPS)] = {};
+        int8_t WIM[(1 << LOGSIZEUPS)] = {};
+        int8_t WB[(1 << LOGSIZEUPS)] = {};
+        int LSUM = 0;
+        sc_lanes_t<!CFG::SCALAR_SC> sc;     // the SC counters of the branch being predicted/updated
+
+        // The two counters used to choose between TAGE and SC on Low Conf SC
+        int8_t FirstH = 0, SecondH = 0;
+        bool MedConf = false;           // is the TAGE prediction medium confidence
+
+        int SizeTable[NHIST + 1] = {};
+        static constexpr std::array<bool, NHIST + 1> NOSKIP = tage_noskip ();
+
+        bool AltConf = false;           // Confidence on the alternate prediction
+        int8_t use_alt_on_na[SIZEUSEALT] = {};
+        //very marginal benefit
+        int8_t BIM = 0;
+
+        int TICK = 0;           // for the reset of the u counter
+
+        //For the TAGE predictor
+        bentry *btable = nullptr;         //bimodal TAGE table
+        gentry *gtable[NHIST + 1] = {};  // tagged TAGE tables
+        static constexpr std::array<int, NHIST + 1> m = tage_history_lengths ();
+        static constexpr std::array<int, NHIST + 1> TB = tage_per_bank (TBITS, TBITS + 4);
+        static constexpr std::array<int, NHIST + 1> logg = tage_per_bank (LOGG, LOGG);
+        static constexpr fold_consts_t FOLD_I = tage_fold_consts (m, logg, 0);
+        static constexpr std::array<fold_consts_t, 2> FOLD_T = { tage_fold_consts (m, TB, 0), tage_fold_consts (m, TB, 1) };
+        static_assert (tage_paired_lengths (m), "HistoryUpdate reads one leaving bit per pair of banks");
+
+        uint64_t Seed = 0;           // for the pseudo-random number generator
+
+
+        // GI/GTAG are padded to whole 8-lane vectors for tag_hits(); bank 0 and the padding are never matched
+        static constexpr int TAG_LANES = (NHIST + 1 + 7) & ~7;
+        static constexpr uint64_t TAG_BANKS = tage_noskip_mask ();
+        // position of the table for the high history lengths in the gtable allocation, in entries
+        static constexpr int GTABLE_HIGH = NBANKLOW * (1 << LOGG);
+        alignas(32) static constexpr std::array<int, TAG_LANES> GTABLE_OFFSET = tage_gtable_offsets<TAG_LANES> (GTABLE_HIGH);
+
         //state set by predict
-        int GI[NHIST + 1];      // indexes to the different tables are computed only once  
-        uint GTAG[NHIST + 1];   // tags for the different tables are computed only once  
+        alignas(32) int GI[TAG_LANES] = {};      // indexes to the different tables are computed only once  
+        alignas(32) uint GTAG[TAG_LANES] = {};   // tags for the different tables are computed only once  
         int BI;             // index of the bimodal table
 
         //
@@ -490,14 +905,24 @@ class CBP2016_TAGE_SC_L
 
         cbp_hist_t active_hist; // running history always updated accurately
         // checkpointed history. Can be accesed using the inst-id(seq_no/piece)
-        std::unordered_map<uint64_t/*key*/, cbp_hist_t/*val*/> pred_time_histories;
+        cbp_ckpt_ring_t pred_time_ckpts;
+#ifdef LOOPPREDICTOR
+        loop_undo_log_t loop_undo_log;
+#endif
 
         CBP2016_TAGE_SC_L (void)
+            : pred_time_ckpts(10)
         {
             init_histories (active_hist);
-#ifdef PRINTSIZE
-            predictorsize ();
-#endif
+            if (CFG::PRINTSIZE)
+                predictorsize ();
+        }
+
+        // Tables allocated by init_histories()
+        ~CBP2016_TAGE_SC_L()
+        {
+            delete[] btable;
+            delete[] gtable[1];
         }
 
         void setup()
@@ -508,6 +933,30 @@ class CBP2016_TAGE_SC_L
         {
         }
 
+        // Saves or restores the predictor state (see lib/snapshot.h): the tables, the running and
+        // checkpointed histories. What predict() computes for update() is not kept: update()
+        // predicts again from the checkpoint.
+        template <class SNAPSHOT>
+        void snapshot(SNAPSHOT& s)
+        {
+            s.section("tage_sc_l");
+            s.check(sizeof(*this), "CBP2016_TAGE_SC_L size");
+            snapshot_fields(s, Bias, BiasSK, BiasBank);
+#ifdef IMLI
+            snapshot_fields(s, IGEHL, IMGEHL);
+#endif
+            snapshot_fields(s, GGEHL, PGEHL, LGEHL, SGEHL, TGEHL);
+            snapshot_fields(s, updatethreshold, Pupdatethreshold, WG, WL, WS, WT, WP, WI, WIM, WB);
+            snapshot_fields(s, FirstH, SecondH, use_alt_on_na, BIM, TICK, Seed);
+            snapshot_array(s, btable, 1 << LOGB);
+            snapshot_array(s, gtable[1], (NBANKLOW + NBANKHIGH) * (1 << LOGG));
+            snapshot_field(s, active_hist);
+            pred_time_ckpts.snapshot(s);
+#ifdef LOOPPREDICTOR
+            loop_undo_log.snapshot(s);
+#endif
+        }
+
         uint64_t get_unique_inst_id(uint64_t seq_no, uint8_t piece) const
         {
             assert(piece < 16);
@@ -516,53 +965,17 @@ class CBP2016_TAGE_SC_L
 
         void init_histories (cbp_hist_t& current_hist)
         {
-            m[1] = MINHIST;
-            m[NHIST / 2] = MAXHIST;
-            for (int i = 2; i <= NHIST / 2; i++)
-            {
-                m[i] =
-                    (int) (((double) MINHIST *
-                                pow ((double) (MAXHIST) / (double) MINHIST,
-                                    (double) (i - 1) / (double) (((NHIST / 2) - 1)))) +
-                            0.5);
-                //      fprintf(stderr, "(%d %d)", m[i],i);
-
-            }
-            for (int i = 1; i <= NHIST; i++)
-            {
-                NOSKIP[i] = ((i - 1) & 1)
-                    || ((i >= BORNINFASSOC) & (i < BORNSUPASSOC));
-
-            }
-
-            NOSKIP[4] = 0;
-            NOSKIP[NHIST - 2] = 0;
-            NOSKIP[8] = 0;
-            NOSKIP[NHIST - 6] = 0;
-            // just eliminate some extra tables (very very marginal)
-
-            for (int i = NHIST; i > 1; i--)
-            {
-                m[i] = m[(i + 1) / 2];
-
-
-            }
-            for (int i = 1; i <= NHIST; i++)
-            {
-                TB[i] = TBITS + 4 * (i >= BORN);
-                logg[i] = LOGG;
-
-            }
-
+            // m, NOSKIP, TB and logg are computed at compile time (see tage_history_lengths)
 
 //#ifdef LOOPPREDICTOR
 //            ltable = new lentry[1 << (LOGL)];
 //#endif
 
-            gtable[1] = new gentry[NBANKLOW * (1 << LOGG)];
+            // one allocation for both tables, so that tag_hits() can gather from all banks with 32-bit offsets
+            gtable[1] = new gentry[(NBANKLOW + NBANKHIGH) * (1 << LOGG)];
             SizeTable[1] = NBANKLOW * (1 << LOGG);
 
-            gtable[BORN] = new gentry[NBANKHIGH * (1 << LOGG)];
+            gtable[BORN] = gtable[1] + GTABLE_HIGH;
             SizeTable[BORN] = NBANKHIGH * (1 << LOGG);
 
             for (int i = BORN + 1; i <= NHIST; i++)
@@ -571,13 +984,8 @@ class CBP2016_TAGE_SC_L
                 gtable[i] = gtable[1];
             btable = new bentry[1 << LOGB];
 
-            for (int i = 1; i <= NHIST; i++)
-            {
-                current_hist.ch_i[i].init (m[i], (logg[i]));
-                current_hist.ch_t[0][i].init (current_hist.ch_i[i].OLENGTH, TB[i]);
-                current_hist.ch_t[1][i].init (current_hist.ch_i[i].OLENGTH, TB[i] - 1);
-
-            }
+            current_hist.ch_i = {};
+            current_hist.ch_t = {};
 
 // LOOPPREDICTOR state
             LVALID = false;
@@ -588,17 +996,12 @@ class CBP2016_TAGE_SC_L
             current_hist.phist = 0;
             Seed = 0;
 
-            for (int i = 0; i < HISTBUFFERLENGTH; i++)
-                current_hist.ghist[i] = 0;
+            current_hist.ghist = {};
             current_hist.ptghist = 0;
             updatethreshold=35<<3;
 
             for (int i = 0; i < (1 << LOGSIZEUP); i++)
                 Pupdatethreshold[i] = 0;
-            for (int i = 0; i < GNB; i++)
-                GGEHL[i] = &GGEHLA[i][0];
-            for (int i = 0; i < LNB; i++)
-                LGEHL[i] = &LGEHLA[i][0];
 
             for (int i = 0; i < GNB; i++)
                 for (int j = 0; j < ((1 << LOGGNB) - 1); j++)
@@ -619,12 +1022,6 @@ class CBP2016_TAGE_SC_L
                     }
                 }
 
-            for (int i = 0; i < SNB; i++)
-                SGEHL[i] = &SGEHLA[i][0];
-            for (int i = 0; i < TNB; i++)
-                TGEHL[i] = &TGEHLA[i][0];
-            for (int i = 0; i < PNB; i++)
-                PGEHL[i] = &PGEHLA[i][0];
 #ifdef IMLI
 #ifdef IMLIOH
             for (int i = 0; i < FNB; i++)
@@ -640,8 +1037,6 @@ class CBP2016_TAGE_SC_L
                     }
                 }
 #endif
-            for (int i = 0; i < INB; i++)
-                IGEHL[i] = &IGEHLA[i][0];
             for (int i = 0; i < INB; i++)
                 for (int j = 0; j < ((1 << LOGINB) - 1); j++)
                 {
@@ -651,8 +1046,6 @@ class CBP2016_TAGE_SC_L
 
                     }
                 }
-            for (int i = 0; i < IMNB; i++)
-                IMGEHL[i] = &IMGEHLA[i][0];
             for (int i = 0; i < IMNB; i++)
                 for (int j = 0; j < ((1 << LOGIMNB) - 1); j++)
                 {
@@ -792,6 +1185,103 @@ class CBP2016_TAGE_SC_L
 
 
 
+        int predictorsize () const
+        {
+            int STORAGESIZE = 0;
+            int inter = 0;
+
+
+
+            STORAGESIZE +=
+                NBANKHIGH * (1 << (logg[BORN])) * (CWIDTH + UWIDTH + TB[BORN]);
+            STORAGESIZE += NBANKLOW * (1 << (logg[1])) * (CWIDTH + UWIDTH + TB[1]);
+
+            STORAGESIZE += (SIZEUSEALT) * ALTWIDTH;
+            STORAGESIZE += (1 << LOGB) + (1 << (LOGB - HYSTSHIFT));
+            STORAGESIZE += m[NHIST];
+            STORAGESIZE += PHISTWIDTH;
+            STORAGESIZE += 10;      //the TICK counter
+
+            fprintf (stderr, " (TAGE %d) ", STORAGESIZE);
+#ifdef SC
+#ifdef LOOPPREDICTOR
+
+            inter = (1 << LOGL) * (2 * WIDTHNBITERLOOP + LOOPTAG + 4 + 4 + 1);
+            fprintf (stderr, " (LOOP %d) ", inter);
+            STORAGESIZE += inter;
+#endif
+
+            inter += WIDTHRES;
+            inter += WIDTHRESP * ((1 << LOGSIZEUP)); //the update threshold counters
+            inter += 3 * EWIDTH * (1 << LOGSIZEUPS);    // the extra weight of the partial sums
+            inter += (PERCWIDTH) * 3 * (1 << (LOGBIAS));
+
+            inter +=
+                (GNB - 2) * (1 << (LOGGNB)) * (PERCWIDTH) +
+                (1 << (LOGGNB - 1)) * (2 * PERCWIDTH);
+            inter += Gm[0];     //global histories for SC
+            inter += (PNB - 2) * (1 << (LOGPNB)) * (PERCWIDTH) +
+                (1 << (LOGPNB - 1)) * (2 * PERCWIDTH);
+            //we use phist already counted for these tables
+
+#ifdef LOCALH
+            inter +=
+                (LNB - 2) * (1 << (LOGLNB)) * (PERCWIDTH) +
+                (1 << (LOGLNB - 1)) * (2 * PERCWIDTH);
+            inter += NLOCAL * Lm[0];
+            inter += EWIDTH * (1 << LOGSIZEUPS);
+#ifdef LOCALS
+            inter +=
+                (SNB - 2) * (1 << (LOGSNB)) * (PERCWIDTH) +
+                (1 << (LOGSNB - 1)) * (2 * PERCWIDTH);
+            inter += NSECLOCAL * (Sm[0]);
+            inter += EWIDTH * (1 << LOGSIZEUPS);
+
+#endif
+#ifdef LOCALT
+            inter +=
+                (TNB - 2) * (1 << (LOGTNB)) * (PERCWIDTH) +
+                (1 << (LOGTNB - 1)) * (2 * PERCWIDTH);
+            inter += NTLOCAL * Tm[0];
+            inter += EWIDTH * (1 << LOGSIZEUPS);
+#endif
+
+
+
+
+
+
+
+
+
+#endif
+
+
+
+#ifdef IMLI
+
+            inter += (1 << (LOGINB - 1)) * PERCWIDTH;
+            inter += Im[0];
+
+            inter += IMNB * (1 << (LOGIMNB - 1)) * PERCWIDTH;
+            inter += 2 * EWIDTH * (1 << LOGSIZEUPS);    // the extra weight of the partial sums
+            inter += 256 * IMm[0];
+#endif
+            inter += 2 * CONFWIDTH; //the 2 counters in the choser
+            STORAGESIZE += inter;
+
+
+            fprintf (stderr, " (SC %d) ", inter);
+#endif
+            fprintf (stderr, " (TOTAL %d bits %.1f KBs) ", STORAGESIZE,
+                    (double)STORAGESIZE / 8192.0);
+            fprintf (stdout, " (TOTAL %d bits %.1f KBs) ", STORAGESIZE,
+                    (double)STORAGESIZE / 8192.0);
+
+
+            return (STORAGESIZE);
+        }
+
         // index function for the bimodal table
         int bindex (UINT64 PC) const
         {
@@ -801,7 +1291,8 @@ class CBP2016_TAGE_SC_L
 
         // the index functions for the tagged tables uses path history as in the OGEHL predictor
         //F serves to mix path history: not very important impact
-        int F (uint64_t A, int size, int bank) const
+        template <int bank>
+        int F (uint64_t A, int size) const
         {
             int   A1, A2;
             A = A & ((1 << size) - 1);
@@ -821,19 +1312,21 @@ class CBP2016_TAGE_SC_L
 
         // gindex computes a full hash of PC, ghist and phist
         //int gindex (unsigned int PC, int bank, uint64_t hist, const folded_history * ch_i) const
-        int gindex (unsigned int PC, int bank, uint64_t hist, const tage_index_t& ch_i) const
+        template <int bank>
+        int gindex (unsigned int PC, uint64_t hist, const folded_comp_t& ch_i) const
         {
             int index;
-            int M = (m[bank] > PHISTWIDTH) ? PHISTWIDTH : m[bank];
-            index = PC ^ (PC >> (abs (logg[bank] - bank) + 1)) ^ ch_i[bank].comp ^ F (hist, M, bank);
+            constexpr int M = (m[bank] > PHISTWIDTH) ? PHISTWIDTH : m[bank];
+            index = PC ^ (PC >> (abs (logg[bank] - bank) + 1)) ^ ch_i[bank] ^ F<bank> (hist, M);
 
             return (index & ((1 << (logg[bank])) - 1));
         }
 
         //  tag computation
-        uint16_t gtag (unsigned int PC, int bank, const tage_tag_t& tag_0_array, const tage_tag_t& tag_1_array) const
+        template <int bank>
+        uint16_t gtag (unsigned int PC, const folded_comp_t& tag_0_array, const folded_comp_t& tag_1_array) const
         {
-            int tag = (PC) ^ tag_0_array[bank].comp ^ (tag_1_array[bank].comp << 1);
+            int tag = (PC) ^ tag_0_array[bank] ^ (tag_1_array[bank] << 1);
             return (tag & ((1 << (TB[bank])) - 1));
         }
 
@@ -890,18 +1383,93 @@ class CBP2016_TAGE_SC_L
         };
 
 
-        //  TAGE PREDICTION: same code at fetch or retire time but the index and tags must recomputed
-        void Tagepred (UINT64 PC, const cbp_hist_t& hist_to_use)
+        // index and tag of banks i and i + 1, which share the same history length
+        template <int i>
+        void bank_pair_index (UINT64 PC, const cbp_ckpt_t& hist_to_use)
+        {
+            GI[i] = gindex<i> (PC, hist_to_use.phist, hist_to_use.ch_i);
+            GTAG[i] = gtag<i> (PC, hist_to_use.ch_t[0], hist_to_use.ch_t[1]);
+            GTAG[i + 1] = GTAG[i];
+            GI[i + 1] = GI[i] ^ (GTAG[i] & ((1 << LOGG) - 1));
+        }
+
+        // bank_pair_index for banks 1, 3, ... NHIST - 1, unrolled
+        template <size_t... P>
+        void bank_pair_indices (UINT64 PC, const cbp_ckpt_t& hist_to_use, std::index_sequence<P...>)
+        {
+            (bank_pair_index<2 * P + 1> (PC, hist_to_use), ...);
+        }
+
+#ifdef __AVX2__
+        // Bit i set when bank i holds the tag of the branch, for the banks in use (NOSKIP).
+        // The tags of 8 banks are gathered and compared at once.
+        uint64_t tag_hits () const
+        {
+            static_assert (sizeof (gentry) == 3 * sizeof (int), "tag gather assumes 3-int entries");
+            const int * tags = (const int *) ((const char *) gtable[1] + offsetof (gentry, tag));
+            uint64_t hits = 0;
+            for (int v = 0; v < TAG_LANES / 8; v++)
+            {
+                __m256i entry = _mm256_add_epi32 (_mm256_load_si256 ((const __m256i *) &GI[8 * v]),
+                                                  _mm256_load_si256 ((const __m256i *) &GTABLE_OFFSET[8 * v]));
+                entry = _mm256_add_epi32 (entry, _mm256_add_epi32 (entry, entry));
+                const __m256i tag = _mm256_i32gather_epi32 (tags, entry, 4);
+                const __m256i eq = _mm256_cmpeq_epi32 (tag, _mm256_load_si256 ((const __m256i *) &GTAG[8 * v]));
+                hits |= (uint64_t) _mm256_movemask_ps (_mm256_castsi256_ps (eq)) << (8 * v);
+            }
+            return hits & TAG_BANKS;
+        }
+#endif
+
+        // Sets HitBank and AltBank, the longest and the alternate matching banks (0: none).
+        // The AVX2 version derives both from the hit mask of all banks; otherwise the banks are
+        // scanned from the longest history, which stops at the first hits.
+        void find_hit_banks ()
         {
             HitBank = 0;
             AltBank = 0;
-            for (int i = 1; i <= NHIST; i += 2)
+#ifdef __AVX2__
+            if (!CFG::SCALAR_TAG_MATCH)
+            {
+                uint64_t hits = tag_hits ();
+                if (hits)
+                {
+                    HitBank = 63 - __builtin_clzll (hits);
+                    hits &= ~(1ULL << HitBank);
+                    if (hits)
+                        AltBank = 63 - __builtin_clzll (hits);
+                }
+                return;
+            }
+#endif
+            //Look for the bank with longest matching history
+            for (int i = NHIST; i > 0; i--)
+            {
+                if (NOSKIP[i])
+                    if (gtable[i][GI[i]].tag == GTAG[i])
+                    {
+                        HitBank = i;
+                        break;
+                    }
+            }
+
+            //Look for the alternate bank
+            for (int i = HitBank - 1; i > 0; i--)
             {
-                GI[i] = gindex (PC, i, hist_to_use.phist, hist_to_use.ch_i);
-                GTAG[i] = gtag (PC, i, hist_to_use.ch_t[0], hist_to_use.ch_t[1]);
-                GTAG[i + 1] = GTAG[i];
-                GI[i + 1] = GI[i] ^ (GTAG[i] & ((1 << LOGG) - 1));
+                if (NOSKIP[i])
+                    if (gtable[i][GI[i]].tag == GTAG[i])
+                    {
+
+                        AltBank = i;
+                        break;
+                    }
             }
+        }
+
+        //  TAGE PREDICTION: same code at fetch or retire time but the index and tags must recomputed
+        void Tagepred (UINT64 PC, const cbp_ckpt_t& hist_to_use)
+        {
+            bank_pair_indices (PC, hist_to_use, std::make_index_sequence<NHIST / 2> ());
             int T = (PC ^ (hist_to_use.phist & ((1ULL << m[BORN]) - 1))) % NBANKHIGH;
             //int T = (PC ^ phist) % NBANKHIGH;
             for (int i = BORN; i <= NHIST; i++)
@@ -931,29 +1499,9 @@ class CBP2016_TAGE_SC_L
                 LongestMatchPred = alttaken;
             }
 
-            //Look for the bank with longest matching history
-            for (int i = NHIST; i > 0; i--)
-            {
-                if (NOSKIP[i])
-                    if (gtable[i][GI[i]].tag == GTAG[i])
-                    {
-                        HitBank = i;
-                        LongestMatchPred = (gtable[HitBank][GI[HitBank]].ctr >= 0);
-                        break;
-                    }
-            }
-
-            //Look for the alternate bank
-            for (int i = HitBank - 1; i > 0; i--)
-            {
-                if (NOSKIP[i])
-                    if (gtable[i][GI[i]].tag == GTAG[i])
-                    {
-
-                        AltBank = i;
-                        break;
-                    }
-            }
+            find_hit_banks ();
+            if (HitBank > 0)
+                LongestMatchPred = (gtable[HitBank][GI[HitBank]].ctr >= 0);
             //computes the prediction and the alternate prediction
 
             if (HitBank > 0)
@@ -1016,15 +1564,36 @@ class CBP2016_TAGE_SC_L
             return (pred_inter + (((HitBank+1)/4)<<4) + (HighConf<<1) + (LowConf <<2) +((AltBank!=0)<<3)+ ((PC^(PC>>2))<<7)) & ((1<<LOGBIAS) -1);
         }
 
+        // copy the part of active_hist that a prediction for PC depends on
+        void checkpoint_hist (UINT64 PC, cbp_ckpt_t& ckpt)
+        {
+            ckpt.GHIST = active_hist.GHIST;
+            ckpt.phist = active_hist.phist;
+            ckpt.ch_i = active_hist.ch_i;
+            ckpt.ch_t = active_hist.ch_t;
+            ckpt.L_shist = active_hist.L_shist[get_local_index(PC)];
+            ckpt.S_slhist = active_hist.S_slhist[get_second_local_index(PC)];
+            ckpt.T_slhist = active_hist.T_slhist[get_third_local_index(PC)];
+            ckpt.IMHIST = active_hist.IMHIST[active_hist.IMLIcount];
+            ckpt.IMLIcount = active_hist.IMLIcount;
+#ifdef LOOPPREDICTOR
+            for (int i = 0; i < 4; i++)
+                ckpt.lways[i] = active_hist.ltable[lway (PC, i)];
+            ckpt.WITHLOOP = active_hist.WITHLOOP;
+            ckpt.ltable_mark = loop_undo_log.mark();
+#endif
+        }
+
         bool predict (uint64_t seq_no, uint8_t piece, UINT64 PC)
         {
             // checkpoint current hist
-            pred_time_histories.emplace(get_unique_inst_id(seq_no, piece), active_hist);
-            const bool pred_taken = predict_using_given_hist(seq_no, piece, PC, active_hist, true/*pred_time_predict*/);
+            cbp_ckpt_t& ckpt = pred_time_ckpts.allocate(seq_no, piece);
+            checkpoint_hist(PC, ckpt);
+            const bool pred_taken = predict_using_given_hist(seq_no, piece, PC, ckpt, true/*pred_time_predict*/);
             return pred_taken;
         }
 
-        bool predict_using_given_hist (uint64_t seq_no, uint8_t piece, UINT64 PC, const cbp_hist_t& hist_to_use, const bool pred_time_predict)
+        bool predict_using_given_hist (uint64_t seq_no, uint8_t piece, UINT64 PC, const cbp_ckpt_t& hist_to_use, const bool pred_time_predict)
         {
             // computes the TAGE table addresses and the partial tags
             Tagepred (PC, hist_to_use);
@@ -1040,37 +1609,7 @@ class CBP2016_TAGE_SC_L
             pred_inter = pred_taken;
 
             //Compute the SC prediction
-
-            LSUM = 0;
-
-            //integrate BIAS prediction   
-            int8_t ctr = Bias[get_bias_index(PC)];
-
-            LSUM += (2 * ctr + 1);
-            ctr = BiasSK[get_biassk_index(PC)];
-            LSUM += (2 * ctr + 1);
-            ctr = BiasBank[get_biasbank_index(PC)];
-            LSUM += (2 * ctr + 1);
-#ifdef VARTHRES
-            LSUM = (1 + (WB[INDUPDS] >= 0)) * LSUM;
-#endif
-            //integrate the GEHL predictions
-            LSUM += Gpredict ((PC << 1) + pred_inter, hist_to_use.GHIST, Gm, GGEHL, GNB, LOGGNB, WG);
-            LSUM += Gpredict (PC, hist_to_use.phist, Pm, PGEHL, PNB, LOGPNB, WP);
-#ifdef LOCALH
-            LSUM += Gpredict (PC, hist_to_use.L_shist[get_local_index(PC)], Lm, LGEHL, LNB, LOGLNB, WL);
-#ifdef LOCALS
-            LSUM += Gpredict (PC, hist_to_use.S_slhist[get_second_local_index(PC)], Sm, SGEHL, SNB, LOGSNB, WS);
-#endif
-#ifdef LOCALT
-            LSUM += Gpredict (PC, hist_to_use.T_slhist[get_third_local_index(PC)], Tm, TGEHL, TNB, LOGTNB, WT);
-#endif
-#endif
-
-#ifdef IMLI
-            LSUM += Gpredict (PC, hist_to_use.IMHIST[(hist_to_use.IMLIcount)], IMm, IMGEHL, IMNB, LOGIMNB, WIM);
-            LSUM += Gpredict (PC, hist_to_use.IMLIcount, Im, IGEHL, INB, LOGINB, WI);
-#endif
+            LSUM = sc_predict (PC, hist_to_use);
             bool SCPRED = (LSUM >= 0);
             //just  an heuristic if the respective contribution of component groups can be multiplied by 2 or not
             THRES = (updatethreshold>>3)+Pupdatethreshold[INDUPD]
@@ -1129,16 +1668,31 @@ class CBP2016_TAGE_SC_L
             HistoryUpdate (PC, brtype, pred_taken, taken, nextPC);
         }
 
+        // pushes DIR at position Y of the global history, then into the folded index and tag histories
+        void update_folded (int Y, bool DIR, folded_comp_t& out)
+        {
+            auto& ghist = active_hist.ghist;
+            const int pos = Y & (HISTBUFFERLENGTH - 1);
+            ghist[pos >> 6] = (ghist[pos >> 6] & ~(1ULL << (pos & 63))) | ((uint64_t) DIR << (pos & 63));
+
+            // the bits leaving the history of each bank, as all-ones/all-zeros lanes
+            for (int i = 1; i <= NHIST; i += 2)
+            {
+                const int leaving = (Y + m[i]) & (HISTBUFFERLENGTH - 1);
+                out[i] = out[i + 1] = (uint16_t) -(int) ((ghist[leaving >> 6] >> (leaving & 63)) & 1);
+            }
+
+            fold_update (active_hist.ch_i, FOLD_I, out, DIR);
+            fold_update (active_hist.ch_t[0], FOLD_T[0], out, DIR);
+            fold_update (active_hist.ch_t[1], FOLD_T[1], out, DIR);
+        }
+
         void HistoryUpdate (UINT64 PC, int brtype, bool pred_taken, bool taken, UINT64 nextPC)
         {
 
             auto& X = active_hist.phist;
             auto& Y = active_hist.ptghist;
 
-            auto& H = active_hist.ch_i;
-            auto& G = active_hist.ch_t[0];
-            auto& J = active_hist.ch_t[1];
-
             //special treatment for indirect  branchs;
             int maxt = 2;
             if (brtype & 1)   // conditional
@@ -1202,6 +1756,7 @@ class CBP2016_TAGE_SC_L
                 PATH = PATH ^ (nextPC >> 2) ^ (nextPC >> 4);
             }
 
+            folded_comp_t out = {};
             for (int t = 0; t < maxt; t++)
             {
                 bool DIR = (T & 1);
@@ -1210,17 +1765,10 @@ class CBP2016_TAGE_SC_L
                 PATH >>= 1;
                 //update  history
                 Y--;  //ptghist
-                active_hist.ghist[Y & (HISTBUFFERLENGTH - 1)] = DIR;
                 X = (X << 1) ^ PATHBIT; //phist
 
-
-                // updates to folded histories
-                for (int i = 1; i <= NHIST; i++)
-                {
-                    H[i].update (active_hist.ghist, Y);
-                    G[i].update (active_hist.ghist, Y);
-                    J[i].update (active_hist.ghist, Y);
-                }
+                // updates to global and folded histories
+                update_folded (Y, DIR, out);
             }
 
             X = (X & ((1<<PHISTWIDTH)-1));
@@ -1232,8 +1780,7 @@ class CBP2016_TAGE_SC_L
         //void update (UINT64 PC, int brtype, bool resolveDir, bool predDir, UINT64 nextPC)
         void update (uint64_t seq_no, uint8_t piece, UINT64 PC, bool resolveDir, bool predDir, UINT64 nextPC)
         {
-            const auto pred_hist_key = get_unique_inst_id(seq_no, piece);
-            const auto& pred_time_history = pred_time_histories.at(pred_hist_key);
+            const auto& pred_time_history = pred_time_ckpts.at(seq_no, piece);
             const bool pred_taken = predict_using_given_hist(seq_no, piece, PC, pred_time_history, false/*pred_time_predict*/);
             //if(pred_taken != predDir)
             //{
@@ -1242,17 +1789,22 @@ class CBP2016_TAGE_SC_L
             //} 
             // remove checkpointed hist
             update(PC, resolveDir, pred_taken, nextPC, pred_time_history);
-            pred_time_histories.erase(pred_hist_key);
+            pred_time_ckpts.release(seq_no, piece);
+#ifdef LOOPPREDICTOR
+            // loop table writes older than every live checkpoint can no longer be rewound
+            const cbp_ckpt_t* oldest_ckpt = pred_time_ckpts.oldest();
+            loop_undo_log.trim(oldest_ckpt ? oldest_ckpt->ltable_mark : loop_undo_log.mark());
+#endif
         }
 
-        void update (UINT64 PC, bool resolveDir, bool pred_taken, UINT64 nextPC, const cbp_hist_t& hist_to_use)
+        void update (UINT64 PC, bool resolveDir, bool pred_taken, UINT64 nextPC, const cbp_ckpt_t& hist_to_use)
         {
 #ifdef SC
 #ifdef LOOPPREDICTOR
             if(pred_taken != resolveDir)  // incorrect loophhist updates in spec_update
             {
                 // fix active hist.ltable and active_hist.WITHLOOP
-                active_hist.ltable = hist_to_use.ltable;
+                loop_undo_log.rewind(hist_to_use.ltable_mark, active_hist.ltable);
                 active_hist.WITHLOOP = hist_to_use.WITHLOOP;
                 if (LVALID)
                 {
@@ -1313,50 +1865,7 @@ class CBP2016_TAGE_SC_L
                         updatethreshold = -(1 << (WIDTHRES - 1));
                     }
                 }
-#ifdef VARTHRES
-                {
-                    int XSUM =
-                        LSUM - ((WB[INDUPDS] >= 0) * ((2 * Bias[get_bias_index(PC)] + 1) +
-                                    (2 * BiasSK[get_biassk_index(PC)] + 1) +
-                                    (2 * BiasBank[get_biasbank_index(PC)] + 1)));
-                    if ((XSUM +
-                                ((2 * Bias[get_bias_index(PC)] + 1) + (2 * BiasSK[get_biassk_index(PC)] + 1) +
-                                 (2 * BiasBank[get_biasbank_index(PC)] + 1)) >= 0) != (XSUM >= 0))
-                        ctrupdate (WB[INDUPDS],
-                                (((2 * Bias[get_bias_index(PC)] + 1) +
-                                  (2 * BiasSK[get_biassk_index(PC)] + 1) +
-                                  (2 * BiasBank[get_biasbank_index(PC)] + 1) >= 0) == resolveDir),
-                                EWIDTH);
-                }
-#endif
-                ctrupdate (Bias[get_bias_index(PC)], resolveDir, PERCWIDTH);
-                ctrupdate (BiasSK[get_biassk_index(PC)], resolveDir, PERCWIDTH);
-                ctrupdate (BiasBank[get_biasbank_index(PC)], resolveDir, PERCWIDTH);
-                Gupdate ((PC << 1) + pred_inter, resolveDir,
-                        hist_to_use.GHIST, Gm, GGEHL, GNB, LOGGNB, WG);
-                Gupdate (PC, resolveDir, hist_to_use.phist, Pm, PGEHL, PNB, LOGPNB, WP);
-#ifdef LOCALH
-                Gupdate (PC, resolveDir, hist_to_use.L_shist[get_local_index(PC)], Lm, LGEHL, LNB, LOGLNB,
-                        WL);
-#ifdef LOCALS
-                Gupdate (PC, resolveDir, hist_to_use.S_slhist[get_second_local_index(PC)], Sm,
-                        SGEHL, SNB, LOGSNB, WS);
-#endif
-#ifdef LOCALT
-
-                Gupdate (PC, resolveDir, hist_to_use.T_slhist[get_third_local_index(PC)], Tm, TGEHL, TNB, LOGTNB,
-                        WT);
-#endif
-#endif
-
-
-#ifdef IMLI
-                Gupdate (PC, resolveDir, hist_to_use.IMHIST[(hist_to_use.IMLIcount)], IMm, IMGEHL, IMNB,
-                        LOGIMNB, WIM);
-                Gupdate (PC, resolveDir, hist_to_use.IMLIcount, Im, IGEHL, INB, LOGINB, WI);
-#endif
-
-
+                sc_update (PC, resolveDir);
 
             }
 #endif
@@ -1571,62 +2080,123 @@ class CBP2016_TAGE_SC_L
         }//END PREDICTOR UPDATE
 
 #define GINDEX (((uint64_t) PC) ^ bhist ^ (bhist >> (8 - i)) ^ (bhist >> (16 - 2 * i)) ^ (bhist >> (24 - 3 * i)) ^ (bhist >> (32 - 3 * i)) ^ (bhist >> (40 - 4 * i))) & ((1 << (logs - (i >= (NBR - 2)))) - 1)
-        int Gpredict (UINT64 PC, uint64_t BHIST, int *length, int8_t ** tab, int NBR, int logs, int8_t * W)
+        // SC sum of the branch at PC: gathers the counters of all the SC tables into sc, weighted per component
+        int sc_predict (UINT64 PC, const cbp_ckpt_t& hist_to_use)
         {
-            int PERCSUM = 0;
-            for (int i = 0; i < NBR; i++)
-            {
-                uint64_t bhist = BHIST & ((uint64_t) ((1ULL << length[i]) - 1));
-                uint64_t index = GINDEX;
+            sc.clear();
 
-                int8_t ctr = tab[i][index];
+            //integrate BIAS prediction   
+            sc.add (SC_BIAS, &Bias[get_bias_index(PC)]);
+            sc.add (SC_BIAS, &BiasSK[get_biassk_index(PC)]);
+            sc.add (SC_BIAS, &BiasBank[get_biasbank_index(PC)]);
+            //integrate the GEHL predictions
+            Ggather<LOGGNB> (SC_GLOBAL, (PC << 1) + pred_inter, hist_to_use.GHIST, Gm, GGEHL);
+            Ggather<LOGPNB> (SC_PATH, PC, hist_to_use.phist, Pm, PGEHL);
+#ifdef LOCALH
+            Ggather<LOGLNB> (SC_LOCAL, PC, hist_to_use.L_shist, Lm, LGEHL);
+#ifdef LOCALS
+            Ggather<LOGSNB> (SC_SECLOCAL, PC, hist_to_use.S_slhist, Sm, SGEHL);
+#endif
+#ifdef LOCALT
+            Ggather<LOGTNB> (SC_THIRDLOCAL, PC, hist_to_use.T_slhist, Tm, TGEHL);
+#endif
+#endif
+
+#ifdef IMLI
+            Ggather<LOGIMNB> (SC_IMLI_HIST, PC, hist_to_use.IMHIST, IMm, IMGEHL);
+            Ggather<LOGINB> (SC_IMLI_COUNT, PC, hist_to_use.IMLIcount, Im, IGEHL);
+#endif
 
-                PERCSUM += (2 * ctr + 1);
-            }
 #ifdef VARTHRES
-            PERCSUM = (1 + (W[INDUPDS] >= 0)) * PERCSUM;
+            sc.weight[SC_BIAS] = 1 + (WB[INDUPDS] >= 0);
+            sc.weight[SC_GLOBAL] = 1 + (WG[INDUPDS] >= 0);
+            sc.weight[SC_PATH] = 1 + (WP[INDUPDS] >= 0);
+            sc.weight[SC_LOCAL] = 1 + (WL[INDUPDS] >= 0);
+            sc.weight[SC_SECLOCAL] = 1 + (WS[INDUPDS] >= 0);
+            sc.weight[SC_THIRDLOCAL] = 1 + (WT[INDUPDS] >= 0);
+            sc.weight[SC_IMLI_HIST] = 1 + (WIM[INDUPDS] >= 0);
+            sc.weight[SC_IMLI_COUNT] = 1 + (WI[INDUPDS] >= 0);
+#else
+            for (int g = 0; g < SC_GROUPS; g++)
+                sc.weight[g] = 1;
 #endif
-            return ((PERCSUM));
+            return sc.sum ();
         }
-        void Gupdate (UINT64 PC, bool taken, uint64_t BHIST, int *length,
-                int8_t ** tab, int NBR, int logs, int8_t * W)
-        {
 
-            int PERCSUM = 0;
+        // trains the counters gathered by the last sc_predict, and the component weights
+        void sc_update (UINT64 PC, bool resolveDir)
+        {
+#ifdef VARTHRES
+            int PERCSUM[SC_GROUPS];
+            sc.group_sums (PERCSUM);
+            Wupdate (WB[INDUPDS], PERCSUM[SC_BIAS], resolveDir);
+            Wupdate (WG[INDUPDS], PERCSUM[SC_GLOBAL], resolveDir);
+            Wupdate (WP[INDUPDS], PERCSUM[SC_PATH], resolveDir);
+#ifdef LOCALH
+            Wupdate (WL[INDUPDS], PERCSUM[SC_LOCAL], resolveDir);
+#ifdef LOCALS
+            Wupdate (WS[INDUPDS], PERCSUM[SC_SECLOCAL], resolveDir);
+#endif
+#ifdef LOCALT
+            Wupdate (WT[INDUPDS], PERCSUM[SC_THIRDLOCAL], resolveDir);
+#endif
+#endif
+#ifdef IMLI
+            Wupdate (WIM[INDUPDS], PERCSUM[SC_IMLI_HIST], resolveDir);
+            Wupdate (WI[INDUPDS], PERCSUM[SC_IMLI_COUNT], resolveDir);
+#endif
+#endif
+            sc.update (resolveDir);
+        }
 
+        // adds the counters of the NBR tables of a GEHL component to sc
+        // logs and NBR are compile-time constants, so that the loop over the NBR tables is unrolled
+        template <int logs, int NBR>
+        void Ggather (sc_group_t group, UINT64 PC, uint64_t BHIST, const int (&length)[NBR], int8_t (&tab)[NBR][1 << logs])
+        {
             for (int i = 0; i < NBR; i++)
             {
                 uint64_t bhist = BHIST & ((uint64_t) ((1ULL << length[i]) - 1));
                 uint64_t index = GINDEX;
 
-                PERCSUM += (2 * tab[i][index] + 1);
-                ctrupdate (tab[i][index], taken, PERCWIDTH);
+                sc.add (group, &tab[i][index]);
             }
+        }
+
 #ifdef VARTHRES
-            {
-                int XSUM = LSUM - ((W[INDUPDS] >= 0)) * PERCSUM;
-                if ((XSUM + PERCSUM >= 0) != (XSUM >= 0))
-                    ctrupdate (W[INDUPDS], ((PERCSUM >= 0) == taken), EWIDTH);
-            }
-#endif
+        // trains the weight W of an SC component whose partial sum was PERCSUM
+        void Wupdate (int8_t & W, int PERCSUM, bool taken)
+        {
+            int XSUM = LSUM - ((W >= 0)) * PERCSUM;
+            if ((XSUM + PERCSUM >= 0) != (XSUM >= 0))
+                ctrupdate (W, ((PERCSUM >= 0) == taken), EWIDTH);
         }
+#endif
 
 
 
 #ifdef LOOPPREDICTOR
-        int lindex (UINT64 PC)
+        int lindex (UINT64 PC) const
         {
             return (((PC ^ (PC >> 2)) & ((1 << (LOGL - 2)) - 1)) << 2);
         }
 
+        // loop table entry of the given way of the skewed associative set of PC
+        int lway (UINT64 PC, int way) const
+        {
+            const int lib = ((PC >> (LOGL - 2)) & ((1 << (LOGL - 2)) - 1));
+            return (lindex (PC) ^ ((lib >> way) << 2)) + way;
+        }
+
 
         //loop prediction: only used if high confidence
         //skewed associative 4-way
         //At fetch time: speculative
 #define CONFLOOP 15
-        bool getloop (UINT64 PC, const cbp_hist_t& hist_to_use)
+        bool getloop (UINT64 PC, const cbp_ckpt_t& hist_to_use)
         {
-            const auto& ltable = hist_to_use.ltable;
+            // the 4 ways of the set, as read at predict time
+            const auto& lways = hist_to_use.lways;
             LHIT = -1;
 
             LI = lindex (PC);
@@ -1637,18 +2207,18 @@ class CBP2016_TAGE_SC_L
 
             for (int i = 0; i < 4; i++)
             {
-                int index = (LI ^ ((LIB >> i) << 2)) + i;
+                const lentry& way = lways[i];
 
-                if (ltable[index].TAG == LTAG)
+                if (way.TAG == LTAG)
                 {
                     LHIT = i;
-                    LVALID = ((ltable[index].confid == CONFLOOP)
-                            || (ltable[index].confid * ltable[index].NbIter > 128));
+                    LVALID = ((way.confid == CONFLOOP)
+                            || (way.confid * way.NbIter > 128));
 
 
-                    if (ltable[index].CurrentIter + 1 == ltable[index].NbIter)
-                        return (!(ltable[index].dir));
-                    return ((ltable[index].dir));
+                    if (way.CurrentIter + 1 == way.NbIter)
+                        return (!(way.dir));
+                    return ((way.dir));
 
                 }
             }
@@ -1659,11 +2229,12 @@ class CBP2016_TAGE_SC_L
 
 
 
-        void loopupdate (UINT64 PC, bool Taken, bool ALLOC, std::vector<lentry>& ltable)
+        void loopupdate (UINT64 PC, bool Taken, bool ALLOC, std::array<lentry, (1 << LOGL)>& ltable)
         {
             if (LHIT >= 0)
             {
                 int index = (LI ^ ((LIB >> LHIT) << 2)) + LHIT;
+                loop_undo_log.record(index, ltable[index]);
                 //already a hit 
                 if (LVALID)
                 {
@@ -1736,6 +2307,7 @@ class CBP2016_TAGE_SC_L
                     {
                         int loop_hit_way_loc = (X + i) & 3;
                         int index = (LI ^ ((LIB >> loop_hit_way_loc) << 2)) + loop_hit_way_loc;
+                        loop_undo_log.record(index, ltable[index]);
                         if (ltable[index].age == 0)
                         {
                             ltable[index].dir = !Taken;
@@ -1764,4 +2336,4 @@ class CBP2016_TAGE_SC_L
 #undef UINT64
 
 #endif
-static CBP2016_TAGE_SC_L cbp2016_tage_sc_l;
+
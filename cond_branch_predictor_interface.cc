@@ -19,8 +19,13 @@
 #include "lib/sim_common_structs.h"
 #include "cbp2016_tage_sc_l.h"
 #include "my_cond_branch_predictor.h"
+#include "lib/snapshot.h"
 #include <cassert>
 
+// One predictor per simulation thread (see cbp --batch).
+// Instantiate CBP2016_TAGE_SC_L<TAGE_SC_L_192KB> instead to use the whole 192KB budget for Tage-SC-L.
+static thread_local CBP2016_TAGE_SC_L<TAGE_SC_L_64KB> cbp2016_tage_sc_l;
+
 //
 // beginCondDirPredictor()
 // 
@@ -176,3 +181,14 @@ void endCondDirPredictor ()
     cbp2016_tage_sc_l.terminate();
     cond_predictor_impl.terminate();
 }
+
+//
+// snapshotCondDirPredictor(snapshot_t& s)
+//
+// This function is called by the simulator to save the predictor state to a snapshot, or restore it.
+//
+void snapshotCondDirPredictor(snapshot_t& s)
+{
+    cbp2016_tage_sc_l.snapshot(s);
+    cond_predictor_impl.snapshot(s);
+}
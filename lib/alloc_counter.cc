@@ -0,0 +1,51 @@
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include "alloc_counter.h"
+
+static std::atomic<uint64_t> num_heap_allocs{0};
+
+uint64_t heap_alloc_count()
+{
+   return num_heap_allocs.load(std::memory_order_relaxed);
+}
+
+void *operator new(std::size_t size)
+{
+   num_heap_allocs.fetch_add(1, std::memory_order_relaxed);
+   if (size == 0)
+      size = 1;
+   while (true) {
+      if (void *p = std::malloc(size))
+         return p;
+      std::new_handler handler = std::get_new_handler();
+      if (!handler)
+         throw std::bad_alloc();
+      handler();
+   }
+}
+
+void *operator new[](std::size_t size)
+{
+   return ::operator new(size);
+}
+
+void operator delete(void *p) noexcept
+{
+   std::free(p);
+}
+
+void operator delete[](void *p) noexcept
+{
+   std::free(p);
+}
+
+void operator delete(void *p, std::size_t) noexcept
+{
+   std::free(p);
+}
+
+void operator delete[](void *p, std::size_t) noexcept
+{
+   std::free(p);
+}
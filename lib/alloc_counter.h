@@ -0,0 +1,21 @@
+#pragma once
+
+// Global heap allocation counter.
+// alloc_counter.cc replaces the global operator new/delete so that every
+// allocation made by the simulator binary (simulator, trace reader and
+// contestant's predictor) is counted. Used to verify that the per-instruction
+// path does not allocate.
+
+#include <cstdint>
+
+uint64_t heap_alloc_count();
+
+// Runs f() and adds the heap allocations it made to count: the calls into the contestant's
+// predictor hooks are counted this way, apart from the simulator's own allocations.
+template <class F>
+inline void count_allocs(uint64_t& count, F&& f)
+{
+   const uint64_t mark = heap_alloc_count();
+   f();
+   count += heap_alloc_count() - mark;
+}
@@ -31,6 +31,7 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "sim_common_structs.h"
 #include "bp.h"
 #include "cbp.h"
+#include "alloc_counter.h"
 #include "parameters.h"
 
 #include "parameters.h"
@@ -66,6 +67,7 @@ bp_t::bp_t()
 }
 
 bp_t::~bp_t() {
+   delete ITTAGE;
 }
 
 // Returns true if instruction is a mispredicted branch.
@@ -86,7 +88,7 @@ bool bp_t::predict(uint64_t seq_no, uint8_t piece, InstClass inst_class, uint64_
 
       // Make prediction.
       //pred_taken= TAGESCL->GetPrediction (pc);
-      pred_taken = get_cond_dir_prediction (seq_no, piece, pc, pred_cycle);
+      count_allocs(hook_allocs, [&] { pred_taken = get_cond_dir_prediction (seq_no, piece, pc, pred_cycle); });
       
       // Determine if mispredicted or not.
       misp = (pred_taken != taken);
@@ -109,7 +111,7 @@ bool bp_t::predict(uint64_t seq_no, uint8_t piece, InstClass inst_class, uint64_
       //spec_update(seq_no, piece, pc, inst_class, taken, pred_taken, next_pc);
       //temp_predictor_update_hook(seq_no, piece, pc, taken,pred_taken, next_pc);
       // OOO Update Option
-      spec_update(seq_no, piece, pc, inst_class, taken, pred_taken, next_pc);
+      count_allocs(hook_allocs, [&] { spec_update(seq_no, piece, pc, inst_class, taken, pred_taken, next_pc); });
       // Update measurements.
       meas_conddir_n_per_epoch.back()++;
       meas_conddir_m_per_epoch.back() += misp;
@@ -125,7 +127,7 @@ bool bp_t::predict(uint64_t seq_no, uint8_t piece, InstClass inst_class, uint64_
       /* A. Seznec: update branch  histories for TAGE-SC-L and ITTAGE */
       //TAGESCL->TrackOtherInst(pc , 0,  true,next_pc);
       //TrackOtherInst(pc , 0,  true,next_pc);
-      spec_update(seq_no, piece, pc, inst_class, true/*taken*/, true/*pred_taken*/, next_pc);
+      count_allocs(hook_allocs, [&] { spec_update(seq_no, piece, pc, inst_class, true/*taken*/, true/*pred_taken*/, next_pc); });
       if(!PERFECT_INDIRECT_PRED)
       {
           ITTAGE->TrackOtherInst(pc , next_pc);
@@ -161,7 +163,7 @@ bool bp_t::predict(uint64_t seq_no, uint8_t piece, InstClass inst_class, uint64_
          meas_jumpret_m_per_epoch.back() += is_ret && misp;
       }
 
-      spec_update(seq_no, piece, pc, inst_class, true/*taken*/, true/*pred_taken*/, next_pc);
+      count_allocs(hook_allocs, [&] { spec_update(seq_no, piece, pc, inst_class, true/*taken*/, true/*pred_taken*/, next_pc); });
       /* A. Seznec: update history for TAGE-SC-L */
       //TAGESCL->TrackOtherInst(pc , 2,  true,next_pc);
       //TrackOtherInst(pc , 2,  true,next_pc);
@@ -203,6 +205,47 @@ void bp_t::update_cycles_on_wrong_path(const uint64_t cycles_on_wrong_path)
     meas_cycles_on_wrong_path_per_epoch.back() += cycles_on_wrong_path;
 }
 
+uint64_t bp_t::num_cond_mispredicted() const
+{
+    return std::accumulate(meas_conddir_m_per_epoch.begin(), meas_conddir_m_per_epoch.end(), (uint64_t)0);
+}
+
+void bp_t::drop_epochs(const size_t count)
+{
+    for (std::vector<uint64_t> *meas : {&meas_conddir_n_per_epoch, &meas_conddir_m_per_epoch, &meas_jumpdir_n_per_epoch,
+                                        &meas_jumpind_n_per_epoch, &meas_jumpind_m_per_epoch, &meas_jumpret_n_per_epoch, &meas_jumpret_m_per_epoch,
+                                        &meas_notctrl_n_per_epoch, &meas_notctrl_m_per_epoch, &meas_cycles_on_wrong_path_per_epoch})
+        meas->erase(meas->begin(), meas->begin() + count);
+}
+
+void bp_t::append_epochs(const bp_t& other, const size_t first, const size_t count)
+{
+    auto append = [first, count](std::vector<uint64_t>& to, const std::vector<uint64_t>& from) {
+        to.insert(to.end(), from.begin() + first, from.begin() + first + count);
+    };
+    append(meas_conddir_n_per_epoch, other.meas_conddir_n_per_epoch);
+    append(meas_conddir_m_per_epoch, other.meas_conddir_m_per_epoch);
+    append(meas_jumpdir_n_per_epoch, other.meas_jumpdir_n_per_epoch);
+    append(meas_jumpind_n_per_epoch, other.meas_jumpind_n_per_epoch);
+    append(meas_jumpind_m_per_epoch, other.meas_jumpind_m_per_epoch);
+    append(meas_jumpret_n_per_epoch, other.meas_jumpret_n_per_epoch);
+    append(meas_jumpret_m_per_epoch, other.meas_jumpret_m_per_epoch);
+    append(meas_notctrl_n_per_epoch, other.meas_notctrl_n_per_epoch);
+    append(meas_notctrl_m_per_epoch, other.meas_notctrl_m_per_epoch);
+    append(meas_cycles_on_wrong_path_per_epoch, other.meas_cycles_on_wrong_path_per_epoch);
+}
+
+cond_br_meas_t bp_t::measure_epoch(const std::vector<uint64_t>&num_insts_per_epoch, const std::vector<uint64_t>&num_cycles_per_epoch, const size_t epoch) const
+{
+    cond_br_meas_t meas;
+    meas.instr                  = num_insts_per_epoch.at(epoch);
+    meas.cycles                 = num_cycles_per_epoch.at(epoch);
+    meas.num_br                 = meas_conddir_n_per_epoch.at(epoch);
+    meas.misp_br                = meas_conddir_m_per_epoch.at(epoch);
+    meas.cycles_on_wrong_path   = meas_cycles_on_wrong_path_per_epoch.at(epoch);
+    return meas;
+}
+
 #define BP_OUTPUT(str, n, m, i) \
     printf("%s%10ld %10ld %8.4lf%% %8.4lf\n", (str), (n), (m), 100.0*((double)(m)/(double)(n)), 1000.0*((double)(m)/(double)(i)))
 
@@ -236,6 +279,26 @@ void bp_t::output(const uint64_t num_inst)
    printf("------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------\n");
 }
 
+// Sums the per-epoch measurements of the most recent epochs, going back until more than
+// target_instr_count instructions are covered (or all epochs have been added).
+cond_br_meas_t bp_t::measure_cond_br(const std::vector<uint64_t>&num_insts_per_epoch, const std::vector<uint64_t>&num_cycles_per_epoch, const uint64_t target_instr_count) const
+{
+   cond_br_meas_t meas;
+   for(int epoch_index = num_insts_per_epoch.size() -1; epoch_index >= 0; epoch_index--)
+   {
+        meas.instr                  += num_insts_per_epoch.at(epoch_index);
+        meas.cycles                 += num_cycles_per_epoch.at(epoch_index);
+        meas.num_br                 += meas_conddir_n_per_epoch.at(epoch_index);
+        meas.misp_br                += meas_conddir_m_per_epoch.at(epoch_index);
+        meas.cycles_on_wrong_path   += meas_cycles_on_wrong_path_per_epoch.at(epoch_index);
+        if(meas.instr > target_instr_count)
+        {
+            break;
+        }
+   }
+   return meas;
+}
+
 void bp_t::output_periodic_info(const std::vector<uint64_t>&num_insts_per_epoch, const std::vector<uint64_t>&num_cycles_per_epoch)
 {
    assert(num_insts_per_epoch.size() == num_cycles_per_epoch.size());
@@ -244,23 +307,12 @@ void bp_t::output_periodic_info(const std::vector<uint64_t>&num_insts_per_epoch,
       const uint64_t target_instr_count = 10000000;
       printf("\n------------------------------------------------------DIRECT CONDITIONAL BRANCH PREDICTION MEASUREMENTS (Last 10M instructions)-----------------------------------------------------\n");
       printf("       Instr       Cycles      IPC      NumBr     MispBr BrPerCyc MispBrPerCyc        MR     MPKI      CycWP   CycWPAvg   CycWPPKI\n");
-      uint64_t my_instr_count = 0;
-      uint64_t my_cycle_count = 0;
-      uint64_t my_br_count = 0;
-      uint64_t my_br_mispred_count = 0;
-      uint64_t my_wpc_count = 0;
-      for(int epoch_index = num_insts_per_epoch.size() -1; epoch_index >= 0; epoch_index--)
-      {
-           my_instr_count       += num_insts_per_epoch.at(epoch_index);
-           my_cycle_count       += num_cycles_per_epoch.at(epoch_index);
-           my_br_count          += meas_conddir_n_per_epoch.at(epoch_index);
-           my_br_mispred_count  += meas_conddir_m_per_epoch.at(epoch_index);
-           my_wpc_count         += meas_cycles_on_wrong_path_per_epoch.at(epoch_index);
-           if(my_instr_count > target_instr_count)
-           {
-               break;
-           }
-      }
+      const cond_br_meas_t meas = measure_cond_br(num_insts_per_epoch, num_cycles_per_epoch, target_instr_count);
+      const uint64_t my_instr_count = meas.instr;
+      const uint64_t my_cycle_count = meas.cycles;
+      const uint64_t my_br_count = meas.num_br;
+      const uint64_t my_br_mispred_count = meas.misp_br;
+      const uint64_t my_wpc_count = meas.cycles_on_wrong_path;
       const double cyc_wp_avg =  (my_br_mispred_count == 0) ? 0.00 : (double)my_wpc_count/(double)my_br_mispred_count;
       const double cyc_wp_pki =  (double)my_wpc_count*1000/(double)my_instr_count;
       printf("%12ld %12ld %8.4f %10ld %10ld %8.4lf %12.4lf %8.4lf%% %8.4lf %10ld %10.4lf %10.4lf\n", my_instr_count, my_cycle_count, (double)my_instr_count/(double)my_cycle_count, my_br_count, my_br_mispred_count, (double)(my_br_count)/(double)(my_cycle_count), (double)(my_br_mispred_count)/(double)(my_cycle_count), 100.0*((double)(my_br_mispred_count)/(double)(my_br_count)), 1000.0*((double)(my_br_mispred_count)/(double)(my_instr_count)), my_wpc_count, cyc_wp_avg, cyc_wp_pki);
@@ -271,23 +323,12 @@ void bp_t::output_periodic_info(const std::vector<uint64_t>&num_insts_per_epoch,
       const uint64_t target_instr_count = 25000000;
       printf("\n------------------------------------------------------DIRECT CONDITIONAL BRANCH PREDICTION MEASUREMENTS (Last 25M instructions)-----------------------------------------------------\n");
       printf("       Instr       Cycles      IPC      NumBr     MispBr BrPerCyc MispBrPerCyc        MR     MPKI      CycWP   CycWPAvg   CycWPPKI\n");
-      uint64_t my_instr_count = 0;
-      uint64_t my_cycle_count = 0;
-      uint64_t my_br_count = 0;
-      uint64_t my_br_mispred_count = 0;
-      uint64_t my_wpc_count = 0;
-      for(int epoch_index = num_insts_per_epoch.size() -1; epoch_index >= 0; epoch_index--)
-      {
-           my_instr_count       += num_insts_per_epoch.at(epoch_index);
-           my_cycle_count       += num_cycles_per_epoch.at(epoch_index);
-           my_br_count          += meas_conddir_n_per_epoch.at(epoch_index);
-           my_br_mispred_count  += meas_conddir_m_per_epoch.at(epoch_index);
-           my_wpc_count         += meas_cycles_on_wrong_path_per_epoch.at(epoch_index);
-           if(my_instr_count > target_instr_count)
-           {
-               break;
-           }
-      }
+      const cond_br_meas_t meas = measure_cond_br(num_insts_per_epoch, num_cycles_per_epoch, target_instr_count);
+      const uint64_t my_instr_count = meas.instr;
+      const uint64_t my_cycle_count = meas.cycles;
+      const uint64_t my_br_count = meas.num_br;
+      const uint64_t my_br_mispred_count = meas.misp_br;
+      const uint64_t my_wpc_count = meas.cycles_on_wrong_path;
       const double cyc_wp_avg =  (my_br_mispred_count == 0) ? 0.00 : (double)my_wpc_count/(double)my_br_mispred_count;
       const double cyc_wp_pki =  (double)my_wpc_count*1000/(double)my_instr_count;
       printf("%12ld %12ld %8.4f %10ld %10ld %8.4lf %12.4lf %8.4lf%% %8.4lf %10ld %10.4lf %10.4lf\n", my_instr_count, my_cycle_count, (double)my_instr_count/(double)my_cycle_count, my_br_count, my_br_mispred_count, (double)(my_br_count)/(double)(my_cycle_count), (double)(my_br_mispred_count)/(double)(my_cycle_count), 100.0*((double)(my_br_mispred_count)/(double)(my_br_count)), 1000.0*((double)(my_br_mispred_count)/(double)(my_instr_count)), my_wpc_count, cyc_wp_avg, cyc_wp_pki);
@@ -299,23 +340,12 @@ void bp_t::output_periodic_info(const std::vector<uint64_t>&num_insts_per_epoch,
       const uint64_t target_instr_count = total_instr/2;
       printf("\n---------------------------------------------------------DIRECT CONDITIONAL BRANCH PREDICTION MEASUREMENTS (50 Perc instructions)---------------------------------------------------\n");
       printf("       Instr       Cycles      IPC      NumBr     MispBr BrPerCyc MispBrPerCyc        MR     MPKI      CycWP   CycWPAvg   CycWPPKI\n");
-      uint64_t my_instr_count = 0;
-      uint64_t my_cycle_count = 0;
-      uint64_t my_br_count = 0;
-      uint64_t my_br_mispred_count = 0;
-      uint64_t my_wpc_count = 0;
-      for(int epoch_index = num_insts_per_epoch.size() -1; epoch_index >= 0; epoch_index--)
-      {
-           my_instr_count       += num_insts_per_epoch.at(epoch_index);
-           my_cycle_count       += num_cycles_per_epoch.at(epoch_index);
-           my_br_count          += meas_conddir_n_per_epoch.at(epoch_index);
-           my_br_mispred_count  += meas_conddir_m_per_epoch.at(epoch_index);
-           my_wpc_count         += meas_cycles_on_wrong_path_per_epoch.at(epoch_index);
-           if(my_instr_count > target_instr_count)
-           {
-               break;
-           }
-      }
+      const cond_br_meas_t meas = measure_cond_br(num_insts_per_epoch, num_cycles_per_epoch, target_instr_count);
+      const uint64_t my_instr_count = meas.instr;
+      const uint64_t my_cycle_count = meas.cycles;
+      const uint64_t my_br_count = meas.num_br;
+      const uint64_t my_br_mispred_count = meas.misp_br;
+      const uint64_t my_wpc_count = meas.cycles_on_wrong_path;
       const double cyc_wp_avg =  (my_br_mispred_count == 0) ? 0.00 : (double)my_wpc_count/(double)my_br_mispred_count;
       const double cyc_wp_pki =  (double)my_wpc_count*1000/(double)my_instr_count;
       printf("%12ld %12ld %8.4f %10ld %10ld %8.4lf %12.4lf %8.4lf%% %8.4lf %10ld %10.4lf %10.4lf\n", my_instr_count, my_cycle_count, (double)my_instr_count/(double)my_cycle_count, my_br_count, my_br_mispred_count, (double)(my_br_count)/(double)(my_cycle_count), (double)(my_br_mispred_count)/(double)(my_cycle_count), 100.0*((double)(my_br_mispred_count)/(double)(my_br_count)), 1000.0*((double)(my_br_mispred_count)/(double)(my_instr_count)), my_wpc_count, cyc_wp_avg, cyc_wp_pki);
@@ -327,23 +357,12 @@ void bp_t::output_periodic_info(const std::vector<uint64_t>&num_insts_per_epoch,
       const uint64_t target_instr_count = total_instr;
       printf("\n-------------------------------------DIRECT CONDITIONAL BRANCH PREDICTION MEASUREMENTS (Full Simulation i.e. Counts Not Reset When Warmup Ends)-------------------------------------\n");
       printf("       Instr       Cycles      IPC      NumBr     MispBr BrPerCyc MispBrPerCyc        MR     MPKI      CycWP   CycWPAvg   CycWPPKI\n");
-      uint64_t my_instr_count = 0;
-      uint64_t my_cycle_count = 0;
-      uint64_t my_br_count = 0;
-      uint64_t my_br_mispred_count = 0;
-      uint64_t my_wpc_count = 0;
-      for(int epoch_index = num_insts_per_epoch.size() -1; epoch_index >= 0; epoch_index--)
-      {
-           my_instr_count       += num_insts_per_epoch.at(epoch_index);
-           my_cycle_count       += num_cycles_per_epoch.at(epoch_index);
-           my_br_count          += meas_conddir_n_per_epoch.at(epoch_index);
-           my_br_mispred_count  += meas_conddir_m_per_epoch.at(epoch_index);
-           my_wpc_count         += meas_cycles_on_wrong_path_per_epoch.at(epoch_index);
-           if(my_instr_count > target_instr_count)
-           {
-               break;
-           }
-      }
+      const cond_br_meas_t meas = measure_cond_br(num_insts_per_epoch, num_cycles_per_epoch, target_instr_count);
+      const uint64_t my_instr_count = meas.instr;
+      const uint64_t my_cycle_count = meas.cycles;
+      const uint64_t my_br_count = meas.num_br;
+      const uint64_t my_br_mispred_count = meas.misp_br;
+      const uint64_t my_wpc_count = meas.cycles_on_wrong_path;
       const double cyc_wp_avg =  (my_br_mispred_count == 0) ? 0.00 : (double)my_wpc_count/(double)my_br_mispred_count;
       const double cyc_wp_pki =  (double)my_wpc_count*1000/(double)my_instr_count;
       printf("%12ld %12ld %8.4f %10ld %10ld %8.4lf %12.4lf %8.4lf%% %8.4lf %10ld %10.4lf %10.4lf\n", my_instr_count, my_cycle_count, (double)my_instr_count/(double)my_cycle_count, my_br_count, my_br_mispred_count, (double)(my_br_count)/(double)(my_cycle_count), (double)(my_br_mispred_count)/(double)(my_cycle_count), 100.0*((double)(my_br_mispred_count)/(double)(my_br_count)), 1000.0*((double)(my_br_mispred_count)/(double)(my_instr_count)), my_wpc_count, cyc_wp_avg, cyc_wp_pki);
@@ -370,3 +389,14 @@ void bp_t::output_periodic_info(const std::vector<uint64_t>&num_insts_per_epoch,
       printf("------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------\n");
    }
 }
+
+void bp_t::snapshot(snapshot_t& s)
+{
+   s.section("bp");
+   if (ITTAGE)
+      ITTAGE->snapshot(s);
+   snapshot_fields(s, mispred_correction_seed,
+                   meas_conddir_n_per_epoch, meas_conddir_m_per_epoch, meas_jumpdir_n_per_epoch,
+                   meas_jumpind_n_per_epoch, meas_jumpind_m_per_epoch, meas_jumpret_n_per_epoch, meas_jumpret_m_per_epoch,
+                   meas_notctrl_n_per_epoch, meas_notctrl_m_per_epoch, meas_cycles_on_wrong_path_per_epoch);
+}
@@ -53,6 +53,15 @@ public:
     }
 };
 
+// Direct conditional branch measurements over a range of epochs.
+struct cond_br_meas_t {
+    uint64_t instr = 0;
+    uint64_t cycles = 0;
+    uint64_t num_br = 0;
+    uint64_t misp_br = 0;
+    uint64_t cycles_on_wrong_path = 0;
+};
+
 class bp_t {
 private:
     //// Conditional branch predictor based on CBP-5 TAGE-SC-L
@@ -98,6 +107,8 @@ private:
 
     std::vector<uint64_t> meas_cycles_on_wrong_path_per_epoch;
 
+    uint64_t hook_allocs = 0;   // heap allocations in get_cond_dir_prediction/spec_update
+
 public:
     bp_t();
     ~bp_t();
@@ -109,7 +120,21 @@ public:
     // Output all branch prediction measurements.
     void output(const uint64_t num_inst);
     void output_periodic_info(const std::vector<uint64_t>&num_insts_per_epoch, const std::vector<uint64_t>&num_cycles_per_epoch);
+    cond_br_meas_t measure_cond_br(const std::vector<uint64_t>&num_insts_per_epoch, const std::vector<uint64_t>&num_cycles_per_epoch, const uint64_t target_instr_count) const;
     void notify_begin_new_epoch();
     void update_cycles_on_wrong_path(const uint64_t cycles_on_wrong_path);
+    // Mispredicted conditional branches so far, all epochs together.
+    uint64_t num_cond_mispredicted() const;
+    // Heap allocations made by the conditional branch predictor hooks called from predict().
+    uint64_t get_hook_allocs() const { return hook_allocs; }
+    // Per-epoch measurements of sharded simulations (cbp --shards): drops those of the first
+    // count epochs, or appends those of epochs [first, first + count) of another predictor.
+    void drop_epochs(const size_t count);
+    void append_epochs(const bp_t& other, const size_t first, const size_t count);
+    // Conditional branch measurements of a single epoch.
+    cond_br_meas_t measure_epoch(const std::vector<uint64_t>&num_insts_per_epoch, const std::vector<uint64_t>&num_cycles_per_epoch, const size_t epoch) const;
+    // The indirect target predictor and the measurements; the conditional branch predictor is
+    // saved separately (snapshotCondDirPredictor).
+    void snapshot(snapshot_t& s);
 };
 
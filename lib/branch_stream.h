@@ -0,0 +1,119 @@
+#pragma once
+
+// Branch-only condensed trace (.cbpb).
+//
+// Holds, in program order, only the branch micro-ops of a trace together with the ids the cbp.h
+// hooks see for them in the timing simulator (seq_no/piece), so that a conditional branch predictor
+// can be trained and measured without simulating the pipeline (see cbp.cc: fast-forward mode).
+//
+// The file is a gzip stream of:
+//   cbpb_header_t
+//   cbpb_record_t[]    - one per branch uop
+//   cbpb_record_t      - end record: insn_class is undefInstClass, seq_no/inst_no hold the
+//                        total uop/instruction counts of the trace
+// Totals come last so that the converter can stream records out without buffering them.
+//
+// Produced by "trace_convert -b" from a .gz or .cbpt trace.
+
+#include <cassert>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include "sim_common_structs.h"
+#include "./gzstream.h"
+
+static constexpr char CBPB_MAGIC[8] = {'C', 'B', 'P', 'B', 'R', 'N', 'C', 'H'};
+static constexpr uint32_t CBPB_VERSION = 1;
+
+struct cbpb_header_t
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+};
+
+struct cbpb_record_t
+{
+    uint64_t seq_no;        // uop id, as passed to the cbp.h hooks
+    uint64_t inst_no;       // trace instructions that precede this branch
+    uint64_t pc;
+    uint64_t next_pc;
+    uint8_t piece;
+    InstClass insn_class;
+    bool taken;
+    uint8_t reserved[5];
+};
+
+static_assert(sizeof(cbpb_record_t) == 40, "cbpb_record_t is a file format");
+
+// Returns true if the (gzip) file at path holds a branch stream.
+inline bool is_cbpb_file(const char * path)
+{
+    gz::igzstream input;
+    input.open(path, std::ios_base::in | std::ios_base::binary);
+    char magic[sizeof(CBPB_MAGIC)];
+    input.read(magic, sizeof(magic));
+    return (input.gcount() == sizeof(magic)) && !memcmp(magic, CBPB_MAGIC, sizeof(magic));
+}
+
+// Sequential reader, pulls records from the gzip stream in blocks.
+class cbpb_reader_t
+{
+    gz::igzstream input;
+    std::vector<cbpb_record_t> block;
+    size_t block_pos = 0;
+    size_t block_len = 0;
+    bool done = false;
+
+    // Totals, valid once next() returned nullptr.
+    uint64_t num_insts = 0;
+    uint64_t num_uops = 0;
+
+public:
+    explicit cbpb_reader_t(const char * path)
+        : block(4096)
+    {
+        cbpb_header_t header;
+        input.open(path, std::ios_base::in | std::ios_base::binary);
+        input.read((char *)&header, sizeof(header));
+        if ((input.gcount() != sizeof(header)) || memcmp(header.magic, CBPB_MAGIC, sizeof(CBPB_MAGIC)) || (header.version != CBPB_VERSION))
+        {
+            printf("%s is not a valid version %u branch stream.\n", path, CBPB_VERSION);
+            exit(1);
+        }
+    }
+
+    // Next branch in program order, nullptr after the end record.
+    const cbpb_record_t * next()
+    {
+        if (done)
+            return nullptr;
+
+        if (block_pos == block_len)
+        {
+            input.read((char *)block.data(), block.size() * sizeof(cbpb_record_t));
+            block_len = input.gcount() / sizeof(cbpb_record_t);
+            block_pos = 0;
+            if (block_len == 0)
+            {
+                printf("Truncated branch stream.\n");
+                exit(1);
+            }
+        }
+
+        const cbpb_record_t * rec = &block[block_pos++];
+        if (rec->insn_class == InstClass::undefInstClass)
+        {
+            num_uops = rec->seq_no;
+            num_insts = rec->inst_no;
+            done = true;
+            return nullptr;
+        }
+        return rec;
+    }
+
+    uint64_t get_num_insts() const { assert(done); return num_insts; }
+    uint64_t get_num_uops() const { assert(done); return num_uops; }
+};
@@ -26,11 +26,45 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <assert.h>
 #include <inttypes.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <immintrin.h>
+#endif
 #include "parameters.h"
 #include "cache.h"
+#include "resource_schedule.h"
+#include "snapshot.h"
+
+
+// zero-filled, 64-byte aligned array of n elements (a set of up to 8 ways per cache line)
+template <class T>
+static T *alloc_sets(uint64_t n) {
+   const size_t bytes = ((n * sizeof(T)) + 63) & ~(size_t)63;
+   T *p = (T *)aligned_alloc(64, bytes);
+   assert(p);
+   memset(p, 0, bytes);
+   return p;
+}
+
+static const char *const cache_repl_names[] = { "lru", "plru", "srrip", "brrip", "random" };
+static_assert(sizeof(cache_repl_names) / sizeof(cache_repl_names[0]) == (size_t)CacheRepl::NumPolicies, "one name per policy");
 
+const char *cache_repl_name(CacheRepl repl) {
+   return cache_repl_names[(int)repl];
+}
 
-cache_t::cache_t(uint64_t size, uint64_t assoc, uint64_t blocksize, uint64_t latency, cache_t *next_level) {
+bool parse_cache_repl(const char *name, CacheRepl& repl) {
+   for (int i = 0; i < (int)CacheRepl::NumPolicies; i++) {
+      if (!strcmp(name, cache_repl_names[i])) {
+         repl = (CacheRepl)i;
+         return true;
+      }
+   }
+   return false;
+}
+
+cache_t::cache_t(uint64_t size, uint64_t assoc, uint64_t blocksize, uint64_t latency, cache_t *next_level, CacheRepl repl) {
    uint64_t num_sets;
 
    assert(IsPow2(blocksize));
@@ -40,37 +74,159 @@ cache_t::cache_t(uint64_t size, uint64_t assoc, uint64_t blocksize, uint64_t lat
    assert(IsPow2(num_sets));
    this->num_index_bits = log2(num_sets);
    this->index_mask = (num_sets - 1);
+   assert((num_index_bits + num_offset_bits) > 0);   // so that no tag is INVALID_TAG
 
    this->assoc = assoc;
+   assert(assoc < LRU_PAD);
 
-   C = new block_t *[num_sets];
+   this->repl = repl;
+   if ((repl == CacheRepl::PLRU) && !IsPow2(assoc)) {
+      printf("Tree-PLRU replacement needs a power-of-2 associativity (got %lu ways).\n", assoc);
+      exit(0);
+   }
+   rng = 0x9e3779b97f4a7c15;
+
+   way_stride = (assoc + 3) & ~(uint64_t)3;
+   tags = alloc_sets<uint64_t>(num_sets * way_stride);
+   timestamps = alloc_sets<uint64_t>(num_sets * way_stride);
+   dirty = alloc_sets<uint8_t>(num_sets * way_stride);
+   repl_stride = ((assoc <= 16) ? 16 : assoc);
+   repl_state = alloc_sets<uint8_t>(num_sets * repl_stride);
    for (uint64_t i = 0; i < num_sets; i++) {
-      C[i] = new block_t[assoc];
-      for (uint64_t j = 0; j < assoc; j++) {
-         C[i][j].valid = false;
-     C[i][j].lru = j;
+      for (uint64_t j = 0; j < way_stride; j++)
+         tags[i * way_stride + j] = INVALID_TAG;
+      for (uint64_t j = 0; j < repl_stride; j++) {
+         uint8_t init = 0;
+         if (repl == CacheRepl::LRU)
+            init = ((j < assoc) ? j : LRU_PAD);
+         else if ((repl == CacheRepl::SRRIP) || (repl == CacheRepl::BRRIP))
+            init = RRPV_MAX;
+         repl_state[i * repl_stride + j] = init;
       }
    }
 
    this->latency = latency;
    this->next_level = next_level;
+   bus = new resource_schedule(1);
 
    accesses = 0;
+   pf_accesses = 0;
    misses = 0;
+   pf_misses = 0;
+   writebacks = 0;
 }
 
 cache_t::~cache_t() {
+   free(tags);
+   free(timestamps);
+   free(dirty);
+   free(repl_state);
+   delete bus;
+}
+
+// Looks up tag in set index; on a hit, way is the matching way.
+bool cache_t::find_way(uint64_t index, uint64_t tag, uint64_t& way) const {
+   const uint64_t *set = &tags[index * way_stride];
+#ifdef __AVX2__
+   const __m256i key = _mm256_set1_epi64x(tag);
+   for (uint64_t w = 0; w < way_stride; w += 4) {
+      const __m256i eq = _mm256_cmpeq_epi64(_mm256_load_si256((const __m256i *)&set[w]), key);
+      const int hits = _mm256_movemask_pd(_mm256_castsi256_pd(eq));
+      if (hits) {
+         way = w + __builtin_ctz(hits);
+         return true;
+      }
+   }
+#else
+   for (uint64_t w = 0; w < assoc; w++) {
+      if (set[w] == tag) {
+         way = w;
+         return true;
+      }
+   }
+#endif
+   return false;
+}
+
+uint64_t cache_t::next_random() {
+   rng ^= rng << 13;
+   rng ^= rng >> 7;
+   rng ^= rng << 17;
+   return rng;
+}
+
+// The way of set index to replace on a miss.
+uint64_t cache_t::victim_way(uint64_t index) {
+   if (repl == CacheRepl::LRU)
+      return lru_way(index);   // invalid ways are always the least recently used
+
+   // other policies fill the invalid ways first (padding ways come after the real ones)
+   uint64_t way;
+   if (find_way(index, INVALID_TAG, way) && (way < assoc))
+      return way;
+
+   switch (repl) {
+      case CacheRepl::PLRU:
+         return plru_way(index);
+      case CacheRepl::SRRIP:
+      case CacheRepl::BRRIP:
+         return rrip_way(index);
+      default:
+         return next_random() % assoc;
+   }
+}
+
+// Updates the replacement state of set index for an access to way: a hit, or the fill of a miss.
+void cache_t::touch(uint64_t index, uint64_t way, bool fill) {
+   uint8_t *set = &repl_state[index * repl_stride];
+   switch (repl) {
+      case CacheRepl::LRU:
+         update_lru(index, way);
+         break;
+      case CacheRepl::PLRU:
+         update_plru(index, way);
+         break;
+      case CacheRepl::SRRIP:
+         // hits are predicted near-immediate re-reference, fills long
+         set[way] = (fill ? (RRPV_MAX - 1) : 0);
+         break;
+      case CacheRepl::BRRIP:
+         // fills are predicted distant re-reference, but 1 in 32
+         set[way] = (fill ? (((next_random() & 31) == 0) ? (RRPV_MAX - 1) : RRPV_MAX) : 0);
+         break;
+      default:
+         break;
+   }
+}
+
+// The LRU way of set index, i.e., the victim on a miss.
+uint64_t cache_t::lru_way(uint64_t index) const {
+   const uint8_t *set = &repl_state[index * repl_stride];
+#ifdef __SSE2__
+   if (repl_stride == 16) {
+      const __m128i eq = _mm_cmpeq_epi8(_mm_load_si128((const __m128i *)set), _mm_set1_epi8(assoc - 1));
+      const int victims = _mm_movemask_epi8(eq);
+      assert(victims);
+      return __builtin_ctz(victims);
+   }
+#endif
+   for (uint64_t way = 0; way < assoc; way++) {
+      if (set[way] == (assoc - 1))
+         return way;
+   }
+   assert(0);
+   return 0;
 }
 
 bool cache_t::is_hit(uint64_t cycle, uint64_t addr) const {
    uint64_t tag = TAG(addr);
    uint64_t index = INDEX(addr);
+   uint64_t way;
 
-   for (uint64_t way = 0; way < assoc; way++) {
-      if (C[index][way].valid && (C[index][way].tag == tag)) {
-         auto avail = ((C[index][way].timestamp > (cycle + latency)) ? C[index][way].timestamp : (cycle + latency));
-         return (cycle + latency >= avail);
-      }
+   if (find_way(index, tag, way)) {
+      const uint64_t timestamp = timestamps[index * way_stride + way];
+      auto avail = ((timestamp > (cycle + latency)) ? timestamp : (cycle + latency));
+      return (cycle + latency >= avail);
    }
 
    return false;
@@ -80,71 +236,214 @@ uint64_t cache_t::access(uint64_t cycle, bool read, uint64_t addr, bool pf) {
    uint64_t avail;      // return value: cycle that requested block is available
    uint64_t tag = TAG(addr);
    uint64_t index = INDEX(addr);
-   bool hit = false;
    uint64_t way;        // if hit, this is the corresponding way
-   uint64_t max_lru_ctr = 0;    // for finding lru block
-   uint64_t victim_way;     // if miss, this is the lru/victim way
 
    accesses+=!pf;
    pf_accesses += pf;
 
-   for (way = 0; way < assoc; way++)
-   {
-      if (C[index][way].valid && (C[index][way].tag == tag))
-      {
-         hit = true;
-         break;
-      }
-      else if (C[index][way].lru >= max_lru_ctr)
-      {
-         max_lru_ctr = C[index][way].lru;
-         victim_way = way;
-      }
-   }
-
-   if (hit) {   // hit
+   if (find_way(index, tag, way)) {   // hit
       // determine when the requested block will be available
-      avail = ((C[index][way].timestamp > (cycle + latency)) ? C[index][way].timestamp : (cycle + latency));
+      const uint64_t timestamp = timestamps[index * way_stride + way];
+      avail = ((timestamp > (cycle + latency)) ? timestamp : (cycle + latency));
 
-      update_lru(index, way);   // make "way" the MRU way
+      dirty[index * way_stride + way] |= !read;
+      touch(index, way, false);
    }
    else {   // miss
       misses+= !pf;
       pf_misses += pf;
 
-      assert(max_lru_ctr == (assoc - 1));
+      // the requests for the block, and the writebacks of dirty victims, take turns on the bus
+      const uint64_t bus_cycle = bus->schedule(cycle + latency);
+
+      if (!read && !WRITE_ALLOCATE) {
+         // write-around: the write goes on to the next level, without allocating the block here
+         return (next_level ? next_level->access(bus_cycle, false, addr, pf) : (bus_cycle + MAIN_MEMORY_LATENCY));
+      }
+
+      uint64_t victim_way = this->victim_way(index);
       assert(victim_way < assoc);
-      
-      // TO DO: model writebacks (evictions of dirty blocks)
 
-      // determine when the requested block will be available
-      avail = (next_level ? next_level->access((cycle + latency), read, addr, pf) : (cycle + latency + MAIN_MEMORY_LATENCY));
+      // determine when the requested block will be available (a write miss reads the block first)
+      avail = (next_level ? next_level->access(bus_cycle, true, addr, pf) : (bus_cycle + MAIN_MEMORY_LATENCY));
 
       // replace the victim block with the requested block
-      C[index][victim_way].valid = true;
-      C[index][victim_way].tag = tag;
-      C[index][victim_way].timestamp = avail;
-      update_lru(index, victim_way);  // make "victim_way" the MRU way
+      fill(index, victim_way, tag, avail, !read, bus_cycle);
    }
 
    return(avail);
 }
 
+// Replaces the block in way of set index with the block tag, available at avail. A dirty victim
+// is written back after cycle.
+void cache_t::fill(uint64_t index, uint64_t way, uint64_t tag, uint64_t avail, bool dirty, uint64_t cycle) {
+   const uint64_t i = index * way_stride + way;
+   if (this->dirty[i])   // invalid blocks are never dirty
+      write_back(index, way, cycle);
+   tags[i] = tag;
+   timestamps[i] = avail;
+   this->dirty[i] = dirty;
+   touch(index, way, true);
+}
+
+void cache_t::write_back(uint64_t index, uint64_t way, uint64_t cycle) {
+   const uint64_t addr = ((tags[index * way_stride + way] << (num_index_bits + num_offset_bits)) | (index << num_offset_bits));
+   writebacks++;
+   const uint64_t bus_cycle = bus->schedule(cycle);
+   if (next_level)
+      next_level->receive_writeback(bus_cycle, addr);
+}
+
+// A writeback carries the whole block: on a miss, the block is allocated without reading it from
+// the next level. Writebacks are not accesses of the block, so a hit leaves the replacement state alone.
+void cache_t::receive_writeback(uint64_t cycle, uint64_t addr) {
+   uint64_t tag = TAG(addr);
+   uint64_t index = INDEX(addr);
+   uint64_t way;
+
+   if (find_way(index, tag, way)) {
+      dirty[index * way_stride + way] = 1;
+   }
+   else {
+      way = victim_way(index);
+      assert(way < assoc);
+      fill(index, way, tag, (cycle + latency), true, (cycle + latency));
+   }
+}
+
+void cache_t::warm(bool read, uint64_t addr) {
+   uint64_t tag = TAG(addr);
+   uint64_t index = INDEX(addr);
+   uint64_t way;
+
+   if (find_way(index, tag, way)) {
+      dirty[index * way_stride + way] |= !read;
+      touch(index, way, false);
+   }
+   else if (!read && !WRITE_ALLOCATE) {
+      if (next_level)
+         next_level->warm(false, addr);
+   }
+   else {
+      way = victim_way(index);
+      assert(way < assoc);
+      if (next_level)
+         next_level->warm(true, addr);
+      warm_fill(index, way, tag, !read);
+   }
+}
+
+void cache_t::warm_fill(uint64_t index, uint64_t way, uint64_t tag, bool dirty) {
+   const uint64_t i = index * way_stride + way;
+   if (this->dirty[i] && next_level)
+      next_level->warm_writeback((tags[i] << (num_index_bits + num_offset_bits)) | (index << num_offset_bits));
+   tags[i] = tag;
+   timestamps[i] = 0;
+   this->dirty[i] = dirty;
+   touch(index, way, true);
+}
+
+void cache_t::warm_writeback(uint64_t addr) {
+   uint64_t tag = TAG(addr);
+   uint64_t index = INDEX(addr);
+   uint64_t way;
+
+   if (find_way(index, tag, way)) {
+      dirty[index * way_stride + way] = 1;
+   }
+   else {
+      way = victim_way(index);
+      assert(way < assoc);
+      warm_fill(index, way, tag, true);
+   }
+}
+
+void cache_t::advance_base_cycle(uint64_t cycle) {
+   bus->advance_base_cycle(cycle);
+}
+
+// Makes mru_way the MRU way of set index.
 void cache_t::update_lru(uint64_t index, uint64_t mru_way) {
+   uint8_t *set = &repl_state[index * repl_stride];
+   const uint8_t mru_pos = set[mru_way];
+#ifdef __SSE2__
+   if (repl_stride == 16) {
+      // ways more recent than mru_way age by one: subtracting the all-ones compare result adds 1
+      const __m128i pos = _mm_load_si128((const __m128i *)set);
+      const __m128i younger = _mm_cmplt_epi8(pos, _mm_set1_epi8(mru_pos));
+      _mm_store_si128((__m128i *)set, _mm_sub_epi8(pos, younger));
+      set[mru_way] = 0;
+      return;
+   }
+#endif
    for (uint64_t way = 0; way < assoc; way++) {
-      if (C[index][way].lru < C[index][mru_way].lru) {
-         C[index][way].lru++;
-         assert(C[index][way].lru < assoc);
+      if (set[way] < mru_pos) {
+         set[way]++;
+         assert(set[way] < assoc);
       }
    }
-   C[index][mru_way].lru = 0;
+   set[mru_way] = 0;
+}
+
+// Tree-PLRU: node n of the tree has the children 2n+1 and 2n+2, and the leaves assoc-1 to 2*assoc-2
+// are the ways. Each node points to the child on the side of the victim (0: left, 1: right).
+uint64_t cache_t::plru_way(uint64_t index) const {
+   const uint8_t *set = &repl_state[index * repl_stride];
+   uint64_t node = 0;
+   while (node < (assoc - 1))
+      node = (2 * node) + 1 + set[node];
+   return (node - (assoc - 1));
+}
+
+// Points the nodes on the path to way away from it.
+void cache_t::update_plru(uint64_t index, uint64_t way) {
+   uint8_t *set = &repl_state[index * repl_stride];
+   uint64_t node = way + (assoc - 1);
+   while (node) {
+      const uint64_t parent = (node - 1) / 2;
+      set[parent] = (node == ((2 * parent) + 1));   // came from the left: the victim is on the right
+      node = parent;
+   }
+}
+
+// RRIP: the first way predicted to be re-referenced in the distant future (RRPV_MAX), after
+// aging all ways as many times as needed for one to get there.
+uint64_t cache_t::rrip_way(uint64_t index) {
+   uint8_t *set = &repl_state[index * repl_stride];
+   uint8_t oldest = 0;
+   for (uint64_t way = 0; way < assoc; way++)
+      oldest = ((set[way] > oldest) ? set[way] : oldest);
+   const uint8_t aging = RRPV_MAX - oldest;
+   uint64_t victim = assoc;
+   for (uint64_t way = 0; way < assoc; way++) {
+      set[way] += aging;
+      if ((set[way] == RRPV_MAX) && (victim == assoc))
+         victim = way;
+   }
+   return victim;
 }
 
 void cache_t::stats() {
+   printf("\treplacement = %s\n", cache_repl_name(repl));
    printf("\taccesses   = %lu\n", accesses);
    printf("\tmisses     = %lu\n", misses);
    printf("\tmiss ratio = %.2f%%\n", 100.0*((double)misses/(double)accesses));
+   printf("\thit ratio  = %.2f%%\n", 100.0*((double)(accesses - misses)/(double)accesses));
    printf("\tpf accesses   = %lu\n", pf_accesses);
    printf("\tpf misses     = %lu\n", pf_misses);
    printf("\tpf miss ratio = %.2f%%\n", 100.0*((double)pf_misses/(double)pf_accesses));
+   printf("\twritebacks = %lu\n", writebacks);
+}
+
+void cache_t::snapshot(snapshot_t& s) {
+   const uint64_t num_sets = index_mask + 1;
+   s.check(num_sets, "cache sets");
+   s.check(assoc, "cache associativity");
+   s.check((uint64_t)repl, "cache replacement policy");
+   snapshot_array(s, tags, num_sets * way_stride);
+   snapshot_array(s, timestamps, num_sets * way_stride);
+   snapshot_array(s, dirty, num_sets * way_stride);
+   snapshot_array(s, repl_state, num_sets * repl_stride);
+   snapshot_fields(s, rng, accesses, pf_accesses, misses, pf_misses, writebacks);
+   bus->snapshot(s);
 }
@@ -22,22 +22,41 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 // Author: Eric Rotenberg (ericro@ncsu.edu)
 
 
-struct block_t {
-    bool valid;
-    //bool dirty;   // TO DO
-    uint64_t tag;
-    uint64_t timestamp;
-    uint64_t lru;
-};
+#include "parameters.h"
 
 #define IsPow2(x)   (((x) & (x-1)) == 0)
 
 #define TAG(addr)   ((addr) >> (num_index_bits + num_offset_bits))
 #define INDEX(addr) (((addr) >> num_offset_bits) & index_mask)
 
+class resource_schedule;
+class snapshot_t;
+
 class cache_t {
 private:
-    block_t **C;
+    // The blocks are stored set-major in flat arrays: way w of set s is entry (s * way_stride + w).
+    // A set's tags are compared as a whole (4 ways at a time with AVX2), so way_stride is assoc
+    // rounded up to 4 and the padding ways are invalid.
+    static const uint64_t INVALID_TAG = UINT64_MAX;   // tag of invalid blocks; no address has it
+    uint64_t *tags;
+    uint64_t *timestamps;   // cycle at which the block is available
+    uint8_t *dirty;         // 1 if the block was written since it was filled
+    uint64_t way_stride;
+
+    // Replacement state, repl_stride bytes per set. It depends on the policy:
+    // - LRU: the position of each way, 0 for the MRU way to assoc-1 for the LRU way. Sets of up to
+    //   16 ways use 16 bytes, updated together with SSE2; their padding bytes hold LRU_PAD, which
+    //   is never moved nor the LRU.
+    // - PLRU: the assoc-1 nodes of a binary tree over the ways (see plru_way).
+    // - SRRIP/BRRIP: the re-reference prediction value (RRPV) of each way.
+    // - RANDOM: none.
+    static const uint8_t LRU_PAD = 0x7f;
+    static const uint8_t RRPV_MAX = 3;
+    CacheRepl repl;
+    uint8_t *repl_state;
+    uint64_t repl_stride;
+    uint64_t rng;           // xorshift state of RANDOM and BRRIP, fixed seed for reproducible runs
+
     uint64_t num_index_bits;
     uint64_t num_offset_bits;
     uint64_t index_mask;
@@ -49,18 +68,51 @@ private:
     // pointer to next cache level if applicable
     cache_t *next_level;
 
+    // The link to the next level (or main memory) takes one block request or writeback per cycle,
+    // so writebacks delay the misses that follow them.
+    resource_schedule *bus;
+
     // measurements
     uint64_t accesses;
     uint64_t pf_accesses;
     uint64_t misses;
     uint64_t pf_misses;
+    uint64_t writebacks;    // dirty blocks evicted to the next level
+
+    bool find_way(uint64_t index, uint64_t tag, uint64_t& way) const;
+    uint64_t next_random();
 
+    uint64_t victim_way(uint64_t index);
+    void touch(uint64_t index, uint64_t way, bool fill);
+
+    uint64_t lru_way(uint64_t index) const;
     void update_lru(uint64_t index, uint64_t mru_way);
+    uint64_t plru_way(uint64_t index) const;
+    void update_plru(uint64_t index, uint64_t way);
+    uint64_t rrip_way(uint64_t index);
+
+    void fill(uint64_t index, uint64_t way, uint64_t tag, uint64_t avail, bool dirty, uint64_t cycle);
+    void write_back(uint64_t index, uint64_t way, uint64_t cycle);
+    void receive_writeback(uint64_t cycle, uint64_t addr);
+
+    void warm_fill(uint64_t index, uint64_t way, uint64_t tag, bool dirty);
+    void warm_writeback(uint64_t addr);
 
 public:
-    cache_t(uint64_t size, uint64_t assoc, uint64_t blocksize, uint64_t latency, cache_t *next_level);
+    cache_t(uint64_t size, uint64_t assoc, uint64_t blocksize, uint64_t latency, cache_t *next_level, CacheRepl repl = CacheRepl::LRU);
     ~cache_t();
     uint64_t access(uint64_t cycle, bool read, uint64_t addr, bool pf = false);
     bool is_hit(uint64_t cycle, uint64_t addr) const;
+    // No access nor writeback will be sent to the next level before cycle any more.
+    void advance_base_cycle(uint64_t cycle);
+    // Functional warming (cbp --sample): updates the contents, dirty bits and replacement state of
+    // the hierarchy as access() would, without timing nor measurements. Blocks are available at once.
+    void warm(bool read, uint64_t addr);
     void stats();
+    void snapshot(snapshot_t& s);
 };
+
+// Name of a replacement policy, as given to the -R option
+const char *cache_repl_name(CacheRepl repl);
+// Sets repl to the policy called name; false if there is none
+bool parse_cache_repl(const char *name, CacheRepl& repl);
@@ -35,10 +35,56 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "resource_schedule.h"
 #include "uarchsim.h"
 #include "parameters.h"
+#include "alloc_counter.h"
+#include "branch_stream.h"
+#include "snapshot.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <string>
+#include <thread>
+#include <vector>
 
-uarchsim_t *sim;
+// Batch mode (--batch): many traces simulated concurrently in one process.
+struct batch_options_t
+{
+  const char * input = nullptr;          // directory to search for traces, or file listing one trace per line
+  const char * csv = "results.csv";
+  uint64_t jobs = 0;                     // 0: one per hardware thread
+};
+
+// Snapshots (--checkpoint, --restore, see snapshot.h).
+struct snapshot_options_t
+{
+  const char * checkpoint = nullptr;     // file to save the state to after checkpoint_insts instructions
+  uint64_t checkpoint_insts = 0;
+  const char * restore = nullptr;        // file to restore the state from before simulating the rest of the trace
+};
+
+// Sampled simulation (--sample): of every period trace instructions, the last unit are measured,
+// after warmup instructions of timing simulation.
+struct sample_options_t
+{
+  uint64_t unit = 0;                     // 0: no sampling
+  uint64_t warmup = 0;
+  uint64_t period = 0;
+};
 
-int parseargs(int argc, char ** argv) 
+// Sharded simulation (--shards): the trace is cut into num_shards ranges of whole epochs, simulated
+// concurrently, each after warmup instructions (rounded up to whole epochs) of timing simulation.
+struct shard_options_t
+{
+  uint64_t num_shards = 0;               // 0: no sharding
+  uint64_t warmup = 0;
+};
+
+int parseargs(int argc, char ** argv, batch_options_t& batch, snapshot_options_t& snap, sample_options_t& sample, shard_options_t& shards) 
 {
   int i = 1;
 
@@ -205,6 +251,23 @@ int parseargs(int argc, char ** argv)
            exit(0);
         }
      }
+     else if (!strcmp(argv[i], "-R"))
+     {
+        i++;
+        char ic[16], l1[16], l2[16], l3[16];
+        if ((i < argc) &&
+            (sscanf(argv[i], "%15[^,],%15[^,],%15[^,],%15s", ic, l1, l2, l3) == 4) &&
+            parse_cache_repl(ic, IC_REPL) && parse_cache_repl(l1, L1_REPL) &&
+            parse_cache_repl(l2, L2_REPL) && parse_cache_repl(l3, L3_REPL))
+        {
+           i++;
+        }
+        else
+        {
+           printf("Usage: missing or unknown replacement policies: -R <IC_repl>,<L1_repl>,<L2_repl>,<L3_repl> (lru, plru, srrip, brrip or random).\n");
+           exit(0);
+        }
+     }
      else if (!strcmp(argv[i], "-E"))
      {
         i++;
@@ -229,6 +292,29 @@ int parseargs(int argc, char ** argv)
            exit(0);
         }
      }
+     else if (!strcmp(argv[i], "-T"))
+     {
+        i++;
+        int file_pos = 0;
+        if ((i < argc) &&
+            (sscanf(argv[i], "%lu,%lu,%n", &LOG_START_CYCLE, &LOG_END_CYCLE, &file_pos) == 2) &&
+            (file_pos > 0) && argv[i][file_pos])
+        {
+           if (!PIPE_TRACE_ENABLED)
+           {
+              printf("-T: this simulator was built without pipeline tracing (make PIPE_TRACE=0).\n");
+              exit(0);
+           }
+           LOG_LEVEL = 1;
+           LOG_FILE = &argv[i][file_pos];
+           i++;
+        }
+        else
+        {
+           printf("Usage: missing pipeline trace parameters: -T <start_cycle>,<end_cycle>,<file>.\n");
+           exit(0);
+        }
+     }
      else if (!strcmp(argv[i], "-w"))
      {
         i++;
@@ -243,13 +329,129 @@ int parseargs(int argc, char ** argv)
            exit(0);
         }
      }
+     else if (!strcmp(argv[i], "--reader-threads"))
+     {
+        i++;
+        if ((i < argc) && (atoi(argv[i]) >= 0) && (atoi(argv[i]) <= 1))
+        {
+           READER_THREADS = atoi(argv[i]);
+           i++;
+        }
+        else
+        {
+           printf("Usage: missing or unsupported reader threads: --reader-threads <0|1>.\n");
+           exit(0);
+        }
+     }
+     else if (!strcmp(argv[i], "--batch"))
+     {
+        i++;
+        if (i < argc)
+        {
+           batch.input = argv[i];
+           i++;
+        }
+        else
+        {
+           printf("Usage: missing trace directory or list: --batch <dir|list>.\n");
+           exit(0);
+        }
+     }
+     else if (!strcmp(argv[i], "--batch-jobs"))
+     {
+        i++;
+        if ((i < argc) && (atoi(argv[i]) > 0))
+        {
+           batch.jobs = atoi(argv[i]);
+           i++;
+        }
+        else
+        {
+           printf("Usage: missing or invalid number of concurrent simulations: --batch-jobs <n>.\n");
+           exit(0);
+        }
+     }
+     else if (!strcmp(argv[i], "--batch-csv"))
+     {
+        i++;
+        if (i < argc)
+        {
+           batch.csv = argv[i];
+           i++;
+        }
+        else
+        {
+           printf("Usage: missing results file: --batch-csv <file>.\n");
+           exit(0);
+        }
+     }
+     else if (!strcmp(argv[i], "--checkpoint"))
+     {
+        i++;
+        int file_pos = 0;
+        if ((i < argc) &&
+            (sscanf(argv[i], "%lu,%n", &snap.checkpoint_insts, &file_pos) == 1) &&
+            (file_pos > 0) && argv[i][file_pos] && (snap.checkpoint_insts > 0))
+        {
+           snap.checkpoint = &argv[i][file_pos];
+           i++;
+        }
+        else
+        {
+           printf("Usage: missing checkpoint parameters: --checkpoint <num_instructions>,<file>.\n");
+           exit(0);
+        }
+     }
+     else if (!strcmp(argv[i], "--sample"))
+     {
+        i++;
+        if ((i < argc) &&
+            (sscanf(argv[i], "%lu,%lu,%lu", &sample.unit, &sample.warmup, &sample.period) == 3) &&
+            (sample.unit > 0) && (sample.period >= sample.unit + sample.warmup))
+        {
+           i++;
+        }
+        else
+        {
+           printf("Usage: missing or invalid sampling parameters: --sample <unit>,<warmup>,<period> (unit > 0, unit + warmup <= period).\n");
+           exit(0);
+        }
+     }
+     else if (!strcmp(argv[i], "--shards"))
+     {
+        i++;
+        if ((i < argc) &&
+            (sscanf(argv[i], "%lu,%lu", &shards.num_shards, &shards.warmup) == 2) && (shards.num_shards > 0))
+        {
+           i++;
+        }
+        else
+        {
+           printf("Usage: missing or invalid sharding parameters: --shards <num_shards>,<warmup> (num_shards > 0).\n");
+           exit(0);
+        }
+     }
+     else if (!strcmp(argv[i], "--restore"))
+     {
+        i++;
+        if (i < argc)
+        {
+           snap.restore = argv[i];
+           i++;
+        }
+        else
+        {
+           printf("Usage: missing snapshot file: --restore <file>.\n");
+           exit(0);
+        }
+     }
      else
      {
         break;
      }
   }
 
-  if (i < argc) {
+  if ((i < argc) || batch.input) {
      return(i);
   }
   else {
@@ -267,20 +469,589 @@ int parseargs(int argc, char ** argv)
              "\t[optional: -F <fetch_width>,<fetch_num_branch>,<fetch_stop_at_indirect>,<fetch_stop_at_taken>,<fetch_model_icache>]\n"
              "\t[optional: -I <log2_ic_size>,<ic_assoc>,<ic_blocksize>]\n"
              "\t[optional: -D <log2_L1_size>,<L1_assoc>,<L1_blocksize>,<L1_latency>,<log2_L2_size>,<L2_assoc>,<L2_blocksize>,<L2_latency>,<log2_L3_size>,<L3_assoc>,<L3_blocksize>,<L3_latency>,<main_memory_latency>]\n"
+             "\t[optional: -R <IC_repl>,<L1_repl>,<L2_repl>,<L3_repl> cache replacement policies: lru (default), plru, srrip, brrip or random]\n"
              "\t[optional: -w <window_size>]\n"
+             "\t[optional: -T <start_cycle>,<end_cycle>,<file> to trace the pipeline events of these cycles into file (see pipe_trace_decode)]\n"
              "\t[optional: -E <epoch_size_insts> to enable dumping per-epoch conditional branch info\n"
-             "\t[REQUIRED: .gz trace file]\n", argv[0]);
+             "\t[optional: --reader-threads <0|1> to decompress and decode the trace on a separate thread]\n"
+             "\t[optional: --batch <dir|list> to simulate all *_trace.gz/*.cbpt traces under dir (or listed in a file, one per line) concurrently, instead of a single trace]\n"
+             "\t[optional: --batch-jobs <n> concurrent simulations in batch mode (default: number of hardware threads)]\n"
+             "\t[optional: --batch-csv <file> batch mode results (default: results.csv)]\n"
+             "\t[optional: --checkpoint <num_instructions>,<file> to save the simulator and predictor state to file after num_instructions trace instructions, and stop]\n"
+             "\t[optional: --restore <file> to restore the state saved by --checkpoint and simulate the rest of the trace]\n"
+             "\t[optional: --sample <unit>,<warmup>,<period> to estimate IPC and MPKI from the last unit instructions of every period, simulated in detail after warmup instructions; the others only warm the predictors and caches]\n"
+             "\t[optional: --shards <num_shards>,<warmup> to cut the trace into num_shards ranges of whole epochs, simulated concurrently after warmup instructions each, and stitch their measurements together]\n"
+             "\t[REQUIRED (unless --batch): .gz or .cbpt trace file, or .cbpb branch stream for fast-forward (branch-only) mode]\n", argv[0]);
      exit(0);
   }
 }
 
+// Fast-forward mode: trains and measures the conditional branch predictor from a branch-only stream
+// (see branch_stream.h) without timing simulation. The cbp.h hooks are called for branches only,
+// in program order, and each branch resolves and commits right after it is predicted. There is no
+// notion of time: cycle arguments carry the branch's seq_no, and the Cycles/IPC/CycWP columns of
+// the reports are not meaningful.
+static void run_branch_stream(const char * path)
+{
+  cbpb_reader_t reader(path);
+  bp_t BP;
+  std::vector<uint64_t> num_insts_per_epoch;
+  std::vector<uint64_t> num_cycles_per_epoch;
+  ExecuteInfo exec_info;
+
+  // Same epoch bookkeeping as uarchsim_t: a new epoch starts after every EPOCH_SIZE_INSTS instructions.
+  auto begin_epochs_until = [&](uint64_t inst_no) {
+     while (num_insts_per_epoch.empty() || (inst_no >= num_insts_per_epoch.size() * EPOCH_SIZE_INSTS)) {
+        if (!num_insts_per_epoch.empty())
+           num_insts_per_epoch.back() = EPOCH_SIZE_INSTS;
+        num_insts_per_epoch.emplace_back(0);
+        num_cycles_per_epoch.emplace_back(0);
+        BP.notify_begin_new_epoch();
+     }
+  };
+
+  beginCondDirPredictor();
+
+  while (const cbpb_record_t *br = reader.next())
+  {
+     begin_epochs_until(br->inst_no);
+
+     notify_instr_fetch(br->seq_no, br->piece, br->pc, br->seq_no);
+
+     const bool misp = !PERFECT_BRANCH_PRED && BP.predict(br->seq_no, br->piece, br->insn_class, br->pc, br->next_pc, br->seq_no);
+
+     exec_info.reset();
+     exec_info.dec_info.insn_class = br->insn_class;
+     exec_info.taken.emplace(br->taken);
+     exec_info.next_pc = br->next_pc;
+     const bool pred_taken = is_cond_br(br->insn_class) ? (misp ? !br->taken : br->taken) : true;
+
+     notify_instr_execute_resolve(br->seq_no, br->piece, br->pc, pred_taken, exec_info, br->seq_no);
+     notify_instr_commit(br->seq_no, br->piece, br->pc, pred_taken, exec_info, br->seq_no);
+  }
+
+  const uint64_t num_inst = reader.get_num_insts();
+  begin_epochs_until(num_inst);
+  num_insts_per_epoch.back() = num_inst - (num_insts_per_epoch.size() - 1) * EPOCH_SIZE_INSTS;
+
+  endCondDirPredictor();
+
+  printf("FAST-FORWARD (branch-only) simulation of %s: %lu instructions, %lu uops. No timing model: Cycles/IPC/CycWP are not meaningful.\n", path, num_inst, reader.get_num_uops());
+  BP.output(num_inst);
+  BP.output_periodic_info(num_insts_per_epoch, num_cycles_per_epoch);
+}
+
+struct batch_job_t
+{
+  std::string path;
+  std::string workload;   // name of the directory holding the trace
+  std::string run;        // trace file name without extension
+  uint64_t size_bytes;
+
+  // Results.
+  bool pass = false;
+  double exec_time = 0.0;
+  cond_br_meas_t full;
+  cond_br_meas_t half;
+};
+
+// Collects the traces of a batch: every *_trace.gz or *.cbpt file under a directory, or the
+// paths listed (one per line, '#' starts a comment line) in a file.
+static std::vector<batch_job_t> find_batch_traces(const char * input)
+{
+  namespace fs = std::filesystem;
+  std::vector<std::string> paths;
+  if (fs::is_directory(input))
+  {
+     for (const auto& entry : fs::recursive_directory_iterator(input))
+     {
+        const std::string name = entry.path().filename().string();
+        const bool is_gz_trace = (name.size() > 9) && !name.compare(name.size() - 9, 9, "_trace.gz");
+        if (entry.is_regular_file() && (is_gz_trace || (entry.path().extension() == ".cbpt")))
+           paths.push_back(entry.path().string());
+     }
+  }
+  else
+  {
+     std::ifstream list(input);
+     if (!list)
+     {
+        printf("Cannot open batch trace list %s.\n", input);
+        exit(1);
+     }
+     std::string line;
+     while (std::getline(list, line))
+     {
+        if (!line.empty() && (line[0] != '#'))
+           paths.push_back(line);
+     }
+  }
+  std::sort(paths.begin(), paths.end());
+
+  std::vector<batch_job_t> jobs;
+  for (const std::string& path : paths)
+  {
+     batch_job_t job;
+     job.path = path;
+     job.workload = fs::path(path).parent_path().filename().string();
+     job.run = fs::path(path).stem().string();
+     std::error_code ec;
+     job.size_bytes = fs::file_size(path, ec);
+     if (ec)
+        job.size_bytes = 0;
+     jobs.push_back(job);
+  }
+  return jobs;
+}
+
+// Simulates one trace of a batch. Must run on a thread of its own: the predictor hooks of cbp.h
+// reach per-thread predictor state, which a fresh thread starts out with.
+static void run_batch_job(batch_job_t& job)
+{
+  const auto begin = std::chrono::steady_clock::now();
+  {
+     TraceReader reader(job.path.c_str(), READER_THREADS, false/*verbose*/);
+     auto sim = std::make_unique<uarchsim_t>();
+     beginCondDirPredictor();
+
+     db_t inst;
+     while (reader.get_inst(inst))
+        sim->step(&inst);
+
+     endPredictor();
+     endCondDirPredictor();
+     sim->finish();
+     job.full = sim->measure_cond_br(false/*last_half_only*/);
+     job.half = sim->measure_cond_br(true/*last_half_only*/);
+  }
+  job.exec_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+  job.pass = true;
+}
+
+// Same columns as reference_results_training_set.csv (and scripts/trace_exec_training_list.py).
+static void write_batch_csv(const char * path, const std::vector<batch_job_t>& jobs)
+{
+  FILE * f = fopen(path, "w");
+  if (!f)
+  {
+     printf("Cannot create %s.\n", path);
+     exit(1);
+  }
+
+  auto print_meas = [f](const cond_br_meas_t& m) {
+     const double cyc_wp_avg = (m.misp_br == 0) ? 0.00 : (double)m.cycles_on_wrong_path/(double)m.misp_br;
+     fprintf(f, ",%lu,%lu,%.4f,%lu,%lu,%.4f,%.4f,%.4f%%,%.4f,%lu,%.4f,%.4f",
+             m.instr, m.cycles, (double)m.instr/(double)m.cycles, m.num_br, m.misp_br,
+             (double)m.num_br/(double)m.cycles, (double)m.misp_br/(double)m.cycles,
+             100.0*((double)m.misp_br/(double)m.num_br), 1000.0*((double)m.misp_br/(double)m.instr),
+             m.cycles_on_wrong_path, cyc_wp_avg, (double)m.cycles_on_wrong_path*1000/(double)m.instr);
+  };
+
+  fprintf(f, "Workload,Run,TraceSize,Status,ExecTime,Instr,Cycles,IPC,NumBr,MispBr,BrPerCyc,MispBrPerCyc,MR,MPKI,CycWP,CycWPAvg,CycWPPKI,"
+             "50PercInstr,50PercCycles,50PercIPC,50PercNumBr,50PercMispBr,50PercBrPerCyc,50PercMispBrPerCyc,50PercMR,50PercMPKI,50PercCycWP,50PercCycWPAvg,50PercCycWPPKI\n");
+  for (const batch_job_t& job : jobs)
+  {
+     fprintf(f, "%s,%s,%f,%s,%f", job.workload.c_str(), job.run.c_str(), (double)job.size_bytes/(1024*1024), job.pass ? "Pass" : "Fail", job.exec_time);
+     if (job.pass)
+     {
+        print_meas(job.full);
+        print_meas(job.half);
+     }
+     else
+     {
+        for (int col = 0; col < 24; col++)
+           fprintf(f, ",0");
+     }
+     fprintf(f, "\n");
+  }
+  fclose(f);
+}
+
+// Batch mode: simulates every trace of the batch, up to batch.jobs at a time, and writes one CSV row per trace.
+// Traces are handed out longest first (by file size) from a shared queue: each worker takes the next
+// one as soon as it is done with its own, so short traces fill in the gaps at the end of the batch.
+static void run_batch(const batch_options_t& batch)
+{
+  std::vector<batch_job_t> jobs = find_batch_traces(batch.input);
+  if (jobs.empty())
+  {
+     printf("No traces found in %s.\n", batch.input);
+     exit(1);
+  }
+
+  std::vector<size_t> order(jobs.size());
+  for (size_t j = 0; j < jobs.size(); j++)
+     order[j] = j;
+  std::stable_sort(order.begin(), order.end(), [&jobs](size_t a, size_t b) { return jobs[a].size_bytes > jobs[b].size_bytes; });
+
+  const uint64_t num_workers = std::min<uint64_t>(batch.jobs ? batch.jobs : std::max(1u, std::thread::hardware_concurrency()), jobs.size());
+  printf("Batch: %lu traces, %lu concurrent simulations\n", jobs.size(), num_workers);
+
+  std::atomic<size_t> next_job{0};
+  std::mutex print_mutex;
+  size_t num_done = 0;
+  auto worker = [&]() {
+     for (size_t k = next_job++; k < order.size(); k = next_job++)
+     {
+        batch_job_t& job = jobs[order[k]];
+        if (!std::filesystem::is_regular_file(job.path))
+        {
+           std::lock_guard<std::mutex> lock(print_mutex);
+           printf("[%lu/%lu] %s/%s: cannot open %s\n", ++num_done, jobs.size(), job.workload.c_str(), job.run.c_str(), job.path.c_str());
+           continue;
+        }
+        std::thread(run_batch_job, std::ref(job)).join();
+
+        std::lock_guard<std::mutex> lock(print_mutex);
+        printf("[%lu/%lu] %s/%s: 50PercMPKI %.4f, ExecTime %.1f s\n", ++num_done, jobs.size(), job.workload.c_str(), job.run.c_str(),
+               1000.0*((double)job.half.misp_br/(double)job.half.instr), job.exec_time);
+        fflush(stdout);
+     }
+  };
+
+  std::vector<std::thread> workers;
+  for (uint64_t w = 0; w < num_workers; w++)
+     workers.emplace_back(worker);
+  for (std::thread& w : workers)
+     w.join();
+
+  write_batch_csv(batch.csv, jobs);
+  printf("Batch results: %s\n", batch.csv);
+}
+
+// Mean of the samples and half-width of its 95% confidence interval (normal approximation, as the
+// samples are many); the half-width is 0 with fewer than 2 samples.
+static std::pair<double, double> estimate_mean(const std::vector<double>& samples)
+{
+  const double n = samples.size();
+  const double mean = std::accumulate(samples.begin(), samples.end(), 0.0) / n;
+  if (samples.size() < 2)
+     return {mean, 0.0};
+  double sum_sq = 0.0;
+  for (double x : samples)
+     sum_sq += (x - mean) * (x - mean);
+  const double stddev = std::sqrt(sum_sq / (n - 1));
+  return {mean, 1.96 * stddev / std::sqrt(n)};
+}
+
+// Sampled simulation, after SMARTS (R. Wunderlich et al., ISCA 2003). Each period of the trace is
+// simulated in three parts: functional warming (uarchsim_t::warm) until its last unit + warmup
+// instructions, then timing simulation, whose last unit instructions are measured. The pipeline is
+// drained after each measured unit. CPI and MPKI are estimated by their mean over the units, and
+// IPC as the inverse of the CPI estimate. Units cut short by the end of the trace are dropped.
+static void run_sampled(TraceReader& reader, uarchsim_t& sim, const sample_options_t& sample, const char * trace_path)
+{
+  const uint64_t detailed_begin = sample.period - sample.unit - sample.warmup;
+  const uint64_t unit_begin = sample.period - sample.unit;
+  std::vector<double> unit_cpi;
+  std::vector<double> unit_mpki;
+  sim_progress_t unit_start = {};
+  uint64_t num_detailed = 0;
+
+  // a restored simulation may have uops in flight
+  sim.drain();
+
+  db_t inst;
+  uint64_t trace_insts = 0;
+  bool first_piece = true;
+  while (reader.get_inst(inst))
+  {
+     const uint64_t pos = trace_insts % sample.period;
+     if (pos < detailed_begin)
+     {
+        sim.warm(&inst);
+     }
+     else
+     {
+        if ((pos == unit_begin) && first_piece)
+           unit_start = sim.get_progress();
+        sim.step(&inst);
+        num_detailed++;
+     }
+
+     first_piece = inst.is_last_piece;
+     if (!inst.is_last_piece)
+        continue;
+     trace_insts++;
+     if (pos == sample.period - 1)
+     {
+        const sim_progress_t unit_end = sim.get_progress();
+        assert(unit_end.num_inst - unit_start.num_inst == sample.unit);
+        unit_cpi.push_back((double)(unit_end.fetch_cycle - unit_start.fetch_cycle) / (double)sample.unit);
+        unit_mpki.push_back(1000.0 * (double)(unit_end.num_cond_mispredicted - unit_start.num_cond_mispredicted) / (double)sample.unit);
+        if (detailed_begin > 0)
+           sim.drain();
+     }
+  }
+  sim.drain();
+
+  endPredictor();
+  endCondDirPredictor();
+
+  const sim_progress_t end = sim.get_progress();
+  printf("-------------------------------------------------------SAMPLED SIMULATION--------------------------------------------------------------\n");
+  printf("Trace: %s, %lu instructions\n", trace_path, trace_insts);
+  printf("Sampling: %lu-instruction units, after %lu instructions of timing warm-up, every %lu instructions\n", sample.unit, sample.warmup, sample.period);
+  printf("Measured units: %lu (%lu instructions, %.2f%% of the trace); uops simulated with timing: %lu\n",
+         unit_cpi.size(), unit_cpi.size() * sample.unit, trace_insts ? 100.0 * (double)(unit_cpi.size() * sample.unit) / (double)trace_insts : 0.0, num_detailed);
+  if (unit_cpi.empty())
+  {
+     printf("No complete unit: the trace is shorter than a sampling period.\n");
+  }
+  else
+  {
+     const auto [cpi, cpi_error] = estimate_mean(unit_cpi);
+     const auto [mpki, mpki_error] = estimate_mean(unit_mpki);
+     printf("Estimates (95%% confidence intervals):\n");
+     printf("\tCPI  %10.4f +- %.4f (%.2f%%)\n", cpi, cpi_error, 100.0 * cpi_error / cpi);
+     printf("\tIPC  %10.4f +- %.4f (%.2f%%)\n", 1.0 / cpi, cpi_error / (cpi * cpi), 100.0 * cpi_error / cpi);
+     printf("\tMPKI %10.4f +- %.4f (%.2f%%)\n", mpki, mpki_error, (mpki > 0.0) ? 100.0 * mpki_error / mpki : 0.0);
+  }
+  // every conditional branch of the trace is predicted, measured units or not
+  printf("MPKI of the whole trace (warming predictions included): %.4f\n", end.num_inst ? 1000.0 * (double)end.num_cond_mispredicted / (double)end.num_inst : 0.0);
+  printf("---------------------------------------------------------------------------------------------------------------------------------------\n");
+}
+
+// One range of a sharded simulation, and the simulator that measured it.
+struct shard_t
+{
+  uint64_t warmup_begin;     // first trace instruction simulated
+  uint64_t begin;            // first trace instruction measured
+  uint64_t end;              // one past the last trace instruction measured
+  uint64_t overlap_end;      // one past the last simulated: the first epoch of the next shard, for its warm-up error
+  uint64_t num_epochs = 0;   // measured epochs
+  std::unique_ptr<uarchsim_t> sim;
+  double exec_time = 0.0;
+};
+
+// Number of instructions of a trace: in the header of a .cbpt trace or of the index of a .gz
+// one (see trace_index.h), counted by decoding a .gz trace without index.
+static uint64_t count_trace_instrs(const char * trace_path)
+{
+  if (is_cbpt_file(trace_path))
+     return cbpt_input_t(trace_path).num_records();
+  if (std::unique_ptr<cbpi_index_t> index = cbpi_index_t::find(trace_path))
+     return index->num_records();
+  TraceReader reader(trace_path, 0/*reader_threads*/, false/*verbose*/);
+  return reader.skip_instrs(UINT64_MAX);
+}
+
+// Simulates one shard. Must run on a thread of its own, like run_batch_job.
+static void run_shard(shard_t& shard, const char * trace_path, const uint64_t num_trace_insts)
+{
+  const auto begin = std::chrono::steady_clock::now();
+  TraceReader reader(trace_path, 0/*reader_threads*/, false/*verbose*/);
+  if (!reader.seek_to_instr(shard.warmup_begin))
+  {
+     printf("Cannot seek to instruction %lu of %s.\n", shard.warmup_begin, trace_path);
+     exit(1);
+  }
+  shard.sim = std::make_unique<uarchsim_t>();
+  beginCondDirPredictor();
+
+  db_t inst;
+  uint64_t trace_insts = shard.warmup_begin;
+  bool first_piece = true;
+  while ((trace_insts < shard.overlap_end) && reader.get_inst(inst))
+  {
+     // the warm-up is whole epochs: the last one has just been closed
+     if (first_piece && (trace_insts == shard.begin))
+        shard.sim->reset_measurements();
+     shard.sim->step(&inst);
+     first_piece = inst.is_last_piece;
+     trace_insts += inst.is_last_piece;
+  }
+
+  endPredictor();
+  endCondDirPredictor();
+  // as in a full simulation, the end of the trace closes the last epoch, however many instructions it has
+  if (shard.overlap_end == num_trace_insts)
+     shard.sim->finish();
+  shard.exec_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+}
+
+// Sharded simulation. The trace is cut into ranges of whole epochs, simulated at the same time on
+// threads of their own, each with its own simulator and predictors, warmed up by the timing
+// simulation of the epochs before the range. The per-epoch measurements of the ranges are then
+// stitched together into the reports of a full simulation. Each shard also simulates the first
+// epoch of the next one: that epoch, simulated without interruption and after the warm-up only,
+// measures the warm-up error at the boundary.
+static void run_sharded(const shard_options_t& options, const char * trace_path)
+{
+  const auto begin = std::chrono::steady_clock::now();
+  const uint64_t num_trace_insts = count_trace_instrs(trace_path);
+  const uint64_t num_epochs = (num_trace_insts + EPOCH_SIZE_INSTS - 1) / EPOCH_SIZE_INSTS;
+  if (num_epochs == 0)
+  {
+     printf("%s has no instructions.\n", trace_path);
+     exit(1);
+  }
+  const uint64_t num_shards = std::min(options.num_shards, num_epochs);
+  const uint64_t warmup = ((options.warmup + EPOCH_SIZE_INSTS - 1) / EPOCH_SIZE_INSTS) * EPOCH_SIZE_INSTS;
+
+  std::vector<shard_t> shards(num_shards);
+  for (uint64_t k = 0; k < num_shards; k++)
+  {
+     shard_t& shard = shards[k];
+     const uint64_t first_epoch = k * num_epochs / num_shards;
+     const uint64_t last_epoch = (k + 1) * num_epochs / num_shards;
+     shard.begin = first_epoch * EPOCH_SIZE_INSTS;
+     shard.end = std::min(last_epoch * EPOCH_SIZE_INSTS, num_trace_insts);
+     shard.warmup_begin = shard.begin - std::min(shard.begin, warmup);
+     shard.overlap_end = (k + 1 < num_shards) ? std::min(shard.end + EPOCH_SIZE_INSTS, num_trace_insts) : num_trace_insts;
+  }
+
+  std::vector<std::thread> threads;
+  for (shard_t& shard : shards)
+     threads.emplace_back(run_shard, std::ref(shard), trace_path, num_trace_insts);
+  for (std::thread& t : threads)
+     t.join();
+  const double exec_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+  // The shards before the last one end with the overlap epoch, and an empty one begun after it.
+  bp_t BP;
+  std::vector<uint64_t> num_insts_per_epoch;
+  std::vector<uint64_t> num_cycles_per_epoch;
+  for (shard_t& shard : shards)
+  {
+     shard.num_epochs = (&shard != &shards.back()) ? (shard.end - shard.begin) / EPOCH_SIZE_INSTS : shard.sim->get_num_epochs();
+     shard.sim->append_epochs(0, shard.num_epochs, num_insts_per_epoch, num_cycles_per_epoch, BP);
+  }
+
+  auto sum_epochs = [](const uarchsim_t& sim, size_t first, size_t count) {
+     cond_br_meas_t sum;
+     for (size_t epoch = first; epoch < first + count; epoch++)
+     {
+        const cond_br_meas_t meas = sim.measure_epoch(epoch);
+        sum.instr += meas.instr;
+        sum.cycles += meas.cycles;
+        sum.num_br += meas.num_br;
+        sum.misp_br += meas.misp_br;
+        sum.cycles_on_wrong_path += meas.cycles_on_wrong_path;
+     }
+     return sum;
+  };
+  auto error = [](uint64_t measured, uint64_t reference) {
+     return reference ? 100.0 * ((double)measured - (double)reference) / (double)reference : 0.0;
+  };
+
+  printf("-------------------------------------------------------SHARDED SIMULATION--------------------------------------------------------------\n");
+  printf("Trace: %s, %lu instructions, %lu epochs of %lu\n", trace_path, num_trace_insts, num_epochs, EPOCH_SIZE_INSTS);
+  printf("Shards: %lu", num_shards);
+  if (num_shards < options.num_shards)
+     printf(" (not %lu: one epoch at least each)", options.num_shards);
+  printf(", each warmed up by the %lu instructions before it; ExecTime %.1f s\n", warmup, exec_time);
+  printf("Shard       Warmup        Begin          End       Cycles      IPC     MispBr     MPKI  ExecTime\n");
+  for (uint64_t k = 0; k < num_shards; k++)
+  {
+     const shard_t& shard = shards[k];
+     const cond_br_meas_t meas = sum_epochs(*shard.sim, 0, shard.num_epochs);
+     printf("%5lu %12lu %12lu %12lu %12lu %8.4f %10lu %8.4f %9.1f\n", k, shard.warmup_begin, shard.begin, shard.end,
+            meas.cycles, (double)meas.instr/(double)meas.cycles, meas.misp_br, 1000.0*((double)meas.misp_br/(double)meas.instr), shard.exec_time);
+  }
+  if (num_shards > 1)
+  {
+     printf("Warm-up error: first epoch of each shard, after its warm-up vs. simulated without interruption by the shard before\n");
+     printf("Boundary       Cycles   ContCycles    Error     MispBr ContMispBr    Error\n");
+     cond_br_meas_t warmed_sum, cont_sum;
+     for (uint64_t k = 1; k < num_shards; k++)
+     {
+        const cond_br_meas_t warmed = shards[k].sim->measure_epoch(0);
+        const cond_br_meas_t cont = shards[k - 1].sim->measure_epoch(shards[k - 1].num_epochs);
+        assert(warmed.instr == cont.instr);
+        printf("%8lu %12lu %12lu %+7.2f%% %10lu %10lu %+7.2f%%\n", shards[k].begin, warmed.cycles, cont.cycles, error(warmed.cycles, cont.cycles),
+               warmed.misp_br, cont.misp_br, error(warmed.misp_br, cont.misp_br));
+        warmed_sum.cycles += warmed.cycles;
+        cont_sum.cycles += cont.cycles;
+        warmed_sum.misp_br += warmed.misp_br;
+        cont_sum.misp_br += cont.misp_br;
+     }
+     printf("     All %12lu %12lu %+7.2f%% %10lu %10lu %+7.2f%%\n", warmed_sum.cycles, cont_sum.cycles, error(warmed_sum.cycles, cont_sum.cycles),
+            warmed_sum.misp_br, cont_sum.misp_br, error(warmed_sum.misp_br, cont_sum.misp_br));
+  }
+  printf("---------------------------------------------------------------------------------------------------------------------------------------\n");
+
+  const uint64_t num_inst = std::accumulate(num_insts_per_epoch.begin(), num_insts_per_epoch.end(), (uint64_t)0);
+  const uint64_t num_cycles = std::accumulate(num_cycles_per_epoch.begin(), num_cycles_per_epoch.end(), (uint64_t)0);
+  cond_br_meas_t all;
+  for (const shard_t& shard : shards)
+     all.cycles_on_wrong_path += sum_epochs(*shard.sim, 0, shard.num_epochs).cycles_on_wrong_path;
+  printf("\n-------------------------------------------ILP LIMIT STUDY (Stitched Together from the Shards)-----------------------------------------\n");
+  printf("instructions = %lu\n", num_inst);
+  printf("cycles       = %lu\n", num_cycles);
+  printf("CycWP        = %lu\n", all.cycles_on_wrong_path);
+  printf("IPC          = %.4f\n", ((double)num_inst/(double)num_cycles));
+  printf("\n---------------------------------------------------------------------------------------------------------------------------------------\n");
+  BP.output(num_inst);
+  BP.output_periodic_info(num_insts_per_epoch, num_cycles_per_epoch);
+}
+
+// The trace a snapshot was taken on (by size: traces are renamed and moved around) and the number
+// of its instructions simulated.
+static void snapshot_trace_position(snapshot_t& s, const char * trace_path, uint64_t& trace_insts)
+{
+  s.section("trace");
+  std::error_code ec;
+  const uint64_t trace_size = std::filesystem::file_size(trace_path, ec);
+  s.check(ec ? 0 : trace_size, "trace size");
+  snapshot_field(s, trace_insts);
+}
+
 int main(int argc, char ** argv)
 {
-  int i = parseargs(argc, argv);
-  TraceReader reader(argv[i]);
+  batch_options_t batch;
+  snapshot_options_t snap;
+  sample_options_t sample;
+  shard_options_t shards;
+  int i = parseargs(argc, argv, batch, snap, sample, shards);
+
+  if (LOG_LEVEL && (batch.input || is_cbpb_file(argv[i])))
+  {
+     printf("-T traces the timing simulation of a single .gz or .cbpt trace.\n");
+     exit(0);
+  }
+
+  if ((snap.checkpoint || snap.restore || sample.unit) && (batch.input || is_cbpb_file(argv[i])))
+  {
+     printf("--checkpoint, --restore and --sample apply to the timing simulation of a single .gz or .cbpt trace.\n");
+     exit(0);
+  }
+
+  if (snap.checkpoint && sample.unit)
+  {
+     printf("--checkpoint saves the state of a full simulation, not a sampled one.\n");
+     exit(0);
+  }
+
+  if (shards.num_shards && (batch.input || is_cbpb_file(argv[i]) || LOG_LEVEL || snap.checkpoint || snap.restore || sample.unit))
+  {
+     printf("--shards applies to the full timing simulation of a single .gz or .cbpt trace, without -T, --checkpoint, --restore or --sample.\n");
+     exit(0);
+  }
+
+  if (batch.input)
+  {
+     run_batch(batch);
+     return 0;
+  }
+
+  if (is_cbpb_file(argv[i]))
+  {
+     run_branch_stream(argv[i]);
+     return 0;
+  }
+
+  const char * trace_path = argv[i];
+  if (shards.num_shards)
+  {
+     run_sharded(shards, trace_path);
+     return 0;
+  }
+
+  TraceReader reader(trace_path, READER_THREADS);
 
   // Need to create simulator after parsing arguments (for global parameters).
-  sim = new uarchsim_t;
+  auto sim = std::make_unique<uarchsim_t>();
  
   // Get to next (optional) argument after trace filename.
   i++;
@@ -295,11 +1066,40 @@ int main(int argc, char ** argv)
   //   beginCondDirPredictor(0, (char **)NULL);
   beginCondDirPredictor();
 
-  db_t *inst = reader.get_inst(); 
+  // Trace instructions simulated so far (the snapshots are taken between two of them).
+  uint64_t trace_insts = 0;
+  if (snap.restore)
+  {
+     snapshot_t s(snap.restore, false/*saving*/);
+     snapshot_trace_position(s, trace_path, trace_insts);
+     if (!reader.seek_to_instr(trace_insts))
+        s.fail("the trace is shorter than the snapshot");
+     sim->snapshot(s);
+     snapshotCondDirPredictor(s);
+  }
+
+  if (sample.unit)
+  {
+     run_sampled(reader, *sim, sample, trace_path);
+     return 0;
+  }
+
+  // Single reusable instruction object: the reader fills it in place, so the
+  // main loop does not allocate per instruction.
+  db_t inst;
+  uint64_t num_insts = 0;
+  uint64_t reader_allocs = 0;
+  uint64_t step_allocs = 0;
+  // The predictor hooks run contestant code: their allocations are reported apart, so that the
+  // simulator's own count stays visible.
+  const uint64_t predictor_alloc_mark = sim->get_predictor_allocs();
+  uint64_t alloc_mark = heap_alloc_count();
+  bool have_inst = reader.get_inst(inst);
+  reader_allocs += heap_alloc_count() - alloc_mark;
 
   //bool dump_activity = true;
   //uint64_t current_fetch_cycle = 0;
-  while (inst != nullptr) 
+  while (have_inst) 
   {
       //const bool logging_activated = (LOG_LEVEL != 0) && (current_fetch_cycle>= LOG_START_CYCLE) && (current_fetch_cycle<=LOG_END_CYCLE);
       //if(logging_activated && dump_activity)
@@ -308,7 +1108,20 @@ int main(int argc, char ** argv)
       //    dump_activity = false;
       //}
 
-      sim->step(inst);
+      alloc_mark = heap_alloc_count();
+      sim->step(&inst);
+      step_allocs += heap_alloc_count() - alloc_mark;
+      num_insts++;
+
+      if (inst.is_last_piece && (++trace_insts == snap.checkpoint_insts) && snap.checkpoint)
+      {
+         snapshot_t s(snap.checkpoint, true/*saving*/);
+         snapshot_trace_position(s, trace_path, trace_insts);
+         sim->snapshot(s);
+         snapshotCondDirPredictor(s);
+         printf("Checkpoint of %s after %lu instructions written to %s.\n", trace_path, trace_insts, snap.checkpoint);
+         return 0;
+      }
 
       //const uint64_t next_fetch_cycle = sim->get_current_fetch_cycle();
       //if(logging_activated && next_fetch_cycle != current_fetch_cycle)
@@ -317,11 +1130,32 @@ int main(int argc, char ** argv)
       //    std::cout<<"======================================================= End "<<current_fetch_cycle<<"->"<<next_fetch_cycle<<"=======================================================\n";
       //}
       //current_fetch_cycle = next_fetch_cycle;
-      delete inst;
-      inst = reader.get_inst();
+      alloc_mark = heap_alloc_count();
+      have_inst = reader.get_inst(inst);
+      reader_allocs += heap_alloc_count() - alloc_mark;
+  }
+
+  const uint64_t predictor_allocs = sim->get_predictor_allocs() - predictor_alloc_mark;
+
+  if (snap.checkpoint)
+  {
+     printf("No checkpoint written: %s has only %lu instructions.\n", trace_path, trace_insts);
+     exit(1);
   }
 
   endPredictor();
   endCondDirPredictor();
+  sim->finish();
   sim->output();
+  printf("------------------------------------------------------HEAP ALLOCATIONS (Main Loop)-----------------------------------------------------\n");
+  printf("TraceReader::get_inst: %lu (%.3f per uop)\n", reader_allocs, num_insts ? (double)reader_allocs/(double)num_insts : 0.0);
+  printf("uarchsim_t::step: %lu (%.3f per uop)\n", step_allocs, num_insts ? (double)step_allocs/(double)num_insts : 0.0);
+  printf("  of which predictor hooks: %lu (%.3f per uop)\n", predictor_allocs, num_insts ? (double)predictor_allocs/(double)num_insts : 0.0);
+  printf("  of which simulator: %lu (populate_exec_info: %lu)\n", step_allocs - predictor_allocs, sim->get_exec_info_allocs());
+  printf("---------------------------------------------------------------------------------------------------------------------------------------\n");
+  printf("------------------------------------------------------------TRACE READER---------------------------------------------------------------\n");
+  printf("READER_THREADS = %lu\n", READER_THREADS);
+  printf("Simulation thread stalls (record ring empty): %lu\n", reader.nConsumerStalls);
+  printf("Producer thread stalls (record ring full): %lu\n", reader.nProducerStalls.load());
+  printf("---------------------------------------------------------------------------------------------------------------------------------------\n");
 }
@@ -21,6 +21,7 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 // Author: Eric Rotenberg (ericro@ncsu.edu)
 
+#include "snapshot.h"
 
 template <class T>
 class fifo_t {
@@ -36,11 +37,20 @@ public:
     ~fifo_t();
     bool empty();       // returns true if empty, false otherwise
     bool full();        // returns true if full, false otherwise
+    uint64_t get_length();      // number of entries
     T pop();        // pop and return head entry
-    void push(T value); // push value at tail entry
+    uint64_t push(const T& value);  // push value at tail entry, return its slot
   T peek();
     T peektail();       // examine value at tail entry
     T peekhead();       // examine value at head entry
+
+    // Entries stay in their slot from push to pop, so they can be referred to by slot.
+    uint64_t head_slot();       // slot of head entry
+    uint64_t tail_slot();       // slot of tail entry
+    T& at(uint64_t slot);       // entry in slot
+
+    // Entries are saved and restored in their slots (see snapshot.h).
+    void snapshot(snapshot_t& s);
 };
 
 template <class T>
@@ -54,6 +64,7 @@ fifo_t<T>::fifo_t(uint64_t size) {
 
 template <class T>
 fifo_t<T>::~fifo_t() {
+   delete[] q;
 }
 
 template <class T>
@@ -66,6 +77,11 @@ bool fifo_t<T>::full() {
    return(length == size);
 }
 
+template <class T>
+uint64_t fifo_t<T>::get_length() {
+   return(length);
+}
+
 // pop and return head entry
 template <class T>
 T fifo_t<T>::pop() {
@@ -82,13 +98,15 @@ T fifo_t<T>::pop() {
 
 // push value at tail entry
 template <class T>
-void fifo_t<T>::push(T value) {
+uint64_t fifo_t<T>::push(const T& value) {
    assert(length < size);
+   const uint64_t slot = tail;
    length++;
    q[tail] = value;
    tail++;
    if (tail == size)
       tail = 0;
+   return(slot);
 }
 
 // examine value at tail entry
@@ -104,3 +122,29 @@ template <class T>
 T fifo_t<T>::peekhead() {
    return(q[head]);
 }
+
+template <class T>
+uint64_t fifo_t<T>::head_slot() {
+   assert(length > 0);
+   return(head);
+}
+
+template <class T>
+uint64_t fifo_t<T>::tail_slot() {
+   assert(length > 0);
+   return((tail > 0) ? (tail - 1) : (size - 1));
+}
+
+template <class T>
+T& fifo_t<T>::at(uint64_t slot) {
+   assert(slot < size);
+   return(q[slot]);
+}
+
+template <class T>
+void fifo_t<T>::snapshot(snapshot_t& s) {
+   s.check(size, "fifo size");
+   snapshot_fields(s, head, tail, length);
+   for (uint64_t i = 0, slot = head; i < length; i++, slot = ((slot + 1 == size) ? 0 : (slot + 1)))
+      snapshot_field(s, q[slot]);
+}
@@ -33,6 +33,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.*/
 #include <stdlib.h>
 #include <string.h>
 #include <vector>
+#include "snapshot.h"
 
 #ifndef _ITTAGE_H
 #define _ITTAGE_H
@@ -138,6 +139,11 @@ public:
 
   IPREDICTOR(void) { reinit(); }
 
+  ~IPREDICTOR() {
+    for (int i = 0; i <= NHIST; i++)
+      delete[] itable[i];
+  }
+
   void reinit() {
     m[0] = 0;
     m[1] = MINHIST;
@@ -423,6 +429,13 @@ public:
 
     // END PREDICTOR UPDATE
   }
+
+  // The tables and histories; the lookup state is set and used within GetPrediction/UpdatePredictor.
+  void snapshot(snapshot_t &s) {
+    snapshot_fields(s, use_alt_on_na, GHIST, TICK, ghist, ptghist, phist, ch_i, ch_t, Seed);
+    for (int i = 0; i <= NHIST; i++)
+      snapshot_array(s, itable[i], (1 << LOGG));
+  }
 #undef NHIST
 #undef MINHIST
 #undef MAXHIST
@@ -23,6 +23,7 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 
 #include <inttypes.h>
+#include "parameters.h"
 
 bool VP_ENABLE = false;
 bool VP_PERFECT = false;
@@ -65,13 +66,20 @@ uint64_t L3_LATENCY = 50; // old_value = 60;
 
 uint64_t MAIN_MEMORY_LATENCY = 150;
 
+CacheRepl IC_REPL = CacheRepl::LRU;
+CacheRepl L1_REPL = CacheRepl::LRU;
+CacheRepl L2_REPL = CacheRepl::LRU;
+CacheRepl L3_REPL = CacheRepl::LRU;
+
 uint64_t DEFAULT_EXEC_LATENCY = 1;
 uint64_t FP_EXEC_LATENCY = 3;
 uint64_t SLOW_ALU_EXEC_LATENCY = 4;
 
+// nonzero: trace the pipeline events of cycles LOG_START_CYCLE to LOG_END_CYCLE into LOG_FILE (-T)
 uint64_t LOG_LEVEL = 0;
 uint64_t LOG_START_CYCLE = 0;
 uint64_t LOG_END_CYCLE = 0;
+const char *LOG_FILE = "pipe_trace.bin";
 
 uint64_t DQ_LATENCY = 2;
 
@@ -79,3 +87,5 @@ uint64_t MISP_REDUCTION_PERC = 0;
 
 uint64_t EPOCH_SIZE_INSTS = 1000000;
 bool PRINT_PER_EPOCH_STATS = false;
+
+uint64_t READER_THREADS = 0;        // 0: decode trace on the simulation thread; 1: decode on a producer thread
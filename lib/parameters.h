@@ -32,6 +32,17 @@ enum class VPTracks
     NumTracks
 };
 
+// Replacement policies of cache_t
+enum class CacheRepl
+{
+    LRU  = 0,   // true LRU
+    PLRU,       // tree pseudo-LRU (power-of-2 associativity)
+    SRRIP,      // static re-reference interval prediction, 2-bit RRPVs
+    BRRIP,      // bimodal RRIP: SRRIP inserting at distant re-reference most of the time
+    RANDOM,
+    NumPolicies
+};
+
 extern bool VP_ENABLE;
 extern bool VP_PERFECT;
 extern uint64_t VP_TRACK;
@@ -73,6 +84,11 @@ extern uint64_t L3_LATENCY;
 
 extern uint64_t MAIN_MEMORY_LATENCY;
 
+extern CacheRepl IC_REPL;
+extern CacheRepl L1_REPL;
+extern CacheRepl L2_REPL;
+extern CacheRepl L3_REPL;
+
 extern uint64_t DEFAULT_EXEC_LATENCY;
 extern uint64_t FP_EXEC_LATENCY;
 extern uint64_t SLOW_ALU_EXEC_LATENCY;
@@ -80,10 +96,13 @@ extern uint64_t SLOW_ALU_EXEC_LATENCY;
 extern uint64_t LOG_LEVEL;
 extern uint64_t LOG_START_CYCLE;
 extern uint64_t LOG_END_CYCLE;
+extern const char *LOG_FILE;
 
 extern uint64_t DQ_LATENCY;
 extern uint64_t MISP_REDUCTION_PERC;
 
 extern uint64_t EPOCH_SIZE_INSTS;
 extern bool PRINT_PER_EPOCH_STATS;
+
+extern uint64_t READER_THREADS;
 #endif
@@ -0,0 +1,106 @@
+#include <cassert>
+#include <cstring>
+#include "pipe_trace.h"
+
+static const char *const pipe_event_names[] = { "Fetched", "Decoded", "AGEN", "Executed", "Retired", "Mispredicted", "Flushed" };
+static_assert(sizeof(pipe_event_names) / sizeof(pipe_event_names[0]) == (size_t)PipeEvent::NumEvents, "one name per event");
+
+const char *pipe_event_name(PipeEvent kind)
+{
+    return ((kind < PipeEvent::NumEvents) ? pipe_event_names[(int)kind] : "?");
+}
+
+bool pipe_trace_sink_t<true>::open(const char *path, uint64_t start_cycle, uint64_t end_cycle)
+{
+    close();
+    file = fopen(path, "wb");
+    if (!file)
+        return false;
+
+    pipe_trace_header_t header;
+    memcpy(header.magic, PIPE_TRACE_MAGIC, sizeof(header.magic));
+    header.version = PIPE_TRACE_VERSION;
+    header.record_size = sizeof(pipe_event_t);
+    fwrite(&header, sizeof(header), 1, file);
+
+    ring = std::make_unique<spsc_ring_t<block_t>>(RING_BLOCKS);
+    block = ring->producer_slot();
+    block->num_events = 0;
+    closing.store(false, std::memory_order_relaxed);
+    writer = std::thread(&pipe_trace_sink_t<true>::write_blocks, this);
+
+    this->start_cycle = start_cycle;
+    this->end_cycle = end_cycle;
+    return true;
+}
+
+// Hands the current block to the writer thread and starts the next one.
+void pipe_trace_sink_t<true>::publish_block()
+{
+    ring->publish();
+    {
+        // so that the writer cannot miss the wakeup between checking the ring and going to sleep
+        std::lock_guard<std::mutex> lock(writer_mutex);
+    }
+    writer_wakeup.notify_one();
+
+    block = ring->producer_slot();
+    if (!block)
+    {
+        num_stalls++;
+        do
+        {
+            std::this_thread::yield();
+            block = ring->producer_slot();
+        } while (!block);
+    }
+    block->num_events = 0;
+}
+
+// Writer thread body: writes the published blocks out until the sink is closed and they are all written.
+void pipe_trace_sink_t<true>::write_blocks()
+{
+    while (true)
+    {
+        block_t *full = ring->consumer_slot();
+        if (!full)
+        {
+            std::unique_lock<std::mutex> lock(writer_mutex);
+            writer_wakeup.wait(lock, [this, &full] {
+                full = ring->consumer_slot();
+                return full || closing.load(std::memory_order_acquire);
+            });
+            if (!full)
+            {
+                // closing: the last blocks may have been published right before
+                full = ring->consumer_slot();
+                if (!full)
+                    return;
+            }
+        }
+        fwrite(full->events.data(), sizeof(pipe_event_t), full->num_events, file);
+        ring->release();
+    }
+}
+
+void pipe_trace_sink_t<true>::close()
+{
+    if (!file)
+        return;
+    if (block->num_events > 0)
+    {
+        ring->publish();
+        block = nullptr;
+    }
+    {
+        std::lock_guard<std::mutex> lock(writer_mutex);
+        closing.store(true, std::memory_order_release);
+    }
+    writer_wakeup.notify_one();
+    writer.join();
+
+    fclose(file);
+    file = nullptr;
+    block = nullptr;
+    ring.reset();
+}
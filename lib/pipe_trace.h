@@ -0,0 +1,138 @@
+#pragma once
+
+// Pipeline event tracing.
+// uarchsim_t reports the fetch, decode, AGEN, execute and retire of every uop, and the branch
+// mispredictions and value-misprediction flushes, to a pipe_trace_t. With tracing compiled out
+// (make PIPE_TRACE=0), pipe_trace_t does nothing and its calls compile away. Otherwise, the events
+// of the cycles chosen at run time (-T) are appended to blocks of fixed-size binary records, which
+// a writer thread writes to the file. Formatting them (as text, Konata or gem5 O3PipeView) is left
+// to a separate tool (pipe_trace_decode), so that the rest of the run pays one compare per event.
+
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include "spsc_ring.h"
+
+#ifndef PIPE_TRACE
+#define PIPE_TRACE 1
+#endif
+constexpr bool PIPE_TRACE_ENABLED = (PIPE_TRACE != 0);
+
+enum class PipeEvent : uint8_t
+{
+    Fetch = 0,
+    Decode,
+    Agen,
+    Execute,
+    Retire,
+    Mispredict,     // a branch mispredicted at fetch (cycle: its prediction)
+    Flush,          // a value misprediction flushed the uops after it (cycle: its fetch)
+    NumEvents
+};
+
+// One event of one uop, with the uop's schedule as known at the time of the event.
+struct pipe_event_t
+{
+    uint64_t cycle;
+    uint64_t seq_no;
+    uint64_t pc;
+    uint64_t fetch_cycle;
+    uint64_t decode_cycle;
+    uint64_t exec_cycle;
+    uint64_t retire_cycle;
+    uint8_t piece;
+    uint8_t kind;           // PipeEvent
+    uint8_t insn_class;     // InstClass
+    uint8_t flags;          // PIPE_EVENT_* below
+    uint32_t wrong_path_cycles;     // Mispredict/Flush: cycles until fetch resumes on the right path
+};
+static_assert(sizeof(pipe_event_t) == 64, "pipe trace records are 64 bytes");
+
+constexpr uint8_t PIPE_EVENT_BRANCH = 1;      // the uop is a branch,
+constexpr uint8_t PIPE_EVENT_TAKEN = 2;       // which is taken
+constexpr uint8_t PIPE_EVENT_PRED_TAKEN = 4;  // and predicted taken (known after the fetch event)
+
+// The file starts with this header, followed by the records in the order of the events.
+struct pipe_trace_header_t
+{
+    char magic[8];          // PIPE_TRACE_MAGIC
+    uint32_t version;
+    uint32_t record_size;   // sizeof(pipe_event_t)
+};
+constexpr char PIPE_TRACE_MAGIC[8] = {'C', 'B', 'P', 'P', 'I', 'P', 'E', '\0'};
+constexpr uint32_t PIPE_TRACE_VERSION = 2;
+
+const char *pipe_event_name(PipeEvent kind);
+
+template <bool ENABLED>
+class pipe_trace_sink_t;
+
+// Tracing compiled out.
+template <>
+class pipe_trace_sink_t<false>
+{
+  public:
+    bool open(const char *, uint64_t, uint64_t) { return false; }
+    constexpr bool active(uint64_t) const { return false; }
+    void record(const pipe_event_t&) {}
+    void close() {}
+};
+
+template <>
+class pipe_trace_sink_t<true>
+{
+    static constexpr size_t BLOCK_EVENTS = 1 << 12;
+    static constexpr uint64_t RING_BLOCKS = 8;
+
+    struct block_t
+    {
+        size_t num_events = 0;
+        std::array<pipe_event_t, BLOCK_EVENTS> events;
+    };
+
+    // The simulation thread fills the producer slot of the ring in place; the writer thread writes
+    // the published blocks out, and sleeps while there are none.
+    FILE *file = nullptr;
+    std::unique_ptr<spsc_ring_t<block_t>> ring;
+    block_t *block = nullptr;
+    std::thread writer;
+    std::mutex writer_mutex;
+    std::condition_variable writer_wakeup;
+    std::atomic<bool> closing{false};
+    uint64_t start_cycle = 0;
+    uint64_t end_cycle = 0;
+
+    void publish_block();
+    void write_blocks();
+
+  public:
+    // Number of blocks for which the simulation thread found the ring full and had to wait.
+    uint64_t num_stalls = 0;
+
+    ~pipe_trace_sink_t() { close(); }
+
+    // Traces the events of cycles start_cycle to end_cycle into path; false if it cannot be created.
+    bool open(const char *path, uint64_t start_cycle, uint64_t end_cycle);
+
+    // Whether events of cycle are traced: call record() only then.
+    bool active(uint64_t cycle) const
+    {
+        return file && (cycle >= start_cycle) && (cycle <= end_cycle);
+    }
+
+    void record(const pipe_event_t& event)
+    {
+        block->events[block->num_events++] = event;
+        if (block->num_events == BLOCK_EVENTS)
+            publish_block();
+    }
+
+    void close();
+};
+
+using pipe_trace_t = pipe_trace_sink_t<PIPE_TRACE_ENABLED>;
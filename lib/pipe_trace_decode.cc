@@ -0,0 +1,281 @@
+// Prints a pipeline event trace (cbp -T, see pipe_trace.h) as text, one event per line, or
+// converts it for a pipeline viewer:
+// -k: Konata (https://github.com/shioyadan/Konata), with the wrong-path cycles of each
+//     mispredicted branch or value misprediction shown as a flushed pseudo-uop.
+// -o: gem5 O3PipeView (util/o3-pipeview.py), one cycle per <ticks> ticks (default 1000).
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+#include "sim_common_structs.h"
+#include "pipe_trace.h"
+
+static const uint64_t UNKNOWN = UINT64_MAX;
+
+static const char *class_name(uint8_t insn_class)
+{
+    return ((insn_class < sizeof(cInfo) / sizeof(cInfo[0])) ? cInfo[insn_class] : "?");
+}
+
+static void print_event(const pipe_event_t& e)
+{
+    printf("%lu::%s: [%lu,%u] PC:0x%lx Class:%s fetch_cycle:%lu decode_cycle:%lu exec_cycle:%lu retire_cycle:%lu",
+           e.cycle, pipe_event_name((PipeEvent)e.kind), e.seq_no, e.piece, e.pc, class_name(e.insn_class),
+           e.fetch_cycle, e.decode_cycle, e.exec_cycle, e.retire_cycle);
+    if (e.flags & PIPE_EVENT_BRANCH)
+    {
+        printf(" Taken:%d", ((e.flags & PIPE_EVENT_TAKEN) != 0));
+        if ((PipeEvent)e.kind != PipeEvent::Fetch)
+            printf(" PredTaken:%d", ((e.flags & PIPE_EVENT_PRED_TAKEN) != 0));
+    }
+    if (((PipeEvent)e.kind == PipeEvent::Mispredict) || ((PipeEvent)e.kind == PipeEvent::Flush))
+        printf(" wrong_path_cycles:%u", e.wrong_path_cycles);
+    printf("\n");
+}
+
+// What the trace tells of one uop. Every event carries the uop's schedule, so uops whose first
+// events fall before the traced cycles are still complete; only the AGEN cycle needs its event.
+struct uop_t
+{
+    uint64_t seq_no;
+    uint8_t piece;
+    uint8_t insn_class;
+    uint8_t flags = 0;
+    uint64_t pc;
+    uint64_t fetch_cycle, decode_cycle, exec_cycle, retire_cycle;
+    uint64_t agen_cycle = UNKNOWN;
+    bool retired = false;       // the Retire event is in the trace
+    PipeEvent redirect = PipeEvent::NumEvents;   // Mispredict or Flush, if any
+    uint64_t redirect_cycle = 0;
+    uint64_t wrong_path_cycles = 0;
+};
+
+static std::vector<uop_t> collect_uops(FILE *f)
+{
+    std::vector<uop_t> uops;
+    std::map<std::pair<uint64_t, uint8_t>, size_t> index;
+    pipe_event_t e;
+    while (fread(&e, sizeof(e), 1, f) == 1)
+    {
+        auto it = index.emplace(std::make_pair(e.seq_no, e.piece), uops.size());
+        if (it.second)
+        {
+            uops.emplace_back();
+            uops.back().seq_no = e.seq_no;
+            uops.back().piece = e.piece;
+            uops.back().insn_class = e.insn_class;
+            uops.back().pc = e.pc;
+        }
+        uop_t& u = uops[it.first->second];
+        // the latest event knows the schedule best (pred_taken is set after the fetch event)
+        u.fetch_cycle = e.fetch_cycle;
+        u.decode_cycle = e.decode_cycle;
+        u.exec_cycle = e.exec_cycle;
+        u.retire_cycle = e.retire_cycle;
+        u.flags |= e.flags;
+        switch ((PipeEvent)e.kind)
+        {
+        case PipeEvent::Agen:
+            u.agen_cycle = e.cycle;
+            break;
+        case PipeEvent::Retire:
+            u.retired = true;
+            break;
+        case PipeEvent::Mispredict:
+        case PipeEvent::Flush:
+            u.redirect = (PipeEvent)e.kind;
+            u.redirect_cycle = e.cycle;
+            u.wrong_path_cycles = e.wrong_path_cycles;
+            break;
+        default:
+            break;
+        }
+    }
+    std::sort(uops.begin(), uops.end(), [](const uop_t& a, const uop_t& b) {
+        return (a.seq_no != b.seq_no) ? (a.seq_no < b.seq_no) : (a.piece < b.piece);
+    });
+    return uops;
+}
+
+// Konata log: commands grouped by cycle, each uop an I(nsert), its L(abels), the S(tart) and
+// E(nd) of its stages F(etch), Ds (decoded, waiting to execute), Ag(en), Cm (completed, waiting
+// to retire), and R(etire) with type 0, or 1 for a flush.
+static void print_konata(const std::vector<uop_t>& uops)
+{
+    struct command_t
+    {
+        uint64_t cycle;
+        uint64_t order;
+        std::string text;
+    };
+    std::vector<command_t> commands;
+    char buf[256];
+    auto add = [&](uint64_t cycle, const char *text) { commands.push_back({cycle, commands.size(), text}); };
+
+    uint64_t id = 0;
+    uint64_t retire_id = 0;
+    for (const uop_t& u : uops)
+    {
+        std::vector<std::pair<uint64_t, const char *>> stages = {
+            {u.fetch_cycle, "F"}, {u.decode_cycle, "Ds"}, {u.exec_cycle, "Cm"}};
+        if (u.agen_cycle != UNKNOWN)
+            stages.push_back({u.agen_cycle, "Ag"});
+        std::stable_sort(stages.begin(), stages.end());
+
+        snprintf(buf, sizeof(buf), "I\t%lu\t%lu\t0", id, u.seq_no);
+        add(u.fetch_cycle, buf);
+        snprintf(buf, sizeof(buf), "L\t%lu\t0\t[%lu,%u] 0x%lx %s", id, u.seq_no, u.piece, u.pc, class_name(u.insn_class));
+        add(u.fetch_cycle, buf);
+        if (u.flags & PIPE_EVENT_BRANCH)
+        {
+            snprintf(buf, sizeof(buf), "L\t%lu\t1\tTaken:%d PredTaken:%d", id,
+                     ((u.flags & PIPE_EVENT_TAKEN) != 0), ((u.flags & PIPE_EVENT_PRED_TAKEN) != 0));
+            add(u.fetch_cycle, buf);
+        }
+        for (size_t i = 0; i < stages.size(); i++)
+        {
+            if (i > 0)
+            {
+                snprintf(buf, sizeof(buf), "E\t%lu\t0\t%s", id, stages[i - 1].second);
+                add(stages[i].first, buf);
+            }
+            snprintf(buf, sizeof(buf), "S\t%lu\t0\t%s", id, stages[i].second);
+            add(stages[i].first, buf);
+        }
+        if (u.retired)
+        {
+            snprintf(buf, sizeof(buf), "E\t%lu\t0\t%s", id, stages.back().second);
+            add(u.retire_cycle, buf);
+            snprintf(buf, sizeof(buf), "R\t%lu\t%lu\t0", id, retire_id++);
+            add(u.retire_cycle, buf);
+        }
+        id++;
+
+        if (u.redirect != PipeEvent::NumEvents)
+        {
+            const uint64_t resume_cycle = u.redirect_cycle + u.wrong_path_cycles;
+            snprintf(buf, sizeof(buf), "I\t%lu\t%lu\t0", id, u.seq_no);
+            add(u.redirect_cycle, buf);
+            snprintf(buf, sizeof(buf), "L\t%lu\t0\twrong path after [%lu,%u] (%s, %lu cycles)", id, u.seq_no, u.piece,
+                     pipe_event_name(u.redirect), u.wrong_path_cycles);
+            add(u.redirect_cycle, buf);
+            snprintf(buf, sizeof(buf), "S\t%lu\t0\tWP", id);
+            add(u.redirect_cycle, buf);
+            snprintf(buf, sizeof(buf), "E\t%lu\t0\tWP", id);
+            add(resume_cycle, buf);
+            snprintf(buf, sizeof(buf), "R\t%lu\t0\t1", id);
+            add(resume_cycle, buf);
+            id++;
+        }
+    }
+
+    std::sort(commands.begin(), commands.end(), [](const command_t& a, const command_t& b) {
+        return (a.cycle != b.cycle) ? (a.cycle < b.cycle) : (a.order < b.order);
+    });
+    printf("Kanata\t0004\n");
+    if (commands.empty())
+        return;
+    uint64_t cycle = commands.front().cycle;
+    printf("C=\t%lu\n", cycle);
+    for (const command_t& c : commands)
+    {
+        if (c.cycle != cycle)
+        {
+            printf("C\t%lu\n", c.cycle - cycle);
+            cycle = c.cycle;
+        }
+        printf("%s\n", c.text.c_str());
+    }
+}
+
+// O3PipeView records, in program order; the fields are separated by ':', so the text of the
+// fetch record has none. The simulator has no rename nor dispatch stage of its own: they are
+// shown at the decode cycle, and issue is the AGEN cycle of memory uops.
+static void print_o3pipeview(const std::vector<uop_t>& uops, uint64_t ticks)
+{
+    for (const uop_t& u : uops)
+    {
+        const bool store = (u.insn_class == (uint8_t)InstClass::storeInstClass);
+        printf("O3PipeView:fetch:%lu:0x%016lx:%u:%lu:%s", u.fetch_cycle * ticks, u.pc, u.piece, u.seq_no, class_name(u.insn_class));
+        if (u.flags & PIPE_EVENT_BRANCH)
+            printf(" [taken=%d pred_taken=%d]", ((u.flags & PIPE_EVENT_TAKEN) != 0), ((u.flags & PIPE_EVENT_PRED_TAKEN) != 0));
+        if (u.redirect != PipeEvent::NumEvents)
+            printf(" [%s, %lu wrong-path cycles]", pipe_event_name(u.redirect), u.wrong_path_cycles);
+        printf("\n");
+        printf("O3PipeView:decode:%lu\n", u.decode_cycle * ticks);
+        printf("O3PipeView:rename:%lu\n", u.decode_cycle * ticks);
+        printf("O3PipeView:dispatch:%lu\n", u.decode_cycle * ticks);
+        printf("O3PipeView:issue:%lu\n", ((u.agen_cycle != UNKNOWN) ? u.agen_cycle : u.exec_cycle) * ticks);
+        printf("O3PipeView:complete:%lu\n", u.exec_cycle * ticks);
+        const uint64_t retire = (u.retired ? u.retire_cycle * ticks : 0);
+        printf("O3PipeView:retire:%lu:store:%lu\n", retire, (store ? retire : 0));
+    }
+}
+
+int main(int argc, char ** argv)
+{
+    char format = 't';
+    uint64_t ticks = 1000;
+    int arg = 1;
+    if ((arg < argc) && (!strcmp(argv[arg], "-k") || !strcmp(argv[arg], "-o")))
+    {
+        format = argv[arg][1];
+        arg++;
+        if ((format == 'o') && (arg + 1 < argc) && (argv[arg][0] != '-'))
+        {
+            char *end;
+            ticks = strtoul(argv[arg], &end, 0);
+            if (*end || !ticks)
+            {
+                printf("Invalid ticks per cycle: %s.\n", argv[arg]);
+                exit(1);
+            }
+            arg++;
+        }
+    }
+    if (arg != argc - 1)
+    {
+        printf("usage:\t%s\n"
+               "\t[OPTIONAL: -k to convert to a Konata log, -o [<ticks per cycle>] to gem5 O3PipeView records]\n"
+               "\t[REQUIRED: pipeline event trace written by cbp -T]\n", argv[0]);
+        exit(0);
+    }
+
+    FILE * f = fopen(argv[arg], "rb");
+    if (!f)
+    {
+        printf("Cannot open %s.\n", argv[arg]);
+        exit(1);
+    }
+
+    pipe_trace_header_t header;
+    if ((fread(&header, sizeof(header), 1, f) != 1) || memcmp(header.magic, PIPE_TRACE_MAGIC, sizeof(header.magic)) ||
+        (header.version != PIPE_TRACE_VERSION) || (header.record_size != sizeof(pipe_event_t)))
+    {
+        printf("%s is not a pipeline event trace (version %u).\n", argv[arg], PIPE_TRACE_VERSION);
+        exit(1);
+    }
+
+    if (format == 't')
+    {
+        pipe_event_t e;
+        while (fread(&e, sizeof(e), 1, f) == 1)
+            print_event(e);
+    }
+    else
+    {
+        const std::vector<uop_t> uops = collect_uops(f);
+        if (format == 'k')
+            print_konata(uops);
+        else
+            print_o3pipeview(uops, ticks);
+    }
+
+    fclose(f);
+    return 0;
+}
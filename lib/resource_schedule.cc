@@ -24,42 +24,91 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include <inttypes.h>
 #include <assert.h>
+#include <string.h>
 #include "resource_schedule.h"
+#include "snapshot.h"
 
 resource_schedule::resource_schedule(uint64_t width) {
+   assert(width > 0);
    base_cycle = 0;
    this->width = width;
-   depth = SCHED_DEPTH_INCREMENT;
-   sched = new uint64_t[depth];
-   for (uint64_t i = 0; i < depth; i++)
-      sched[i] = 0;
+   depth = SCHED_INITIAL_DEPTH;
+   sched = new uint32_t[depth]();
+   full = new uint64_t[depth / 64]();
 }
 
 resource_schedule::~resource_schedule() {
+   delete[] sched;
+   delete[] full;
 }
 
+// Grows the ring to at least new_depth slots, moving each scheduled cycle to its slot in the new ring.
 void resource_schedule::resize(uint64_t new_depth) {
-   uint64_t old_depth;
-   uint64_t *old;
-   uint64_t increments;
-   uint64_t i;
-
-   old_depth = depth;
-   old = sched;
-
-   increments = (new_depth/SCHED_DEPTH_INCREMENT);
-   if (new_depth % SCHED_DEPTH_INCREMENT)
-      increments++;
-   depth = increments*SCHED_DEPTH_INCREMENT;
-   assert(depth >= new_depth);
-
-   sched = new uint64_t[depth];
-   for (i = 0; i < old_depth; i++)
-      sched[i] = old[i];
-   for (i = old_depth; i < depth; i++)
-      sched[i] = 0;
-
-   delete[] old;
+   uint64_t old_depth = depth;
+   uint32_t *old_sched = sched;
+   uint64_t *old_full = full;
+
+   while (depth < new_depth)
+      depth *= 2;
+
+   sched = new uint32_t[depth]();
+   full = new uint64_t[depth / 64]();
+   for (uint64_t c = base_cycle; c < (base_cycle + old_depth); c++) {
+      const uint64_t old_slot = (c & (old_depth - 1));
+      const uint64_t slot = (c & (depth - 1));
+      sched[slot] = old_sched[old_slot];
+      full[slot >> 6] |= (((old_full[old_slot >> 6] >> (old_slot & 63)) & 1) << (slot & 63));
+   }
+
+   delete[] old_sched;
+   delete[] old_full;
+}
+
+// Empties the slots first_slot to end_slot - 1 (no wrap-around).
+void resource_schedule::clear(uint64_t first_slot, uint64_t end_slot) {
+   if (first_slot >= end_slot)
+      return;
+   memset(&sched[first_slot], 0, (end_slot - first_slot) * sizeof(sched[0]));
+
+   const uint64_t first_word = (first_slot >> 6);
+   const uint64_t last_word = ((end_slot - 1) >> 6);
+   const uint64_t first_mask = (~0lu << (first_slot & 63));
+   const uint64_t last_mask = (~0lu >> (63 - ((end_slot - 1) & 63)));
+   if (first_word == last_word) {
+      full[first_word] &= ~(first_mask & last_mask);
+   }
+   else {
+      full[first_word] &= ~first_mask;
+      for (uint64_t w = first_word + 1; w < last_word; w++)
+         full[w] = 0;
+      full[last_word] &= ~last_mask;
+   }
+}
+
+// The first cycle from cycle on with a free slot, or MAX_CYCLE if there is none up to limit_cycle.
+uint64_t resource_schedule::next_free(uint64_t cycle, uint64_t limit_cycle) {
+   assert(cycle >= base_cycle);
+
+   while (cycle <= limit_cycle) {
+      if ((cycle - base_cycle + 1) > depth)
+         resize(cycle - base_cycle + 1);
+
+      // free slots of the word of cycle, from cycle on
+      const uint64_t slot = (cycle & (depth - 1));
+      const uint64_t free = (~full[slot >> 6] & (~0lu << (slot & 63)));
+      if (free) {
+         const uint64_t found = ((cycle & ~63lu) + __builtin_ctzl(free));
+         // a cycle beyond the ring shares its slot with an earlier cycle: grow and look again
+         if ((found - base_cycle + 1) > depth)
+            cycle = found;
+         else
+            return ((found <= limit_cycle) ? found : MAX_CYCLE);
+      }
+      else {
+         cycle = ((cycle | 63) + 1);
+      }
+   }
+   return MAX_CYCLE;
 }
 
 uint64_t resource_schedule::schedule(uint64_t start_cycle, uint64_t max_delta) 
@@ -67,26 +116,14 @@ uint64_t resource_schedule::schedule(uint64_t start_cycle, uint64_t max_delta)
    assert(start_cycle >= base_cycle);
 
    uint64_t limit_cycle = max_delta == MAX_CYCLE ? MAX_CYCLE : start_cycle + max_delta;
-   bool found = false;
 
-   while (!found) {
-      if ((start_cycle - base_cycle + 1) > depth)
-         resize(start_cycle - base_cycle + 1);
+   start_cycle = next_free(start_cycle, limit_cycle);
+   if (start_cycle == MAX_CYCLE)
+      return MAX_CYCLE;
 
-      if (sched[MOD_S(start_cycle,depth)] < width) {
-         found = true;
-         sched[MOD_S(start_cycle,depth)]++;
-      }
-      else {
-         start_cycle++;
-         if(start_cycle > limit_cycle)
-         {
-            return MAX_CYCLE;
-         }
-      }
-   }
-
-   assert(found);
+   const uint64_t slot = (start_cycle & (depth - 1));
+   if (++sched[slot] == width)
+      full[slot >> 6] |= (1lu << (slot & 63));
    return(start_cycle);
 }
 
@@ -95,28 +132,40 @@ uint64_t resource_schedule::try_schedule(uint64_t try_cycle)
    // Calling this assumes all previous events to schedule have been scheduled.
    assert(try_cycle >= base_cycle);
 
-   bool found = false;
-
-   while (!found) {
-      if ((try_cycle - base_cycle + 1) > depth)
-         resize(try_cycle - base_cycle + 1);
+   return next_free(try_cycle, MAX_CYCLE);
+}
 
-      if (sched[MOD_S(try_cycle,depth)] < width) {
-         found = true;
+void resource_schedule::advance_base_cycle(uint64_t new_base_cycle) {
+   assert(new_base_cycle >= base_cycle);
+   if ((new_base_cycle - base_cycle) >= depth) {
+      clear(0, depth);
+   }
+   else {
+      const uint64_t first_slot = (base_cycle & (depth - 1));
+      const uint64_t end_slot = (new_base_cycle & (depth - 1));
+      if (first_slot <= end_slot) {
+         clear(first_slot, end_slot);
       }
       else {
-         try_cycle++;
+         clear(first_slot, depth);
+         clear(0, end_slot);
       }
    }
-
-   assert(found);
-   return(try_cycle);
-}
-
-void resource_schedule::advance_base_cycle(uint64_t new_base_cycle) {
-   assert(new_base_cycle >= base_cycle);
-   for (uint64_t i = base_cycle; i < new_base_cycle; i++)
-      sched[MOD_S(i,depth)] = 0;
    base_cycle = new_base_cycle;
 }
 
+void resource_schedule::snapshot(snapshot_t& s) {
+   s.check(width, "resource_schedule width");
+   uint64_t saved_depth = depth;
+   snapshot_field(s, saved_depth);
+   if (saved_depth != depth) {
+      delete[] sched;
+      delete[] full;
+      depth = saved_depth;
+      sched = new uint32_t[depth];
+      full = new uint64_t[depth / 64];
+   }
+   snapshot_field(s, base_cycle);
+   snapshot_array(s, sched, depth);
+   snapshot_array(s, full, depth / 64);
+}
@@ -22,20 +22,28 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 // Author: Eric Rotenberg (ericro@ncsu.edu)
 
 
-#define SCHED_DEPTH_INCREMENT 256
-#define MOD_S(x,y)      ((x) & ((y)-1))
+#define SCHED_INITIAL_DEPTH 4096   // power of 2, and a multiple of 64; deep enough not to grow in steady state
 
 constexpr uint64_t MAX_CYCLE = ~0lu;
 
+class snapshot_t;
+
+// Number of events scheduled in each cycle from base_cycle to base_cycle + depth - 1, at most width.
+// The cycles are kept in a ring of depth slots (cycle c in slot c & (depth - 1)), which doubles when
+// an event is scheduled too far ahead. A bitmap of the full slots lets the search for a free cycle
+// skip 64 cycles at a time.
 class resource_schedule {
 private:
-   uint64_t *sched;
+   uint32_t *sched;     // events scheduled in each slot
+   uint64_t *full;      // bit (slot & 63) of word (slot >> 6): the slot has width events
    uint64_t depth;
    uint64_t width;
 
    uint64_t base_cycle;
 
    void resize(uint64_t new_depth);
+   void clear(uint64_t first_slot, uint64_t end_slot);
+   uint64_t next_free(uint64_t cycle, uint64_t limit_cycle);
 
 public:
    resource_schedule(uint64_t width);
@@ -43,4 +51,5 @@ public:
    uint64_t schedule(uint64_t start_cycle, uint64_t max_delta = MAX_CYCLE);
    uint64_t try_schedule(uint64_t try_cycle);
    void advance_base_cycle(uint64_t new_base_cycle);
+   void snapshot(snapshot_t& s);
 };
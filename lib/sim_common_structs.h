@@ -26,6 +26,7 @@
 #include <vector>
 #include <cstdint>
 #include <ostream>
+#include "static_vec.h"
 
 enum class InstClass : uint8_t
 {
@@ -98,7 +99,7 @@ enum class HitMissInfo : uint8_t
 struct DecodeInfo
 {
     InstClass insn_class;
-    std::vector<uint64_t> src_reg_info;
+    static_vec_t<uint64_t, 3> src_reg_info;    // at most 3 source registers (A, B and C in the trace)
     std::optional<uint64_t> dst_reg_info;
     //std::optional<uint64_t> imm_op;
     DecodeInfo()
@@ -0,0 +1,109 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "parameters.h"
+#include "snapshot.h"
+
+static const char SNAPSHOT_MAGIC[8] = {'C', 'B', 'P', 'S', 'N', 'A', 'P', '\0'};
+
+// The parameters that the simulated state depends on: restoring a snapshot under another
+// configuration would not give the results of either.
+static std::string simulator_config()
+{
+   char buf[1024];
+   snprintf(buf, sizeof(buf),
+            "VP=%d,%d,%lu WINDOW=%lu FETCH=%lu,%lu,%d,%d,%d PERFECT_BP=%d,%d FILL=%lu LANES=%lu,%lu PF=%d PERFECT_CACHE=%d WA=%d "
+            "IC=%lu,%lu,%lu,%d L1=%lu,%lu,%lu,%lu,%d L2=%lu,%lu,%lu,%lu,%d L3=%lu,%lu,%lu,%lu,%d MEM=%lu "
+            "EXEC=%lu,%lu,%lu DQ=%lu MISP_RED=%lu EPOCH=%lu",
+            VP_ENABLE, VP_PERFECT, VP_TRACK, WINDOW_SIZE,
+            FETCH_WIDTH, FETCH_NUM_BRANCH, FETCH_STOP_AT_INDIRECT, FETCH_STOP_AT_TAKEN, FETCH_MODEL_ICACHE,
+            PERFECT_BRANCH_PRED, PERFECT_INDIRECT_PRED, PIPELINE_FILL_LATENCY, NUM_LDST_LANES, NUM_ALU_LANES,
+            PREFETCHER_ENABLE, PERFECT_CACHE, WRITE_ALLOCATE,
+            IC_SIZE, IC_ASSOC, IC_BLOCKSIZE, (int)IC_REPL,
+            L1_SIZE, L1_ASSOC, L1_BLOCKSIZE, L1_LATENCY, (int)L1_REPL,
+            L2_SIZE, L2_ASSOC, L2_BLOCKSIZE, L2_LATENCY, (int)L2_REPL,
+            L3_SIZE, L3_ASSOC, L3_BLOCKSIZE, L3_LATENCY, (int)L3_REPL,
+            MAIN_MEMORY_LATENCY, DEFAULT_EXEC_LATENCY, FP_EXEC_LATENCY, SLOW_ALU_EXEC_LATENCY,
+            DQ_LATENCY, MISP_REDUCTION_PERC, EPOCH_SIZE_INSTS);
+   return buf;
+}
+
+snapshot_t::snapshot_t(const char *path, bool saving)
+   : path(path), saving(saving)
+{
+   file = fopen(path, saving ? "wb" : "rb");
+   if (!file) {
+      printf("Cannot %s snapshot %s.\n", saving ? "create" : "open", path);
+      exit(1);
+   }
+
+   char magic[8];
+   memcpy(magic, SNAPSHOT_MAGIC, sizeof(magic));
+   uint32_t version = VERSION;
+   std::string config = simulator_config();
+   uint64_t config_size = config.size();
+   if (saving) {
+      bytes(magic, sizeof(magic));
+      bytes(&version, sizeof(version));
+      bytes(&config_size, sizeof(config_size));
+      bytes(&config[0], config_size);
+   }
+   else {
+      if ((fread(magic, sizeof(magic), 1, file) != 1) || memcmp(magic, SNAPSHOT_MAGIC, sizeof(magic)) ||
+          (fread(&version, sizeof(version), 1, file) != 1) || (version != VERSION)) {
+         printf("%s is not a version %u simulator snapshot.\n", path, VERSION);
+         exit(1);
+      }
+      bytes(&config_size, sizeof(config_size));
+      std::string saved(config_size, '\0');
+      bytes(&saved[0], config_size);
+      if (saved != config) {
+         printf("Snapshot %s was taken with another simulator configuration:\n  snapshot:  %s\n  this run:  %s\n",
+                path, saved.c_str(), config.c_str());
+         exit(1);
+      }
+   }
+}
+
+snapshot_t::~snapshot_t() {
+   if (saving && (fflush(file) != 0))
+      fail("write error");
+   fclose(file);
+}
+
+void snapshot_t::bytes(void *data, size_t size) {
+   if (saving) {
+      if (fwrite(data, 1, size, file) != size)
+         fail("write error");
+   }
+   else if (fread(data, 1, size, file) != size)
+      fail("truncated");
+}
+
+void snapshot_t::check(uint64_t value, const char *what) {
+   uint64_t saved = value;
+   bytes(&saved, sizeof(saved));
+   if (saved != value) {
+      char msg[256];
+      snprintf(msg, sizeof(msg), "%s is %lu, not %lu", what, saved, value);
+      fail(msg);
+   }
+}
+
+// Sections make a snapshot taken by a simulator with another layout fail where it starts to differ.
+void snapshot_t::section(const char *name) {
+   char saved[16] = {};
+   strncpy(saved, name, sizeof(saved) - 1);
+   bytes(saved, sizeof(saved));
+   if (strncmp(saved, name, sizeof(saved) - 1)) {
+      char msg[64];
+      snprintf(msg, sizeof(msg), "expected section %.15s, found %.15s", name, saved);
+      fail(msg);
+   }
+}
+
+void snapshot_t::fail(const char *what) {
+   printf("Snapshot %s: %s.\n", path.c_str(), what);
+   exit(1);
+}
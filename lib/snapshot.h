@@ -0,0 +1,169 @@
+#pragma once
+
+// Simulator snapshots (cbp --checkpoint/--restore).
+// A snapshot holds the state of a timing simulation between two instructions: uarchsim_t with its
+// caches, prefetcher and branch predictors, the conditional branch predictor (snapshotCondDirPredictor
+// in cbp.h) and the number of trace records consumed. Restoring it and simulating the rest of the
+// trace gives the same results as simulating the whole trace.
+//
+// Each class describes its state once, in a snapshot(snapshot_t&) member that passes its fields
+// to snapshot_field(): saving, they are written to the file; restoring, they are read back in
+// place. Only state that lives from one instruction to the next is described, not the scratch
+// state of a single call. Fields are written in their in-memory layout, so a snapshot is restored
+// by the simulator that wrote it, with the same configuration (checked by the header).
+
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "static_vec.h"
+
+class snapshot_t
+{
+    FILE *file;
+    std::string path;
+    bool saving;
+
+  public:
+    static const uint32_t VERSION = 1;
+
+    // Creates path and writes the header (saving), or opens path and checks its header (restoring).
+    // Exits with an error message if the file cannot be used.
+    snapshot_t(const char *path, bool saving);
+    ~snapshot_t();
+
+    bool is_saving() const { return saving; }
+
+    void bytes(void *data, size_t size);
+
+    // Saves value, or checks that the snapshot holds the same value (a table size, a section
+    // name...) and exits with an error naming what otherwise.
+    void check(uint64_t value, const char *what);
+    void section(const char *name);
+
+    // Exits with an error message about the snapshot.
+    [[noreturn]] void fail(const char *what);
+};
+
+// The containers' overloads call each other, so they are all declared first.
+template <class T> void snapshot_field(snapshot_t& s, T& x);
+template <class T, size_t N> void snapshot_field(snapshot_t& s, T (&x)[N]);
+template <class T, class A> void snapshot_field(snapshot_t& s, std::vector<T, A>& v);
+template <class T, class A> void snapshot_field(snapshot_t& s, std::deque<T, A>& d);
+template <class K, class V, class H, class E, class A> void snapshot_field(snapshot_t& s, std::unordered_map<K, V, H, E, A>& m);
+template <class T1, class T2> void snapshot_field(snapshot_t& s, std::pair<T1, T2>& p);
+template <class... T> void snapshot_field(snapshot_t& s, std::tuple<T...>& t);
+template <class T, size_t N> void snapshot_field(snapshot_t& s, static_vec_t<T, N>& v);
+
+template <class T>
+void snapshot_field(snapshot_t& s, T& x)
+{
+    static_assert(std::is_trivially_copyable<T>::value, "snapshot_field needs an overload for this type");
+    s.bytes(&x, sizeof(T));
+}
+
+template <class T>
+void snapshot_array(snapshot_t& s, T *x, size_t n)
+{
+    if constexpr (std::is_trivially_copyable<T>::value)
+        s.bytes(x, n * sizeof(T));
+    else
+        for (size_t i = 0; i < n; i++)
+            snapshot_field(s, x[i]);
+}
+
+template <class T, size_t N>
+void snapshot_field(snapshot_t& s, T (&x)[N])
+{
+    snapshot_array(s, x, N);
+}
+
+template <class T, class A>
+void snapshot_field(snapshot_t& s, std::vector<T, A>& v)
+{
+    uint64_t n = v.size();
+    snapshot_field(s, n);
+    if (!s.is_saving())
+        v.resize(n);
+    snapshot_array(s, v.data(), n);
+}
+
+template <class T, class A>
+void snapshot_field(snapshot_t& s, std::deque<T, A>& d)
+{
+    uint64_t n = d.size();
+    snapshot_field(s, n);
+    if (!s.is_saving())
+        d.resize(n);
+    for (T& x : d)
+        snapshot_field(s, x);
+}
+
+template <class K, class V, class H, class E, class A>
+void snapshot_field(snapshot_t& s, std::unordered_map<K, V, H, E, A>& m)
+{
+    uint64_t n = m.size();
+    snapshot_field(s, n);
+    if (s.is_saving())
+    {
+        for (auto& kv : m)
+        {
+            K key = kv.first;
+            snapshot_field(s, key);
+            snapshot_field(s, kv.second);
+        }
+    }
+    else
+    {
+        m.clear();
+        for (uint64_t i = 0; i < n; i++)
+        {
+            K key;
+            V value;
+            snapshot_field(s, key);
+            snapshot_field(s, value);
+            m.emplace(key, value);
+        }
+    }
+}
+
+template <class T1, class T2>
+void snapshot_field(snapshot_t& s, std::pair<T1, T2>& p)
+{
+    snapshot_field(s, p.first);
+    snapshot_field(s, p.second);
+}
+
+template <class... T>
+void snapshot_field(snapshot_t& s, std::tuple<T...>& t)
+{
+    std::apply([&s](auto&... x) { (snapshot_field(s, x), ...); }, t);
+}
+
+template <class T, size_t N>
+void snapshot_field(snapshot_t& s, static_vec_t<T, N>& v)
+{
+    uint64_t n = v.size();
+    snapshot_field(s, n);
+    if (!s.is_saving())
+    {
+        if (n > N)
+            s.fail("static_vec_t capacity exceeded");
+        v.clear();
+        for (uint64_t i = 0; i < n; i++)
+            v.push_back(T());
+    }
+    snapshot_array(s, v.begin(), n);
+}
+
+// snapshot_field of each argument in turn.
+template <class... T>
+void snapshot_fields(snapshot_t& s, T&... x)
+{
+    (snapshot_field(s, x), ...);
+}
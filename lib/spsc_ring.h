@@ -0,0 +1,70 @@
+#pragma once
+
+// Single-producer/single-consumer lock-free ring.
+// The producer fills producer_slot() in place and then publish()es it; the consumer
+// reads consumer_slot() in place and then release()s it. Each side caches the other
+// side's index so that the shared atomics are only reloaded when the ring looks full/empty.
+
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <vector>
+
+template <class T>
+class spsc_ring_t
+{
+    std::vector<T> slots;
+    uint64_t mask;
+
+    // Written by the consumer.
+    alignas(64) std::atomic<uint64_t> head{0};
+    uint64_t cached_tail = 0;
+
+    // Written by the producer.
+    alignas(64) std::atomic<uint64_t> tail{0};
+    uint64_t cached_head = 0;
+
+public:
+    // size must be a power of two.
+    explicit spsc_ring_t(uint64_t size)
+        : slots(size), mask(size - 1)
+    {
+        assert(size && ((size & (size - 1)) == 0));
+    }
+
+    // Producer side: next free slot, or nullptr if the ring is full.
+    T *producer_slot()
+    {
+        const uint64_t t = tail.load(std::memory_order_relaxed);
+        if ((t - cached_head) == slots.size())
+        {
+            cached_head = head.load(std::memory_order_acquire);
+            if ((t - cached_head) == slots.size())
+                return nullptr;
+        }
+        return &slots[t & mask];
+    }
+
+    void publish()
+    {
+        tail.store(tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    // Consumer side: oldest published slot, or nullptr if the ring is empty.
+    T *consumer_slot()
+    {
+        const uint64_t h = head.load(std::memory_order_relaxed);
+        if (h == cached_tail)
+        {
+            cached_tail = tail.load(std::memory_order_acquire);
+            if (h == cached_tail)
+                return nullptr;
+        }
+        return &slots[h & mask];
+    }
+
+    void release()
+    {
+        head.store(head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+};
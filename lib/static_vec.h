@@ -0,0 +1,103 @@
+#pragma once
+
+// Fixed-capacity vector with inline storage.
+// Used on the per-instruction path (trace reader, decode info) where the number of
+// elements is bounded by the ISA and a std::vector would cost a heap allocation per record.
+// Only the subset of the std::vector interface the simulator needs is provided.
+
+#include <cstddef>
+#include <cstdint>
+#include <cassert>
+#include <array>
+#include <algorithm>
+#include <iterator>
+
+template <typename T, std::size_t N>
+class static_vec_t
+{
+    std::array<T, N> elems;
+    uint32_t len = 0;
+
+public:
+    using value_type = T;
+    using size_type = std::size_t;
+    using iterator = T*;
+    using const_iterator = const T*;
+    using reverse_iterator = std::reverse_iterator<iterator>;
+    using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+
+    static_vec_t() = default;
+
+    static_vec_t(const static_vec_t& other)
+    {
+        *this = other;
+    }
+
+    // Only copy the live elements.
+    static_vec_t& operator=(const static_vec_t& other)
+    {
+        len = other.len;
+        std::copy(other.begin(), other.end(), begin());
+        return *this;
+    }
+
+    static constexpr size_type capacity() { return N; }
+    size_type size() const { return len; }
+    bool empty() const { return len == 0; }
+    bool full() const { return len == N; }
+    void clear() { len = 0; }
+
+    void push_back(const T& value)
+    {
+        assert(len < N && "static_vec_t capacity exceeded");
+        elems[len++] = value;
+    }
+
+    void pop_back()
+    {
+        assert(len > 0);
+        len--;
+    }
+
+    T& operator[](size_type i) { return elems[i]; }
+    const T& operator[](size_type i) const { return elems[i]; }
+
+    T& at(size_type i)
+    {
+        assert(i < len);
+        return elems[i];
+    }
+
+    const T& at(size_type i) const
+    {
+        assert(i < len);
+        return elems[i];
+    }
+
+    T& front() { return at(0); }
+    const T& front() const { return at(0); }
+    T& back() { return at(len - 1); }
+    const T& back() const { return at(len - 1); }
+
+    iterator begin() { return elems.data(); }
+    iterator end() { return elems.data() + len; }
+    const_iterator begin() const { return elems.data(); }
+    const_iterator end() const { return elems.data() + len; }
+    reverse_iterator rbegin() { return reverse_iterator(end()); }
+    reverse_iterator rend() { return reverse_iterator(begin()); }
+    const_reverse_iterator rbegin() const { return const_reverse_iterator(end()); }
+    const_reverse_iterator rend() const { return const_reverse_iterator(begin()); }
+
+    iterator erase(const_iterator pos)
+    {
+        return erase(pos, pos + 1);
+    }
+
+    iterator erase(const_iterator first, const_iterator last)
+    {
+        iterator dst = begin() + (first - begin());
+        std::copy(last, const_iterator(end()), dst);
+        len -= (last - first);
+        return dst;
+    }
+};
@@ -0,0 +1,215 @@
+#pragma once
+
+// Store queue (SQ) timing for store-to-load forwarding.
+//
+// For every byte written by a store that has not left the SQ yet, keeps the execution cycle and the
+// SQ release cycle (ret_cycle) of the youngest store to that byte. Bytes are grouped in aligned
+// 8-byte chunks with a valid mask, held in an open-addressing hash table, so a load probes the table
+// once per chunk it touches rather than once per byte.
+//
+// A byte whose ret_cycle is <= the current fetch cycle can never forward again (loads search the SQ
+// strictly after their fetch cycle), so evict() drops it. Stores are visited for eviction in fetch
+// order, which keeps the table bounded by the stores that are still in flight. That order is kept in
+// a power-of-two ring that, like the table, only grows if more stores are in flight than it was sized
+// for, so steady-state simulation does not allocate.
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+#include "snapshot.h"
+
+class store_queue_t
+{
+    static constexpr uint64_t CHUNK_BYTES = 8;
+    static constexpr uint64_t EMPTY = UINT64_MAX;
+
+    struct chunk_t
+    {
+        uint64_t tag = EMPTY;                 // addr / CHUNK_BYTES, EMPTY if the slot is free
+        uint8_t mask = 0;                     // bytes that hold a store
+        uint64_t exec_cycle[CHUNK_BYTES];     // store's execution cycle
+        uint64_t ret_cycle[CHUNK_BYTES];      // store's commit cycle
+    };
+
+    std::vector<chunk_t> table;
+    uint64_t table_mask;
+    uint64_t num_chunks = 0;
+
+    // Chunks written by each store, in fetch order, with the store's ret_cycle: entries
+    // [retire_head, retire_tail) of a ring indexed modulo its size.
+    std::vector<std::pair<uint64_t/*tag*/, uint64_t/*ret_cycle*/>> retire_order;
+    uint64_t retire_mask;
+    uint64_t retire_head = 0;
+    uint64_t retire_tail = 0;
+
+    uint64_t home(uint64_t tag) const
+    {
+        return (tag * 0x9E3779B97F4A7C15ULL) >> (64 - __builtin_ctzll(table.size())) & table_mask;
+    }
+
+    chunk_t *find(uint64_t tag)
+    {
+        for (uint64_t i = home(tag); ; i = (i + 1) & table_mask)
+        {
+            if (table[i].tag == tag)
+                return &table[i];
+            if (table[i].tag == EMPTY)
+                return nullptr;
+        }
+    }
+
+    chunk_t &find_or_insert(uint64_t tag)
+    {
+        if (2 * (num_chunks + 1) > table.size())
+            grow();
+        uint64_t i = home(tag);
+        for (; table[i].tag != EMPTY; i = (i + 1) & table_mask)
+        {
+            if (table[i].tag == tag)
+                return table[i];
+        }
+        num_chunks++;
+        table[i].tag = tag;
+        table[i].mask = 0;
+        return table[i];
+    }
+
+    // Linear-probing deletion: shift back later entries of the cluster so that no tombstone is needed.
+    void erase(chunk_t *c)
+    {
+        uint64_t hole = c - table.data();
+        table[hole].tag = EMPTY;
+        num_chunks--;
+        for (uint64_t i = (hole + 1) & table_mask; table[i].tag != EMPTY; i = (i + 1) & table_mask)
+        {
+            const uint64_t h = home(table[i].tag);
+            // Move entry i into the hole if its home is not cyclically within (hole, i].
+            if (((i - h) & table_mask) >= ((i - hole) & table_mask))
+            {
+                table[hole] = table[i];
+                table[i].tag = EMPTY;
+                hole = i;
+            }
+        }
+    }
+
+    void grow()
+    {
+        std::vector<chunk_t> old(table.size() * 2);
+        old.swap(table);
+        table_mask = table.size() - 1;
+        num_chunks = 0;
+        for (const chunk_t &c : old)
+        {
+            if (c.tag != EMPTY)
+            {
+                chunk_t &n = find_or_insert(c.tag);
+                n = c;
+            }
+        }
+    }
+
+    void grow_retire_order()
+    {
+        std::vector<std::pair<uint64_t, uint64_t>> old(retire_order.size() * 2);
+        old.swap(retire_order);
+        retire_mask = retire_order.size() - 1;
+        const uint64_t n = retire_tail - retire_head;
+        for (uint64_t i = 0; i < n; i++)
+            retire_order[i] = old[(retire_head + i) & (old.size() - 1)];
+        retire_head = 0;
+        retire_tail = n;
+    }
+
+public:
+    // initial_chunks is rounded up to a power of two; the table and the retire order ring grow if more
+    // stores are in flight.
+    explicit store_queue_t(uint64_t initial_chunks)
+    {
+        uint64_t size = 16;
+        while (size < 2 * initial_chunks)
+            size <<= 1;
+        table.resize(size);
+        table_mask = size - 1;
+        retire_order.resize(size);
+        retire_mask = size - 1;
+    }
+
+    // Record a store of [addr, addr+size).
+    void store(uint64_t addr, uint64_t size, uint64_t exec_cycle, uint64_t ret_cycle)
+    {
+        const uint64_t end = addr + size;
+        while (addr < end)
+        {
+            const uint64_t tag = addr / CHUNK_BYTES;
+            const uint64_t chunk_end = (tag + 1) * CHUNK_BYTES;
+            chunk_t &c = find_or_insert(tag);
+            for (; (addr < end) && (addr < chunk_end); addr++)
+            {
+                const uint64_t b = addr % CHUNK_BYTES;
+                c.mask |= (1 << b);
+                c.exec_cycle[b] = exec_cycle;
+                c.ret_cycle[b] = ret_cycle;
+            }
+            if (retire_tail - retire_head == retire_order.size())
+                grow_retire_order();
+            retire_order[retire_tail++ & retire_mask] = {tag, ret_cycle};
+        }
+    }
+
+    // Timestamp of a load of [addr, addr+size) that searches the SQ in exec_cycle: each byte is available
+    // at the later of exec_cycle and the store's exec_cycle if a store still holds it, or at
+    // data_cache_cycle otherwise. sq_miss is set if at least one byte comes from the cache.
+    uint64_t load(uint64_t addr, uint64_t size, uint64_t exec_cycle, uint64_t data_cache_cycle, bool &sq_miss)
+    {
+        uint64_t avail = 0;
+        const uint64_t end = addr + size;
+        while (addr < end)
+        {
+            const uint64_t tag = addr / CHUNK_BYTES;
+            const uint64_t chunk_end = (tag + 1) * CHUNK_BYTES;
+            const chunk_t *c = find(tag);
+            for (; (addr < end) && (addr < chunk_end); addr++)
+            {
+                const uint64_t b = addr % CHUNK_BYTES;
+                if (c && (c->mask & (1 << b)) && (exec_cycle < c->ret_cycle[b]))
+                {
+                    // SQ hit: the byte's timestamp is the later of load's execution cycle and store's execution cycle
+                    avail = std::max(avail, std::max(exec_cycle, c->exec_cycle[b]));
+                }
+                else
+                {
+                    // SQ miss: the byte's timestamp is its availability in L1 D$
+                    avail = std::max(avail, data_cache_cycle);
+                    sq_miss = true;
+                }
+            }
+        }
+        return avail;
+    }
+
+    // Drop the bytes of stores that left the SQ by cycle (see top of file).
+    void evict(uint64_t cycle)
+    {
+        while ((retire_head != retire_tail) && (retire_order[retire_head & retire_mask].second <= cycle))
+        {
+            chunk_t *c = find(retire_order[retire_head++ & retire_mask].first);
+            if (!c)
+                continue;
+            for (uint64_t b = 0; b < CHUNK_BYTES; b++)
+            {
+                if ((c->mask & (1 << b)) && (c->ret_cycle[b] <= cycle))
+                    c->mask &= ~(1 << b);
+            }
+            if (c->mask == 0)
+                erase(c);
+        }
+    }
+
+    uint64_t size() const { return num_chunks; }
+
+    void snapshot(snapshot_t& s)
+    {
+        snapshot_fields(s, table, table_mask, num_chunks, retire_order, retire_mask, retire_head, retire_tail);
+    }
+};
@@ -2,9 +2,9 @@
 
 #include <cassert>
 #include <vector>
-#include <deque>
 #include <map>
 #include <algorithm>
+#include "snapshot.h"
 //#include <optional>
 
 #define DEF_ENUM(ENUM, NAME) _DEF_ENUM(ENUM, NAME)
@@ -134,6 +134,7 @@ class StridePrefetcher
 
     StridePrefetcher()
     {
+        queue.reserve(PF_QUEUE_SIZE);
         init(NUM_RPT_ENTRIES);
     }
 
@@ -333,7 +334,7 @@ class StridePrefetcher
         {
             spdlog::debug("Dropping pf because too old (created at cycle {}, current fetch cycle {})", queue.front().cycle_generated, cycle);
             ++stat_dropped_untimely_pf;
-            queue.pop_front();
+            queue.erase(queue.begin());
         }
 
         if(!queue.empty())
@@ -341,7 +342,7 @@ class StridePrefetcher
             p = queue.front();
             if(p.cycle_generated <= cycle)
             {
-                queue.pop_front();
+                queue.erase(queue.begin());
                 ++stat_issued;
                 return true;
             }
@@ -354,7 +355,7 @@ class StridePrefetcher
     void put_back(const Prefetch & p)
     {
         ++stat_put_back;
-        queue.push_front(p);
+        queue.insert(queue.begin(), p);
     }
 
     uint64_t get_oldest_pf_cycle() const
@@ -379,12 +380,20 @@ class StridePrefetcher
         std::cout << "Num prefetches not issued LDST contention :" << stat_put_back << std::endl;
         std::cout << "Num prefetches not issued stride 0 :" << stat_stride_zero << std::endl;
     }
+
+    void snapshot(snapshot_t& s)
+    {
+        snapshot_fields(s, rpt, lru_info, queue, stat_trainings, stat_generated, stat_issued,
+                        stat_duplicate_pf_filtered, stat_dropped_untimely_pf, stat_put_back, stat_stride_zero);
+    }
     private:
     std::array<RPTEntry, NUM_RPT_ENTRIES> rpt;
     uint64_t lru_info;
 
-    //Queue to store generated prefetches
-    std::deque<Prefetch> queue;
+    //Queue to store generated prefetches. A few entries at most (they are dropped after
+    //PF_MUST_ISSUE_BEFORE_CYCLES): a vector that keeps its capacity, where a deque would keep
+    //allocating and freeing blocks as prefetches come and go.
+    std::vector<Prefetch> queue;
     //Stats
     uint64_t stat_trainings = 0;
     uint64_t stat_generated = 0;
@@ -0,0 +1,223 @@
+#pragma once
+
+// Native CBP trace container (.cbpt).
+//
+// A .cbpt file holds the same byte-level records as a CBP .gz trace (see trace_reader.h for the
+// record format), split into chunks that always end on a record boundary:
+//
+//   cbpt_header_t                          - fixed size, at offset 0
+//   chunk 0 .. chunk (num_chunks-1)        - stored back to back, raw or compressed (header.codec)
+//   cbpt_chunk_t[num_chunks]               - chunk index, at header.index_offset
+//
+// Files are produced once from a .gz trace by trace_convert and read back by TraceReader through
+// cbpt_input_t, which mmaps the file and hands out record bytes straight from the mapping
+// (raw chunks) or from a per-chunk inflate buffer (compressed chunks).
+//
+// zlib is the only compression codec for now (zstd/lz4 are not a build dependency of the simulator);
+// the codec field leaves room for more.
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <zlib.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static constexpr char CBPT_MAGIC[8] = {'C', 'B', 'P', 'T', 'R', 'A', 'C', 'E'};
+static constexpr uint32_t CBPT_VERSION = 1;
+
+enum class cbpt_codec_t : uint32_t
+{
+    none = 0,
+    zlib = 1,
+};
+
+struct cbpt_header_t
+{
+    char magic[8];
+    uint32_t version;
+    cbpt_codec_t codec;
+    uint64_t num_records;     // trace instructions in the file
+    uint64_t num_chunks;
+    uint64_t index_offset;    // file offset of the chunk index
+    uint64_t max_chunk_bytes; // largest uncompressed chunk, sizes the inflate buffer
+};
+
+struct cbpt_chunk_t
+{
+    uint64_t offset;        // file offset of the stored chunk
+    uint64_t stored_bytes;  // size in the file
+    uint64_t raw_bytes;     // size once decompressed
+    uint64_t first_record;  // index of the first trace instruction in the chunk
+};
+
+// Returns true if the file at path starts with the .cbpt magic.
+inline bool is_cbpt_file(const char * path)
+{
+    char magic[sizeof(CBPT_MAGIC)];
+    FILE * f = fopen(path, "rb");
+    if (!f)
+        return false;
+    const bool is_cbpt = (fread(magic, 1, sizeof(magic), f) == sizeof(magic)) && !memcmp(magic, CBPT_MAGIC, sizeof(magic));
+    fclose(f);
+    return is_cbpt;
+}
+
+// Read side of a .cbpt file. Offers the read()/eof() subset of std::istream that
+// TraceReader::decodeRecord() relies on, so the same decoder serves .gz and .cbpt traces.
+class cbpt_input_t
+{
+    const uint8_t * map = nullptr;
+    size_t map_size = 0;
+
+    const cbpt_header_t * header = nullptr;
+    const cbpt_chunk_t * index = nullptr;
+    uint64_t next_chunk = 0;
+
+    // Bytes of the current chunk that have not been consumed yet.
+    const uint8_t * cur = nullptr;
+    const uint8_t * end = nullptr;
+
+    std::vector<uint8_t> inflate_buf;
+    bool at_eof = false;
+
+    // Make the next chunk current. Returns false past the last chunk.
+    bool load_next_chunk()
+    {
+        if (next_chunk == header->num_chunks)
+            return false;
+
+        const cbpt_chunk_t & chunk = index[next_chunk++];
+        if (header->codec == cbpt_codec_t::none)
+        {
+            cur = map + chunk.offset;
+        }
+        else
+        {
+            uLongf raw_bytes = chunk.raw_bytes;
+            const int ret = uncompress(inflate_buf.data(), &raw_bytes, map + chunk.offset, chunk.stored_bytes);
+            if ((ret != Z_OK) || (raw_bytes != chunk.raw_bytes))
+            {
+                printf("Corrupted chunk %lu in .cbpt trace (zlib error %d).\n", next_chunk - 1, ret);
+                exit(1);
+            }
+            cur = inflate_buf.data();
+        }
+        end = cur + chunk.raw_bytes;
+        return true;
+    }
+
+    // Checks the chunk index once, so that chunks can be loaded without bounds checks: every
+    // chunk lies in the mapping and fits inflate_buf, and seek_chunk() can binary-search it.
+    bool valid_index()
+    {
+        if (((header->codec != cbpt_codec_t::none) && (header->codec != cbpt_codec_t::zlib)) ||
+            (header->index_offset > map_size) ||
+            (header->num_chunks > (map_size - header->index_offset) / sizeof(cbpt_chunk_t)) ||
+            ((header->num_chunks == 0) && (header->num_records != 0)))
+            return false;
+        index = (const cbpt_chunk_t *)(map + header->index_offset);
+
+        for (uint64_t i = 0; i < header->num_chunks; i++)
+        {
+            const cbpt_chunk_t & chunk = index[i];
+            if ((chunk.offset > map_size) || (chunk.stored_bytes > map_size - chunk.offset) ||
+                (chunk.raw_bytes > header->max_chunk_bytes) ||
+                ((header->codec == cbpt_codec_t::none) && (chunk.raw_bytes != chunk.stored_bytes)) ||
+                (chunk.first_record > header->num_records) ||
+                ((i == 0) ? (chunk.first_record != 0) : (chunk.first_record < index[i - 1].first_record)))
+                return false;
+        }
+        return true;
+    }
+
+public:
+    explicit cbpt_input_t(const char * path)
+    {
+        const int fd = open(path, O_RDONLY);
+        struct stat st;
+        if ((fd < 0) || (fstat(fd, &st) != 0) || ((size_t)st.st_size < sizeof(cbpt_header_t)))
+        {
+            printf("Cannot open .cbpt trace %s.\n", path);
+            exit(1);
+        }
+        map_size = st.st_size;
+        void * addr = mmap(nullptr, map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (addr == MAP_FAILED)
+        {
+            printf("Cannot mmap .cbpt trace %s.\n", path);
+            exit(1);
+        }
+        map = (const uint8_t *)addr;
+        madvise(addr, map_size, MADV_SEQUENTIAL);
+
+        header = (const cbpt_header_t *)map;
+        if (memcmp(header->magic, CBPT_MAGIC, sizeof(CBPT_MAGIC)) || (header->version != CBPT_VERSION) || !valid_index())
+        {
+            printf("%s is not a valid version %u .cbpt trace.\n", path, CBPT_VERSION);
+            exit(1);
+        }
+
+        if (header->codec != cbpt_codec_t::none)
+            inflate_buf.resize(header->max_chunk_bytes);
+    }
+
+    ~cbpt_input_t()
+    {
+        if (map)
+            munmap((void *)map, map_size);
+    }
+
+    cbpt_input_t(const cbpt_input_t &) = delete;
+    cbpt_input_t & operator=(const cbpt_input_t &) = delete;
+
+    uint64_t num_records() const { return header->num_records; }
+
+    // Moves to the chunk holding record n and returns the index of its first record: the records
+    // from there to n are still to be read. Past the last record, moves to the end.
+    uint64_t seek_chunk(uint64_t n)
+    {
+        at_eof = false;
+        cur = end = nullptr;
+        if (n >= header->num_records)
+        {
+            next_chunk = header->num_chunks;
+            return header->num_records;
+        }
+        // the index is in record order: find the last chunk starting at or before n
+        const cbpt_chunk_t * chunk = std::upper_bound(index, index + header->num_chunks, n,
+            [](uint64_t record, const cbpt_chunk_t & c) { return record < c.first_record; }) - 1;
+        next_chunk = chunk - index;
+        load_next_chunk();
+        return chunk->first_record;
+    }
+
+    // Records never straddle chunks, so moving to the next chunk only happens when a
+    // record starts exactly at the end of the current one.
+    void read(char * dst, size_t n)
+    {
+        if (cur == end)
+        {
+            if (!load_next_chunk())
+            {
+                at_eof = true;
+                return;
+            }
+        }
+        if ((size_t)(end - cur) < n)
+        {
+            printf("Truncated record in .cbpt trace.\n");
+            exit(1);
+        }
+        memcpy(dst, cur, n);
+        cur += n;
+    }
+
+    bool eof() const { return at_eof; }
+};
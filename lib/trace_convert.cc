@@ -0,0 +1,454 @@
+// Converts a CBP .gz trace into the native .cbpt container (see trace_container.h).
+// The records are validated with the simulator's own decoder while they are copied, so
+// a converted trace is guaranteed to replay exactly like the original one.
+//
+// With -b, extracts the branch-only stream (see branch_stream.h) from a .gz or .cbpt trace instead.
+// With -i, writes the seek index (see trace_index.h) of a .gz trace next to it instead.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <memory>
+#include <vector>
+#include "trace_reader.h"
+#include "branch_stream.h"
+
+// Forwards reads to the gzip stream and keeps a copy of every byte, so that the
+// bytes of each record can be written out once TraceReader::decodeRecord() accepted it.
+struct tee_input_t
+{
+    gz::igzstream& input;
+    std::vector<uint8_t>& bytes;
+
+    void read(char * dst, size_t n)
+    {
+        input.read(dst, n);
+        bytes.insert(bytes.end(), (uint8_t *)dst, (uint8_t *)dst + input.gcount());
+    }
+
+    bool eof() const { return input.eof(); }
+};
+
+static void write_or_die(FILE * f, const void * data, size_t n, const char * path)
+{
+    if (fwrite(data, 1, n, f) != n)
+    {
+        printf("Write to %s failed.\n", path);
+        exit(1);
+    }
+}
+
+// Inflates a .gz trace for its index, one deflate block at a time (as zran.c does), into a
+// circular window of the last 32 KB inflated. Offers read()/eof() to TraceReader::decodeRecord(),
+// which tells where the records start, and keeps the state of the inflater at the last block
+// boundary before what has been read, from which an access point is made.
+class gz_indexer_t
+{
+    FILE * file;
+    z_stream strm;
+    std::vector<uint8_t> in_buf;
+    uint8_t window[CBPI_WINDOW_BYTES];
+    uint64_t in_total = 0;       // compressed bytes given to the inflater
+    uint64_t out_total = 0;      // bytes inflated
+    uint64_t consumed = 0;       // bytes read (never more than one inflate() call behind out_total)
+    bool at_eof = false;
+
+    // The last block boundary at or before consumed, and the one at the end of the bytes not read
+    // yet, if any. Each inflate() call stops at a boundary, so there is never more than one of those.
+    std::unique_ptr<cbpi_point_t> last = std::make_unique<cbpi_point_t>();
+    std::unique_ptr<cbpi_point_t> pending = std::make_unique<cbpi_point_t>();
+    uint64_t last_out = 0;
+    uint64_t pending_out = 0;
+    bool has_last = false;
+    bool has_pending = false;
+
+    void promote_pending()
+    {
+        if (has_pending && (pending_out <= consumed))
+        {
+            std::swap(last, pending);
+            last_out = pending_out;
+            has_last = true;
+            has_pending = false;
+        }
+    }
+
+    // One inflate() call, up to the end of the window or the next block boundary. Returns false
+    // at the end of the file.
+    bool inflate_once()
+    {
+        if (strm.avail_in == 0)
+        {
+            strm.avail_in = fread(in_buf.data(), 1, in_buf.size(), file);
+            strm.next_in = in_buf.data();
+            in_total += strm.avail_in;
+            if (strm.avail_in == 0)
+                return false;
+        }
+        const size_t pos = out_total % CBPI_WINDOW_BYTES;
+        strm.next_out = window + pos;
+        strm.avail_out = CBPI_WINDOW_BYTES - pos;
+        const int ret = inflate(&strm, Z_BLOCK);
+        if ((ret != Z_OK) && (ret != Z_STREAM_END) && (ret != Z_BUF_ERROR))
+        {
+            printf("Corrupted .gz trace (zlib error %d).\n", ret);
+            exit(1);
+        }
+        out_total += (CBPI_WINDOW_BYTES - pos) - strm.avail_out;
+
+        if (ret == Z_STREAM_END)
+        {
+            // another gzip member may follow
+            inflateReset(&strm);
+        }
+        else if ((strm.data_type & 128) && !(strm.data_type & 64))
+        {
+            // end of the gzip header or of a block that is not the last one
+            pending->in_offset = in_total - strm.avail_in;
+            pending->in_bits = strm.data_type & 7;
+            pending->window_bytes = std::min<uint64_t>(out_total, CBPI_WINDOW_BYTES);
+            const size_t end = out_total % CBPI_WINDOW_BYTES;
+            uint8_t * dst = pending->window + CBPI_WINDOW_BYTES - pending->window_bytes;
+            if (pending->window_bytes == CBPI_WINDOW_BYTES)
+            {
+                memcpy(dst, window + end, CBPI_WINDOW_BYTES - end);
+                memcpy(dst + CBPI_WINDOW_BYTES - end, window, end);
+            }
+            else
+            {
+                memcpy(dst, window, pending->window_bytes);
+            }
+            pending_out = out_total;
+            has_pending = true;
+            promote_pending();
+        }
+        return true;
+    }
+
+public:
+    explicit gz_indexer_t(const char * path)
+        : in_buf(1 << 16)
+    {
+        memset(&strm, 0, sizeof(strm));
+        file = fopen(path, "rb");
+        if (!file || (inflateInit2(&strm, 15 + 16) != Z_OK))
+        {
+            printf("Cannot open %s.\n", path);
+            exit(1);
+        }
+        // up to the end of the gzip header, the first boundary
+        while (!has_last && inflate_once())
+        {
+        }
+    }
+
+    ~gz_indexer_t()
+    {
+        inflateEnd(&strm);
+        fclose(file);
+    }
+
+    void read(char * dst, size_t n)
+    {
+        while (n > 0)
+        {
+            if (consumed == out_total)
+            {
+                if (!inflate_once())
+                {
+                    at_eof = true;
+                    return;
+                }
+                continue;
+            }
+            const size_t pos = consumed % CBPI_WINDOW_BYTES;
+            const size_t chunk = std::min<uint64_t>({n, out_total - consumed, CBPI_WINDOW_BYTES - pos});
+            memcpy(dst, window + pos, chunk);
+            consumed += chunk;
+            dst += chunk;
+            n -= chunk;
+            promote_pending();
+        }
+    }
+
+    bool eof() const { return at_eof; }
+
+    // The access point of the next byte to be read.
+    const cbpi_point_t & point()
+    {
+        assert(has_last);
+        last->skip_bytes = consumed - last_out;
+        return *last;
+    }
+};
+
+// Writes the index of a .gz trace, with a point every interval instructions.
+static void write_trace_index(const char * in_path, uint64_t interval)
+{
+    const std::string out_path = trace_index_path(in_path);
+    gz_indexer_t input(in_path);
+    FILE * out = fopen(out_path.c_str(), "wb");
+    if (!out)
+    {
+        printf("Cannot create %s.\n", out_path.c_str());
+        exit(1);
+    }
+
+    struct stat st;
+    cbpi_header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CBPI_MAGIC, sizeof(CBPI_MAGIC));
+    header.version = CBPI_VERSION;
+    header.window_bytes = CBPI_WINDOW_BYTES;
+    header.trace_bytes = (stat(in_path, &st) == 0) ? st.st_size : 0;
+    header.interval = interval;
+    // Placeholder, rewritten once the number of records is known.
+    write_or_die(out, &header, sizeof(header), out_path.c_str());
+
+    TraceReader::Record record;
+    while (true)
+    {
+        if (header.num_records % interval == 0)
+        {
+            write_or_die(out, &input.point(), sizeof(cbpi_point_t), out_path.c_str());
+            header.num_points++;
+        }
+        if (!TraceReader::decodeRecord(input, record))
+            break;
+        header.num_records++;
+    }
+
+    fseek(out, 0, SEEK_SET);
+    write_or_die(out, &header, sizeof(header), out_path.c_str());
+    fclose(out);
+
+    printf("Indexed %lu instrs with %lu points, one every %lu instrs (%lu bytes): %s\n", header.num_records, header.num_points,
+           interval, sizeof(header) + header.num_points * sizeof(cbpi_point_t), out_path.c_str());
+}
+
+// Cracks the trace into pieces exactly like the timing simulator does and keeps the branches,
+// tagged with the seq_no/piece that uarchsim_t::step() would assign to them.
+static void write_branch_stream(const char * in_path, const char * out_path)
+{
+    gz::ogzstream out;
+    out.open(out_path, std::ios_base::out | std::ios_base::binary);
+    if (!out.good())
+    {
+        printf("Cannot create %s.\n", out_path);
+        exit(1);
+    }
+
+    cbpb_header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CBPB_MAGIC, sizeof(CBPB_MAGIC));
+    header.version = CBPB_VERSION;
+    out.write((const char *)&header, sizeof(header));
+
+    uint64_t num_uops = 0;
+    uint64_t num_insts = 0;
+    uint64_t num_branches = 0;
+    {
+        TraceReader reader(in_path);
+        db_t inst;
+        uint8_t piece = 0;
+        while (reader.get_inst(inst))
+        {
+            if (is_br(inst.insn_class))
+            {
+                cbpb_record_t rec;
+                memset(&rec, 0, sizeof(rec));
+                rec.seq_no = num_uops;
+                rec.inst_no = num_insts;
+                rec.pc = inst.pc;
+                rec.next_pc = inst.next_pc;
+                rec.piece = piece;
+                rec.insn_class = inst.insn_class;
+                rec.taken = inst.is_taken;
+                out.write((const char *)&rec, sizeof(rec));
+                num_branches++;
+            }
+            num_uops++;
+            num_insts += inst.is_last_piece;
+            piece = inst.is_last_piece ? 0 : (piece + 1);
+        }
+    }
+
+    cbpb_record_t end_rec;
+    memset(&end_rec, 0, sizeof(end_rec));
+    end_rec.insn_class = InstClass::undefInstClass;
+    end_rec.seq_no = num_uops;
+    end_rec.inst_no = num_insts;
+    out.write((const char *)&end_rec, sizeof(end_rec));
+    out.close();
+    if (!out.good())
+    {
+        printf("Write to %s failed.\n", out_path);
+        exit(1);
+    }
+
+    printf("Extracted %lu branches out of %lu instrs (%lu uops): %s\n", num_branches, num_insts, num_uops, out_path);
+}
+
+int main(int argc, char ** argv)
+{
+    bool branch_stream = false;
+    bool trace_index = false;
+    uint64_t index_interval = 1000000;
+    int zlib_level = -1;           // -1: store chunks uncompressed
+    uint64_t chunk_bytes = 4 << 20; // target uncompressed chunk size
+
+    int i = 1;
+    while (i < argc)
+    {
+        if (!strcmp(argv[i], "-b"))
+        {
+            branch_stream = true;
+            i++;
+        }
+        else if (!strcmp(argv[i], "-i"))
+        {
+            trace_index = true;
+            i++;
+        }
+        else if (!strcmp(argv[i], "-k") && (i + 1 < argc))
+        {
+            index_interval = strtoull(argv[i + 1], nullptr, 0);
+            i += 2;
+        }
+        else if (!strcmp(argv[i], "-z") && (i + 1 < argc))
+        {
+            zlib_level = atoi(argv[i + 1]);
+            i += 2;
+        }
+        else if (!strcmp(argv[i], "-c") && (i + 1 < argc))
+        {
+            chunk_bytes = strtoull(argv[i + 1], nullptr, 0) << 10;
+            i += 2;
+        }
+        else
+        {
+            break;
+        }
+    }
+
+    if ((i + (trace_index ? 1 : 2) != argc) || (zlib_level > 9) || (chunk_bytes == 0) || (index_interval == 0))
+    {
+        printf("usage:\t%s\n"
+               "\t[optional: -b to write the branch-only stream (.cbpb) of a .gz or .cbpt trace instead]\n"
+               "\t[optional: -i to write the seek index (<trace>.cbpi) of a .gz trace instead, without output file]\n"
+               "\t[optional: -k <num_instructions> between two points of the seek index (default: 1000000)]\n"
+               "\t[optional: -z <zlib_level 0-9> to zlib-compress each chunk (default: uncompressed chunks)]\n"
+               "\t[optional: -c <chunk_size_kb> target uncompressed chunk size (default: 4096)]\n"
+               "\t[REQUIRED: input .gz trace file (or .cbpt with -b)]\n"
+               "\t[REQUIRED: output .cbpt (or .cbpb with -b) trace file]\n", argv[0]);
+        exit(0);
+    }
+    const char * in_path = argv[i];
+    if (trace_index)
+    {
+        write_trace_index(in_path, index_interval);
+        return 0;
+    }
+    const char * out_path = argv[i + 1];
+
+    if (branch_stream)
+    {
+        write_branch_stream(in_path, out_path);
+        return 0;
+    }
+
+    gz::igzstream input;
+    input.open(in_path, std::ios_base::in | std::ios_base::binary);
+    if (!input.good())
+    {
+        printf("Cannot open %s.\n", in_path);
+        exit(1);
+    }
+
+    FILE * out = fopen(out_path, "wb");
+    if (!out)
+    {
+        printf("Cannot create %s.\n", out_path);
+        exit(1);
+    }
+
+    cbpt_header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CBPT_MAGIC, sizeof(CBPT_MAGIC));
+    header.version = CBPT_VERSION;
+    header.codec = (zlib_level >= 0) ? cbpt_codec_t::zlib : cbpt_codec_t::none;
+    // Placeholder, rewritten once the chunk index is known.
+    write_or_die(out, &header, sizeof(header), out_path);
+
+    std::vector<cbpt_chunk_t> index;
+    std::vector<uint8_t> raw;
+    std::vector<uint8_t> record_bytes;
+    std::vector<uint8_t> packed;
+    uint64_t offset = sizeof(header);
+    uint64_t chunk_first_record = 0;
+
+    auto flush_chunk = [&]() {
+        if (raw.empty())
+            return;
+        cbpt_chunk_t chunk;
+        chunk.offset = offset;
+        chunk.raw_bytes = raw.size();
+        chunk.first_record = chunk_first_record;
+        if (header.codec == cbpt_codec_t::zlib)
+        {
+            uLongf packed_bytes = compressBound(raw.size());
+            packed.resize(packed_bytes);
+            if (compress2(packed.data(), &packed_bytes, raw.data(), raw.size(), zlib_level) != Z_OK)
+            {
+                printf("zlib compression failed.\n");
+                exit(1);
+            }
+            chunk.stored_bytes = packed_bytes;
+            write_or_die(out, packed.data(), packed_bytes, out_path);
+        }
+        else
+        {
+            chunk.stored_bytes = raw.size();
+            write_or_die(out, raw.data(), raw.size(), out_path);
+        }
+        offset += chunk.stored_bytes;
+        header.max_chunk_bytes = std::max(header.max_chunk_bytes, chunk.raw_bytes);
+        index.push_back(chunk);
+        raw.clear();
+    };
+
+    TraceReader::Record record;
+    while (true)
+    {
+        record_bytes.clear();
+        tee_input_t tee{input, record_bytes};
+        if (!TraceReader::decodeRecord(tee, record))
+            break;
+
+        if (raw.empty())
+            chunk_first_record = header.num_records;
+        raw.insert(raw.end(), record_bytes.begin(), record_bytes.end());
+        header.num_records++;
+
+        if (raw.size() >= chunk_bytes)
+            flush_chunk();
+    }
+    flush_chunk();
+
+    // Keep the index 8-byte aligned so that it can be used in place from the mapping.
+    static const uint8_t zeros[8] = {};
+    const uint64_t pad = (8 - (offset % 8)) % 8;
+    write_or_die(out, zeros, pad, out_path);
+    offset += pad;
+
+    header.num_chunks = index.size();
+    header.index_offset = offset;
+    write_or_die(out, index.data(), index.size() * sizeof(cbpt_chunk_t), out_path);
+    fseek(out, 0, SEEK_SET);
+    write_or_die(out, &header, sizeof(header), out_path);
+    fclose(out);
+
+    printf("Converted %lu instrs into %lu %s chunks (%lu bytes): %s\n", header.num_records, header.num_chunks,
+           (header.codec == cbpt_codec_t::zlib) ? "zlib" : "uncompressed", offset + index.size() * sizeof(cbpt_chunk_t), out_path);
+    return 0;
+}
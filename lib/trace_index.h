@@ -0,0 +1,293 @@
+#pragma once
+
+// Seek index of a CBP .gz trace (.cbpi side-car file), after zran.c of the zlib distribution.
+//
+// A deflate stream can only be inflated from its start, unless the inflater is handed the state
+// it had at a block boundary: the bit position in the compressed stream and the last 32 KB of
+// uncompressed data, which back-references may reach. trace_convert -i inflates a trace once and
+// saves such an access point every interval instructions:
+//
+//   cbpi_header_t                          - fixed size, at offset 0
+//   cbpi_point_t[num_points]               - point j for trace instruction j * interval
+//
+// Each point is taken at the last block boundary before the record of its instruction, and tells
+// how many uncompressed bytes lie between the two. gz_index_input_t resumes inflating at a point
+// and offers the read()/eof() subset of std::istream that TraceReader::decodeRecord() relies on.
+// The index of <trace> is <trace>.cbpi, and is matched to its trace by the trace size.
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+#include <zlib.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static constexpr char CBPI_MAGIC[8] = {'C', 'B', 'P', 'I', 'N', 'D', 'E', 'X'};
+static constexpr uint32_t CBPI_VERSION = 1;
+static constexpr uint32_t CBPI_WINDOW_BYTES = 32768;    // deflate window
+
+struct cbpi_header_t
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t window_bytes;    // CBPI_WINDOW_BYTES
+    uint64_t trace_bytes;     // size of the .gz trace
+    uint64_t num_records;     // trace instructions in the trace
+    uint64_t interval;        // trace instructions between two points
+    uint64_t num_points;
+};
+
+struct cbpi_point_t
+{
+    uint64_t in_offset;       // offset in the .gz file of the first whole byte of the block
+    uint64_t skip_bytes;      // uncompressed bytes from the block start to the record
+    uint32_t in_bits;         // bits of the byte before in_offset that belong to the block (0-7)
+    uint32_t window_bytes;    // bytes inflated before the block, up to CBPI_WINDOW_BYTES
+    uint8_t window[CBPI_WINDOW_BYTES];   // the last window_bytes of them, at the end
+};
+
+inline std::string trace_index_path(const char * trace_path)
+{
+    return std::string(trace_path) + ".cbpi";
+}
+
+// The index of a trace, mapped in memory. Exits with an error message if the index is not one
+// of this trace.
+class cbpi_index_t
+{
+    const uint8_t * map = nullptr;
+    size_t map_size = 0;
+    const cbpi_header_t * header = nullptr;
+
+    const cbpi_point_t * points() const { return (const cbpi_point_t *)(map + sizeof(cbpi_header_t)); }
+
+    // gz_index_input_t resumes at a point as is: its bits and window must fit what it restores.
+    bool valid_points() const
+    {
+        for (uint64_t j = 0; j < header->num_points; j++)
+        {
+            const cbpi_point_t & point = points()[j];
+            if ((point.window_bytes > CBPI_WINDOW_BYTES) || (point.in_bits > 7) ||
+                (point.in_offset > header->trace_bytes) || ((point.in_bits > 0) && (point.in_offset == 0)))
+                return false;
+        }
+        return true;
+    }
+
+public:
+    cbpi_index_t(const char * index_path, const char * trace_path)
+    {
+        const int fd = open(index_path, O_RDONLY);
+        struct stat st, trace_st;
+        if ((fd < 0) || (fstat(fd, &st) != 0) || ((size_t)st.st_size < sizeof(cbpi_header_t)))
+        {
+            printf("Cannot open trace index %s.\n", index_path);
+            exit(1);
+        }
+        map_size = st.st_size;
+        void * addr = mmap(nullptr, map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (addr == MAP_FAILED)
+        {
+            printf("Cannot mmap trace index %s.\n", index_path);
+            exit(1);
+        }
+        map = (const uint8_t *)addr;
+
+        header = (const cbpi_header_t *)map;
+        if (memcmp(header->magic, CBPI_MAGIC, sizeof(CBPI_MAGIC)) || (header->version != CBPI_VERSION) ||
+            (header->window_bytes != CBPI_WINDOW_BYTES) || (header->interval == 0) ||
+            (header->num_points > (map_size - sizeof(cbpi_header_t)) / sizeof(cbpi_point_t)) || !valid_points())
+        {
+            printf("%s is not a valid version %u trace index.\n", index_path, CBPI_VERSION);
+            exit(1);
+        }
+        if ((stat(trace_path, &trace_st) != 0) || ((uint64_t)trace_st.st_size != header->trace_bytes))
+        {
+            printf("%s is not the index of %s: rebuild it with trace_convert -i.\n", index_path, trace_path);
+            exit(1);
+        }
+    }
+
+    ~cbpi_index_t()
+    {
+        if (map)
+            munmap((void *)map, map_size);
+    }
+
+    cbpi_index_t(const cbpi_index_t &) = delete;
+    cbpi_index_t & operator=(const cbpi_index_t &) = delete;
+
+    // Returns the index of trace_path if there is one, nullptr otherwise.
+    static std::unique_ptr<cbpi_index_t> find(const char * trace_path)
+    {
+        const std::string index_path = trace_index_path(trace_path);
+        if (access(index_path.c_str(), F_OK) != 0)
+            return nullptr;
+        return std::make_unique<cbpi_index_t>(index_path.c_str(), trace_path);
+    }
+
+    uint64_t num_records() const { return header->num_records; }
+
+    // The last point at or before trace instruction instr, and the instruction it is for.
+    const cbpi_point_t & point_before(uint64_t instr, uint64_t & point_instr) const
+    {
+        const uint64_t j = std::min(instr / header->interval, header->num_points - 1);
+        point_instr = j * header->interval;
+        return points()[j];
+    }
+
+    bool empty() const { return header->num_points == 0; }
+};
+
+// Read side of a .gz trace from an access point of its index on.
+class gz_index_input_t
+{
+    static const size_t IN_BYTES = 1 << 16;
+    static const size_t OUT_BYTES = 1 << 16;
+
+    FILE * file = nullptr;
+    z_stream strm;
+    std::vector<uint8_t> in_buf;
+    std::vector<uint8_t> out_buf;
+    const uint8_t * cur = nullptr;     // inflated bytes not consumed yet
+    const uint8_t * end = nullptr;
+    bool raw_mode = true;              // until the end of the gzip member of the point
+    uint64_t trailer_bytes = 0;        // of that member, still to skip
+    bool at_end = false;               // no more input to inflate
+    bool at_eof = false;
+
+    bool fill_input()
+    {
+        if (strm.avail_in == 0)
+        {
+            strm.avail_in = fread(in_buf.data(), 1, IN_BYTES, file);
+            strm.next_in = in_buf.data();
+        }
+        return strm.avail_in > 0;
+    }
+
+    [[noreturn]] void fail(int ret)
+    {
+        printf("Corrupted .gz trace (zlib error %d).\n", ret);
+        exit(1);
+    }
+
+    // Inflates the next bytes into out_buf. Returns false at the end of the trace.
+    bool inflate_more()
+    {
+        while (!at_end)
+        {
+            // A point resumes in raw mode, without the gzip header and trailer: after the end of
+            // the deflate data of a member, the trailer is skipped and the next member (if any) parsed.
+            while (trailer_bytes > 0)
+            {
+                if (!fill_input())
+                    fail(Z_DATA_ERROR);
+                const uint64_t n = std::min<uint64_t>(trailer_bytes, strm.avail_in);
+                strm.next_in += n;
+                strm.avail_in -= n;
+                trailer_bytes -= n;
+                if ((trailer_bytes == 0) && (inflateReset2(&strm, 15 + 16) != Z_OK))
+                    fail(Z_STREAM_ERROR);
+            }
+            if (!fill_input())
+            {
+                at_end = true;
+                break;
+            }
+            strm.next_out = out_buf.data();
+            strm.avail_out = OUT_BYTES;
+            const int ret = inflate(&strm, Z_NO_FLUSH);
+            if ((ret != Z_OK) && (ret != Z_STREAM_END) && (ret != Z_BUF_ERROR))
+                fail(ret);
+            if ((ret == Z_STREAM_END) && raw_mode)
+            {
+                raw_mode = false;
+                trailer_bytes = 8;
+            }
+            else if ((ret == Z_STREAM_END) && (inflateReset(&strm) != Z_OK))
+            {
+                fail(Z_STREAM_ERROR);
+            }
+            if (strm.avail_out < OUT_BYTES)
+            {
+                cur = out_buf.data();
+                end = out_buf.data() + (OUT_BYTES - strm.avail_out);
+                return true;
+            }
+        }
+        return false;
+    }
+
+public:
+    // Opens trace_path at the record following point.
+    gz_index_input_t(const char * trace_path, const cbpi_point_t & point)
+        : in_buf(IN_BYTES), out_buf(OUT_BYTES)
+    {
+        memset(&strm, 0, sizeof(strm));
+        file = fopen(trace_path, "rb");
+        if (!file || (inflateInit2(&strm, -15) != Z_OK))
+        {
+            printf("Cannot open .gz trace %s.\n", trace_path);
+            exit(1);
+        }
+        if (fseek(file, point.in_offset - (point.in_bits ? 1 : 0), SEEK_SET) != 0)
+            fail(Z_DATA_ERROR);
+        if (point.in_bits)
+        {
+            const int byte = getc(file);
+            if ((byte == EOF) || (inflatePrime(&strm, point.in_bits, byte >> (8 - point.in_bits)) != Z_OK))
+                fail(Z_DATA_ERROR);
+        }
+        if (point.window_bytes &&
+            (inflateSetDictionary(&strm, point.window + CBPI_WINDOW_BYTES - point.window_bytes, point.window_bytes) != Z_OK))
+            fail(Z_DATA_ERROR);
+
+        uint64_t skip = point.skip_bytes;
+        while (skip > 0)
+        {
+            if ((cur == end) && !inflate_more())
+                fail(Z_DATA_ERROR);
+            const uint64_t n = std::min<uint64_t>(skip, end - cur);
+            cur += n;
+            skip -= n;
+        }
+    }
+
+    ~gz_index_input_t()
+    {
+        inflateEnd(&strm);
+        if (file)
+            fclose(file);
+    }
+
+    gz_index_input_t(const gz_index_input_t &) = delete;
+    gz_index_input_t & operator=(const gz_index_input_t &) = delete;
+
+    void read(char * dst, size_t n)
+    {
+        while (n > 0)
+        {
+            if ((cur == end) && !inflate_more())
+            {
+                at_eof = true;
+                return;
+            }
+            const size_t chunk = std::min<size_t>(n, end - cur);
+            memcpy(dst, cur, chunk);
+            cur += chunk;
+            dst += chunk;
+            n -= chunk;
+        }
+    }
+
+    bool eof() const { return at_eof; }
+};
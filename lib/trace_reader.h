@@ -36,7 +36,7 @@
 //
 // Usage : TraceReader reader("./my_trace.tar.gz")
 //         while(reader.readInstr())
-//           reader.mInstr.printInstr();
+//           reader.mRecord.mInstr.printInstr();
 //            ...
 // Note that this is an exemple file (that was used for CVP).
 // Given the trace format below, you can write your own trace reader that
@@ -67,11 +67,19 @@
 // SIMD registers are encoded 32-63
 
 #include <fstream>
+#include <string>
 #include <algorithm>
 #include <iostream>
 #include <vector>
 #include <cassert>
+#include <atomic>
+#include <memory>
+#include <thread>
 #include "sim_common_structs.h"
+#include "static_vec.h"
+#include "spsc_ring.h"
+#include "trace_container.h"
+#include "trace_index.h"
 #include "./gzstream.h"
 
 // This structure is used by CBP's simulator.
@@ -181,6 +189,12 @@ inline bool reg_is_int(uint8_t reg_offset)
 // Other instructions subject to this are (list not exhaustive): load pair and vector inststructions.
 struct TraceReader
 {
+    // Upper bounds on the register operands of a trace instruction (e.g., st4/ld4 with base update and register offset).
+    // SIMD outputs carry two 64-bit values each.
+    static constexpr std::size_t MAX_IN_REGS = 16;
+    static constexpr std::size_t MAX_OUT_REGS = 16;
+    static constexpr std::size_t MAX_OUT_VALUES = 2 * MAX_OUT_REGS;
+
     struct Instr
     {
         uint64_t mPc;
@@ -192,11 +206,11 @@ struct TraceReader
         uint8_t mBaseUpd;
         uint8_t mHasRegOffset;
         uint8_t mNumInRegs;
-        std::vector<uint8_t> mInRegs;
+        static_vec_t<uint8_t, MAX_IN_REGS> mInRegs;
         uint8_t mNumOutRegs;
-        std::vector<uint8_t> mOutRegs;
+        static_vec_t<uint8_t, MAX_OUT_REGS> mOutRegs;
         std::optional<uint8_t> mBaseUpdReg;
-        std::vector<uint64_t> mOutRegsValues;
+        static_vec_t<uint64_t, MAX_OUT_VALUES> mOutRegsValues;
 
         Instr()
         {
@@ -283,7 +297,7 @@ struct TraceReader
                 dst_reg_ids.erase(dst_it, dst_reg_ids.end());
             }
 
-            std::vector<uint8_t> overlap_vec;
+            static_vec_t<uint8_t, MAX_OUT_REGS> overlap_vec;
             std::set_intersection(src_reg_ids.begin(), src_reg_ids.end(), dst_reg_ids.begin(), dst_reg_ids.end(), std::back_inserter(overlap_vec));
 
             if(overlap_vec.size() > 1)
@@ -359,15 +373,36 @@ struct TraceReader
         }
     };
 
+    // A decoded trace instruction along with the piece bookkeeping derived from it.
+    // This is the unit handed from the producer thread to the simulation thread when --reader-threads is used.
+    struct Record
+    {
+        // Buffer to hold trace instruction information
+        Instr mInstr;
+
+        // Expected total pieces of an instr
+        uint8_t mTotalPieces = 0;
+        // Expected MemPieces
+        uint8_t mMemPieces = 0;
+        // Inverse of memory size multiplier for each piece. E.g., a 128-bit access will have size 16, and each piece will have size 8 (16 * 1/2).
+        uint8_t mSizeFactor = 0;
+    };
+
+    // Number of decoded records buffered between the producer thread and the simulation thread.
+    static constexpr uint64_t RECORD_RING_SIZE = 4096;
+
+    // Exactly one of these is open: gzip stream for .gz traces, mmap'd container for .cbpt traces (see trace_container.h).
     gz::igzstream * dpressed_input;
+    std::unique_ptr<cbpt_input_t> container_input;
+    // A .gz trace read from a point of its index (see trace_index.h) after seek_to_instr(), instead of dpressed_input.
+    std::unique_ptr<gz_index_input_t> indexed_input;
+    std::unique_ptr<cbpi_index_t> gz_index;
+    bool gz_index_looked_up = false;
+    const std::string trace_name;
 
-    // Buffer to hold trace instruction information
-    Instr mInstr;
+    // Trace instruction currently being cracked into pieces
+    Record mRecord;
 
-    // Expected total pieces of an instr
-    uint8_t mTotalPieces;
-    // Expected MemPieces
-    uint8_t mMemPieces;
     // Pieces processed so far 
     uint8_t mProcessedPieces;
 
@@ -381,11 +416,9 @@ struct TraceReader
     uint8_t mCrackRegIdx;
     uint8_t mCrackValIdx;
 
-    // Inverse of memory size multiplier for each piece. E.g., a 128-bit access will have size 16, and each piece will have size 8 (16 * 1/2).
-    uint8_t mSizeFactor;
-
     // Number of instructions processed so far.
     uint64_t nInstr;
+    const bool verbose;
 
     // This simply tracks how many lanes one SIMD register have been processed.
     // In this case, since SIMD is 128 bits and pieces output 64 bits, if it is pair and we are creating an instruction object from a trace instruction, this means that
@@ -393,92 +426,205 @@ struct TraceReader
     // If it is odd, it means that it will contain the high order bits of the SIMD register.
     uint8_t start_fp_reg;
 
+    // Asynchronous decoding: a producer thread inflates and decodes records into records_ring,
+    // get_inst() only cracks pre-decoded records into pieces.
+    std::unique_ptr<spsc_ring_t<Record>> records_ring;
+    std::thread producer;
+    std::atomic<bool> producer_done{false};
+    std::atomic<bool> stop_producer{false};
+
+    // Number of records for which the simulation thread found the ring empty and had to wait.
+    uint64_t nConsumerStalls;
+    // Number of records for which the producer thread found the ring full and had to wait.
+    std::atomic<uint64_t> nProducerStalls{0};
+
     // Note that there is no check for trace existence, so modify to suit your needs.
-    TraceReader(const char * trace_name)
+    // reader_threads = 0 decodes on the calling thread, reader_threads = 1 decodes on a separate producer thread.
+    // verbose = false drops the progress/EOF messages (batch mode runs several readers at once).
+    TraceReader(const char * trace_name, uint64_t reader_threads = 0, bool verbose = true)
+        : trace_name(trace_name), verbose(verbose)
     {
-        dpressed_input = new gz::igzstream();
-        dpressed_input->open(trace_name, std::ios_base::in | std::ios_base::binary);
+        dpressed_input = nullptr;
+        if(is_cbpt_file(trace_name))
+        {
+            container_input = std::make_unique<cbpt_input_t>(trace_name);
+        }
+        else
+        {
+            openGzTrace();
+        }
 
-        mTotalPieces = 0;
-        mMemPieces = 0;
         mCrackRegIdx = 0;
         mCrackValIdx = 0;
         mProcessedPieces = 0;
-        mSizeFactor = 0;
         nInstr = 0;
         start_fp_reg = 0;
+        nConsumerStalls = 0;
+
+        assert(reader_threads <= 1);
+        if(reader_threads)
+        {
+            records_ring = std::make_unique<spsc_ring_t<Record>>(RECORD_RING_SIZE);
+            producer = std::thread(&TraceReader::produceRecords, this);
+        }
     }
 
     ~TraceReader()
     {
+        if(producer.joinable())
+        {
+            stop_producer.store(true, std::memory_order_relaxed);
+            producer.join();
+        }
+
         if(dpressed_input)
             delete dpressed_input;
 
-        std::cout  << " Read " << nInstr << " instrs " << std::endl;
+        if(verbose)
+            std::cout  << " Read " << nInstr << " instrs " << std::endl;
     }
 
     // This is the main API function
     // There is no specific reason to call the other functions from without this file.
-    // Idiom is : while(instr = get_inst())
-    //              ... process instr
-    db_t  *get_inst()
+    // Fills the caller-owned inst with the next piece and returns false when the trace is done.
+    // Idiom is : db_t inst;
+    //            while(reader.get_inst(inst))
+    //              ... process inst
+    // No heap allocation takes place, so the same object can be reused for every piece.
+    bool get_inst(db_t& inst)
     {
         // If we are creating several pieces from a single trace instructions and some are left to create,
-        // mProcessedPieces != mTotalPieces
-        if(mProcessedPieces != mTotalPieces)
+        // mProcessedPieces != mRecord.mTotalPieces
+        if(mProcessedPieces != mRecord.mTotalPieces)
         {
             //std::cout<<"Continuing with the same MacroOP"<<std::endl;
-            return populateNewInstr();
+            populateNewInstr(inst);
+            return true;
         }
         // If there is a single piece to create
         else if(readInstr())
         {
             //std::cout<<"Read New MacroOp"<<std::endl;
-            return populateNewInstr();
+            populateNewInstr(inst);
+            return true;
         }
         else
         {
             // If the trace is done
             //std::cout<<"End of sim"<<std::endl;
-            return nullptr;
+            return false;
+        }
+    }
+
+    // Skips the next n trace instructions (e.g. those simulated before a snapshot, see cbp --restore).
+    // Must be called between instructions. Returns the number skipped, less than n if the trace ends first.
+    uint64_t skip_instrs(uint64_t n)
+    {
+        assert(mProcessedPieces == mRecord.mTotalPieces);
+        uint64_t skipped = 0;
+        while((skipped < n) && readInstr())
+            skipped++;
+        mProcessedPieces = mRecord.mTotalPieces;
+        return skipped;
+    }
+
+    // Moves to trace instruction n (counting from 0): get_inst() returns its first piece next, and
+    // the pieces left of the current instruction are dropped. A .cbpt trace jumps to the chunk
+    // holding the instruction, a .gz trace to the last point of its index (<trace>.cbpi, see
+    // trace_index.h) before it, or back to its start without an index; the records from there on
+    // are decoded up to the instruction. With a producer thread (reader_threads = 1), which owns
+    // the input, the records are only decoded forward.
+    // Returns false if the trace has fewer than n instructions, or if n is behind with a producer thread.
+    bool seek_to_instr(uint64_t n)
+    {
+        // the next get_inst() reads a new record, and starts cracking it over
+        mProcessedPieces = mRecord.mTotalPieces;
+
+        if(records_ring)
+        {
+            if(n < nInstr)
+                return false;
+        }
+        else if(container_input)
+        {
+            nInstr = container_input->seek_chunk(n);
+        }
+        else
+        {
+            if(!gz_index_looked_up)
+            {
+                gz_index = cbpi_index_t::find(trace_name.c_str());
+                gz_index_looked_up = true;
+            }
+            uint64_t point_instr = 0;
+            const cbpi_point_t * point = (gz_index && !gz_index->empty()) ? &gz_index->point_before(n, point_instr) : nullptr;
+            if(point && ((point_instr > nInstr) || (n < nInstr)))
+            {
+                indexed_input = std::make_unique<gz_index_input_t>(trace_name.c_str(), *point);
+                nInstr = point_instr;
+            }
+            else if(n < nInstr)
+            {
+                indexed_input.reset();
+                openGzTrace();
+                nInstr = 0;
+            }
         }
+        const uint64_t to_skip = n - nInstr;
+        return skip_instrs(to_skip) == to_skip;
+    }
 
+    // Allocating variant kept for existing users.
+    // Idiom is : while(instr = get_inst())
+    //              ... process instr
+    //              delete instr
+    db_t  *get_inst()
+    {
+        db_t * inst = new db_t();
+        if(get_inst(*inst))
+        {
+            return inst;
+        }
+        delete inst;
+        return nullptr;
     }
 
-    // Creates a new object and populate it with trace information.
+    // Populates inst with trace information.
     // Subsequent calls to populateNewInstr() will take care of creating multiple pieces for a trace instruction
     // that has several outputs or 128-bit output.
     // Number of calls is decided by mProcessedPieces from get_inst().
-    db_t *populateNewInstr()
+    void populateNewInstr(db_t& inst_ref)
     {
-        db_t * inst = new db_t();
+        // Start from a clean object so that reusing inst_ref across calls is indistinguishable from a fresh one.
+        inst_ref = db_t();
+        db_t * inst = &inst_ref;
 
-        //std::cout<<"Processing piece:"<<(uint64_t)(1+mProcessedPieces)<<" from:"<<(uint64_t)mTotalPieces<<std::endl;
-        assert(mProcessedPieces < mTotalPieces);
-        assert(mMemPieces <= mTotalPieces);
+        //std::cout<<"Processing piece:"<<(uint64_t)(1+mProcessedPieces)<<" from:"<<(uint64_t)mRecord.mTotalPieces<<std::endl;
+        assert(mProcessedPieces < mRecord.mTotalPieces);
+        assert(mRecord.mMemPieces <= mRecord.mTotalPieces);
 
-        const bool is_macro_op_mem = is_mem(mInstr.mType);
+        const bool is_macro_op_mem = is_mem(mRecord.mInstr.mType);
         if(is_macro_op_mem)
         {
-            assert(mMemPieces >=1);
+            assert(mRecord.mMemPieces >=1);
         }
         else
         {
-            assert(mMemPieces ==0);
+            assert(mRecord.mMemPieces ==0);
         }
 
         //                                
-        const bool create_base_update_op = is_macro_op_mem && (mProcessedPieces>=1) && (mMemPieces == mProcessedPieces) && (mMemPieces == (mTotalPieces -1));
+        const bool create_base_update_op = is_macro_op_mem && (mProcessedPieces>=1) && (mRecord.mMemPieces == mProcessedPieces) && (mRecord.mMemPieces == (mRecord.mTotalPieces -1));
         // verify only 1 piece remaining
         if(create_base_update_op)
         {
-            assert((1 + mMemPieces) == mTotalPieces && "Only 1 create_base_update_op piece expected");
-            assert((1 + mProcessedPieces) == mTotalPieces && "Base-update piece expected to be the last one");
+            assert((1 + mRecord.mMemPieces) == mRecord.mTotalPieces && "Only 1 create_base_update_op piece expected");
+            assert((1 + mProcessedPieces) == mRecord.mTotalPieces && "Base-update piece expected to be the last one");
         }
 
-        inst->insn_class = create_base_update_op ? InstClass::aluInstClass : mInstr.mType;
-        inst->pc = mInstr.mPc;
-        inst->is_taken = mInstr.mTaken;
+        inst->insn_class = create_base_update_op ? InstClass::aluInstClass : mRecord.mInstr.mType;
+        inst->pc = mRecord.mInstr.mPc;
+        inst->is_taken = mRecord.mInstr.mTaken;
         if(is_uncond_br(inst->insn_class))
         {
             assert(inst->is_taken);
@@ -488,10 +634,10 @@ struct TraceReader
             assert(!inst->is_taken);
         }
 
-        inst->next_pc = mInstr.mNextPc;
+        inst->next_pc = mRecord.mInstr.mNextPc;
       
-        const bool base_update_reg_present = mInstr.mBaseUpdReg.has_value();;
-        const uint8_t base_upd_reg = mInstr.mBaseUpdReg.value_or(UINT8_MAX);
+        const bool base_update_reg_present = mRecord.mInstr.mBaseUpdReg.has_value();;
+        const uint8_t base_upd_reg = mRecord.mInstr.mBaseUpdReg.value_or(UINT8_MAX);
 
         // Process all the inputs for this uop
         uint8_t inp_reg_processed_this_instr = 0;
@@ -509,36 +655,36 @@ struct TraceReader
             inst->B.valid = false;
             inst->C.valid = false;
         }
-        else if(is_store(mInstr.mType))
+        else if(is_store(mRecord.mInstr.mType))
         {
             const uint8_t max_str_val_regs_per_instr = 1;
             // str addr reg
             {
                 inp_reg_processed_this_instr++;
                 inst->A.valid = true;
-                inst->A.is_int = reg_is_int(mInstr.mInRegs.at(0));
-                inst->A.log_reg = mInstr.mInRegs[0];
+                inst->A.is_int = reg_is_int(mRecord.mInstr.mInRegs.at(0));
+                inst->A.log_reg = mRecord.mInstr.mInRegs[0];
                 inst->A.value = 0xdeadbeef;
             }
 
-            const uint8_t str_value_reg_offset = 1 + mInstr.mHasRegOffset + mProcessedPieces*max_str_val_regs_per_instr;
-            if(mInstr.mHasRegOffset)
+            const uint8_t str_value_reg_offset = 1 + mRecord.mInstr.mHasRegOffset + mProcessedPieces*max_str_val_regs_per_instr;
+            if(mRecord.mInstr.mHasRegOffset)
             {
-                assert(mInstr.mNumInRegs >= 2);
+                assert(mRecord.mInstr.mNumInRegs >= 2);
                 // str offset
                 inp_reg_processed_this_instr++;
                 inst->B.valid = true;
-                inst->B.is_int = reg_is_int(mInstr.mInRegs.at(1));
-                inst->B.log_reg = mInstr.mInRegs[1];
+                inst->B.is_int = reg_is_int(mRecord.mInstr.mInRegs.at(1));
+                inst->B.log_reg = mRecord.mInstr.mInRegs[1];
                 inst->B.value = 0xdeadbeef;
 
                 // str value
-                if( str_value_reg_offset < mInstr.mNumInRegs )
+                if( str_value_reg_offset < mRecord.mInstr.mNumInRegs )
                 {
                     inp_reg_processed_this_instr++;
                     inst->C.valid = true;
-                    inst->C.is_int = reg_is_int(mInstr.mInRegs.at(str_value_reg_offset));
-                    inst->C.log_reg = mInstr.mInRegs[str_value_reg_offset];
+                    inst->C.is_int = reg_is_int(mRecord.mInstr.mInRegs.at(str_value_reg_offset));
+                    inst->C.log_reg = mRecord.mInstr.mInRegs[str_value_reg_offset];
                     inst->C.value = 0xdeadbeef;
                 }
                 else
@@ -548,14 +694,14 @@ struct TraceReader
             }
             else
             {
-                assert(mInstr.mNumInRegs >= 1);
-                if( str_value_reg_offset < mInstr.mNumInRegs )
+                assert(mRecord.mInstr.mNumInRegs >= 1);
+                if( str_value_reg_offset < mRecord.mInstr.mNumInRegs )
                 {
                     // str value
                     inp_reg_processed_this_instr++;
                     inst->B.valid = true;
-                    inst->B.is_int = reg_is_int(mInstr.mInRegs.at(str_value_reg_offset));
-                    inst->B.log_reg = mInstr.mInRegs[str_value_reg_offset];
+                    inst->B.is_int = reg_is_int(mRecord.mInstr.mInRegs.at(str_value_reg_offset));
+                    inst->B.log_reg = mRecord.mInstr.mInRegs[str_value_reg_offset];
                     inst->B.value = 0xdeadbeef;
 
                     inst->C.valid = false;
@@ -569,34 +715,34 @@ struct TraceReader
         }
         else
         {
-            if(mInstr.mNumInRegs >= 1)
+            if(mRecord.mInstr.mNumInRegs >= 1)
             {
                 inp_reg_processed_this_instr++;
                 inst->A.valid = true;
-                inst->A.is_int = reg_is_int(mInstr.mInRegs.at(0));
-                inst->A.log_reg = mInstr.mInRegs[0];
+                inst->A.is_int = reg_is_int(mRecord.mInstr.mInRegs.at(0));
+                inst->A.log_reg = mRecord.mInstr.mInRegs[0];
                 inst->A.value = 0xdeadbeef;
             }
             else
                 inst->A.valid = false;
 
-            if(mInstr.mNumInRegs >= 2)
+            if(mRecord.mInstr.mNumInRegs >= 2)
             {
                 inp_reg_processed_this_instr++;
                 inst->B.valid = true;
-                inst->B.is_int = reg_is_int(mInstr.mInRegs.at(1));
-                inst->B.log_reg = mInstr.mInRegs[1];
+                inst->B.is_int = reg_is_int(mRecord.mInstr.mInRegs.at(1));
+                inst->B.log_reg = mRecord.mInstr.mInRegs[1];
                 inst->B.value = 0xdeadbeef;
             }
             else
                 inst->B.valid = false;
 
-            if(mInstr.mNumInRegs >= 3)
+            if(mRecord.mInstr.mNumInRegs >= 3)
             {
                 inp_reg_processed_this_instr++;
                 inst->C.valid = true;
-                inst->C.is_int = reg_is_int(mInstr.mInRegs.at(2));
-                inst->C.log_reg = mInstr.mInRegs[2];
+                inst->C.is_int = reg_is_int(mRecord.mInstr.mInRegs.at(2));
+                inst->C.log_reg = mRecord.mInstr.mInRegs[2];
                 inst->C.value = 0xdeadbeef;
             }
             else
@@ -608,20 +754,20 @@ struct TraceReader
         if(create_base_update_op)   // store output handled here
         {
             assert(base_update_reg_present);
-            assert(base_upd_reg == *mInstr.mOutRegs.rbegin());
+            assert(base_upd_reg == *mRecord.mInstr.mOutRegs.rbegin());
             inst->D.valid = true;
             inst->D.is_int = reg_is_int(base_upd_reg);
             assert(inst->D.is_int);
             inst->D.log_reg = base_upd_reg;
-            inst->D.value = *mInstr.mOutRegsValues.rbegin();
+            inst->D.value = *mRecord.mInstr.mOutRegsValues.rbegin();
         }
-        else if(!is_store(mInstr.mType) && mInstr.mNumOutRegs >= 1)
+        else if(!is_store(mRecord.mInstr.mType) && mRecord.mInstr.mNumOutRegs >= 1)
         {
             inst->D.valid = true;
             // Flag register is considered to be INT
-            inst->D.is_int = reg_is_int(mInstr.mOutRegs.at(mCrackRegIdx));
-            inst->D.log_reg = mInstr.mOutRegs[mCrackRegIdx];
-            inst->D.value = mInstr.mOutRegsValues.at(mCrackValIdx);
+            inst->D.is_int = reg_is_int(mRecord.mInstr.mOutRegs.at(mCrackRegIdx));
+            inst->D.log_reg = mRecord.mInstr.mOutRegs[mCrackRegIdx];
+            inst->D.value = mRecord.mInstr.mOutRegsValues.at(mCrackValIdx);
             // if SIMD register, we processed one more 64-bit lane.
             if(!inst->D.is_int)
                 start_fp_reg++;
@@ -634,20 +780,20 @@ struct TraceReader
             start_fp_reg = 0;
         }
 
-        inst->is_load = create_base_update_op ? false : mInstr.mType == InstClass::loadInstClass;
-        inst->is_store = create_base_update_op ? false : mInstr.mType == InstClass::storeInstClass;
-        inst->addr = mInstr.mEffAddr + (mProcessedPieces * mSizeFactor);
-        inst->size = std::max((uint64_t)1, (uint64_t)mSizeFactor);
+        inst->is_load = create_base_update_op ? false : mRecord.mInstr.mType == InstClass::loadInstClass;
+        inst->is_store = create_base_update_op ? false : mRecord.mInstr.mType == InstClass::storeInstClass;
+        inst->addr = mRecord.mInstr.mEffAddr + (mProcessedPieces * mRecord.mSizeFactor);
+        inst->size = std::max((uint64_t)1, (uint64_t)mRecord.mSizeFactor);
 
         assert(inst->size || !(inst->is_load || inst->is_store));
-        assert(mProcessedPieces < mTotalPieces);
+        assert(mProcessedPieces < mRecord.mTotalPieces);
 
         // At this point, if mProcessedPieces is 0, the next statements will have no effect.
         mProcessedPieces++;
-        inst->is_last_piece = mProcessedPieces == mTotalPieces;
+        inst->is_last_piece = mProcessedPieces == mRecord.mTotalPieces;
 
         // If there are more output registers to be processed and they are SIMD
-        if(mInstr.mNumOutRegs > mCrackRegIdx && !reg_is_int(mInstr.mOutRegs.at(mCrackRegIdx)))
+        if(mRecord.mInstr.mNumOutRegs > mCrackRegIdx && !reg_is_int(mRecord.mInstr.mOutRegs.at(mCrackRegIdx)))
         {
             // Next output value is in the next 64-bit lane
             mCrackValIdx++;
@@ -661,13 +807,124 @@ struct TraceReader
             mCrackValIdx++;
             mCrackRegIdx++;
         }
+    }
+
+    // Producer thread body: decode records ahead of the simulation thread until the trace is over.
+    void produceRecords()
+    {
+        while(!stop_producer.load(std::memory_order_relaxed))
+        {
+            Record * slot = records_ring->producer_slot();
+            if(slot == nullptr)
+            {
+                nProducerStalls.fetch_add(1, std::memory_order_relaxed);
+                do
+                {
+                    std::this_thread::yield();
+                    if(stop_producer.load(std::memory_order_relaxed))
+                    {
+                        break;
+                    }
+                    slot = records_ring->producer_slot();
+                } while(slot == nullptr);
+
+                if(slot == nullptr)
+                {
+                    break;
+                }
+            }
+
+            if(!decodeNextRecord(*slot))
+            {
+                break;
+            }
+            records_ring->publish();
+        }
+        producer_done.store(true, std::memory_order_release);
+    }
+
+    // Takes the next record from the producer thread, waiting for it if needed.
+    // Returns false once the producer reached the end of the trace and the ring is drained.
+    bool popRecord()
+    {
+        bool stalled = false;
+        while(true)
+        {
+            Record * slot = records_ring->consumer_slot();
+            if(slot == nullptr && producer_done.load(std::memory_order_acquire))
+            {
+                // The producer may have published its last records right before finishing.
+                slot = records_ring->consumer_slot();
+                if(slot == nullptr)
+                {
+                    return false;
+                }
+            }
+
+            if(slot != nullptr)
+            {
+                mRecord = *slot;
+                records_ring->release();
+                return true;
+            }
 
-        return inst;
+            if(!stalled)
+            {
+                stalled = true;
+                nConsumerStalls++;
+            }
+            std::this_thread::yield();
+        }
     }
 
-    // Read bytes from the trace and populate a buffer object.
+    // Fetch the next trace instruction, either decoded in place or from the producer thread.
     // Returns true if something was read from the trace, false if we the trace is over.
     bool readInstr()
+    {
+        start_fp_reg = 0;
+
+        const bool got_record = records_ring ? popRecord() : decodeNextRecord(mRecord);
+        if(!got_record)
+        {
+            if(verbose)
+                std::cout<<"EOF"<<std::endl;
+            return false;
+        }
+
+        // reset bookkeeping variables
+        mProcessedPieces = 0;
+        mCrackRegIdx = 0;
+        mCrackValIdx = 0;
+
+        nInstr++;
+
+        if(verbose && (nInstr % 5000000 == 0))
+            std::cout << nInstr << " instrs " << std::endl;
+
+        return true;
+    }
+
+    bool decodeNextRecord(Record& rec)
+    {
+        if(container_input)
+            return decodeRecord(*container_input, rec);
+        return indexed_input ? decodeRecord(*indexed_input, rec) : decodeRecord(*dpressed_input, rec);
+    }
+
+    // (Re)opens the .gz trace at its start.
+    void openGzTrace()
+    {
+        delete dpressed_input;
+        dpressed_input = new gz::igzstream();
+        dpressed_input->open(trace_name.c_str(), std::ios_base::in | std::ios_base::binary);
+    }
+
+    // Read bytes from the trace and populate a record.
+    // Returns true if something was read from the trace, false if we the trace is over.
+    // Only touches input and rec, so that it can run on the producer thread.
+    // Input is anything offering istream-like read(char*, n)/eof(): igzstream, cbpt_input_t, ...
+    template <class Input>
+    static bool decodeRecord(Input& input, Record& rec)
     {
         // Trace Format :
         // Inst PC                  - 8 bytes
@@ -692,92 +949,88 @@ struct TraceReader
         //
         // Int registers are encoded 0-30(GPRs), 31(Stack Pointer Register), 64(Flag Register), 65(Zero Register)
         // SIMD registers are encoded 32-63
-        mInstr.reset();
-        start_fp_reg = 0;
+        rec.mInstr.reset();
 
-        dpressed_input->read((char*) &mInstr.mPc, sizeof(mInstr.mPc));
+        input.read((char*) &rec.mInstr.mPc, sizeof(rec.mInstr.mPc));
 
-        if(dpressed_input->eof())
+        if(input.eof())
         {
-            std::cout<<"EOF"<<std::endl;
             return false;
         }
 
-        // reset bookkeeping variables
-        mTotalPieces = 0;
-        mMemPieces = 0;
-        mProcessedPieces = 0;
-        mSizeFactor = 1;
-        mCrackRegIdx = 0;
-        mCrackValIdx = 0;
+        rec.mTotalPieces = 0;
+        rec.mMemPieces = 0;
+        rec.mSizeFactor = 1;
 
         // default NextPc
-        mInstr.mNextPc = mInstr.mPc + 4;
+        rec.mInstr.mNextPc = rec.mInstr.mPc + 4;
 
-        dpressed_input->read((char*) &mInstr.mType, sizeof(mInstr.mType));
+        input.read((char*) &rec.mInstr.mType, sizeof(rec.mInstr.mType));
 
-        assert(mInstr.mType != InstClass::undefInstClass);
+        assert(rec.mInstr.mType != InstClass::undefInstClass);
 
         //EffAddr is the base address
-        if(mInstr.mType == InstClass::loadInstClass || mInstr.mType == InstClass::storeInstClass)
+        if(rec.mInstr.mType == InstClass::loadInstClass || rec.mInstr.mType == InstClass::storeInstClass)
         {
-            dpressed_input->read((char*) &mInstr.mEffAddr, sizeof(mInstr.mEffAddr));
-            dpressed_input->read((char*) &mInstr.mMemSize, sizeof(mInstr.mMemSize));
-            dpressed_input->read((char*) &mInstr.mBaseUpd, sizeof(mInstr.mBaseUpd));
-            if(mInstr.mType == InstClass::storeInstClass)
+            input.read((char*) &rec.mInstr.mEffAddr, sizeof(rec.mInstr.mEffAddr));
+            input.read((char*) &rec.mInstr.mMemSize, sizeof(rec.mInstr.mMemSize));
+            input.read((char*) &rec.mInstr.mBaseUpd, sizeof(rec.mInstr.mBaseUpd));
+            if(rec.mInstr.mType == InstClass::storeInstClass)
             {
-                dpressed_input->read((char*) &mInstr.mHasRegOffset, sizeof(mInstr.mHasRegOffset));
+                input.read((char*) &rec.mInstr.mHasRegOffset, sizeof(rec.mInstr.mHasRegOffset));
             }
         }
 
-        if(is_br(mInstr.mType))
+        if(is_br(rec.mInstr.mType))
         {
-            dpressed_input->read((char*) &mInstr.mTaken, sizeof(mInstr.mTaken));
-            if(!is_cond_br(mInstr.mType))
+            input.read((char*) &rec.mInstr.mTaken, sizeof(rec.mInstr.mTaken));
+            if(!is_cond_br(rec.mInstr.mType))
             {
-                assert(mInstr.mTaken);
+                assert(rec.mInstr.mTaken);
             }
-            if(mInstr.mTaken)
+            if(rec.mInstr.mTaken)
             {
-                dpressed_input->read((char*) &mInstr.mNextPc, sizeof(mInstr.mNextPc));
+                input.read((char*) &rec.mInstr.mNextPc, sizeof(rec.mInstr.mNextPc));
             }
         }
 
-        dpressed_input->read((char*) &mInstr.mNumInRegs, sizeof(mInstr.mNumInRegs));
+        input.read((char*) &rec.mInstr.mNumInRegs, sizeof(rec.mInstr.mNumInRegs));
 
+        assert(rec.mInstr.mNumInRegs <= MAX_IN_REGS && "Increase TraceReader::MAX_IN_REGS");
         // capture logical src reg
-        for(auto i = 0; i != mInstr.mNumInRegs; i++)
+        for(auto i = 0; i != rec.mInstr.mNumInRegs; i++)
         {
             uint8_t inReg;
-            dpressed_input->read((char*) &inReg, sizeof(inReg));
-            mInstr.mInRegs.push_back(inReg);
+            input.read((char*) &inReg, sizeof(inReg));
+            rec.mInstr.mInRegs.push_back(inReg);
         }
 
-        dpressed_input->read((char*) &mInstr.mNumOutRegs, sizeof(mInstr.mNumOutRegs));
+        input.read((char*) &rec.mInstr.mNumOutRegs, sizeof(rec.mInstr.mNumOutRegs));
 
+        assert(rec.mInstr.mNumOutRegs <= MAX_OUT_REGS && "Increase TraceReader::MAX_OUT_REGS");
         // capture logical dst reg
-        for(auto i = 0; i != mInstr.mNumOutRegs; i++)
+        for(auto i = 0; i != rec.mInstr.mNumOutRegs; i++)
         {
             uint8_t outReg;
-            dpressed_input->read((char*) &outReg, sizeof(outReg));
-            mInstr.mOutRegs.push_back(outReg);
+            input.read((char*) &outReg, sizeof(outReg));
+            rec.mInstr.mOutRegs.push_back(outReg);
         }
 
         // assumes 1 piece per logical register output
-        mTotalPieces =  (mInstr.mNumOutRegs > 0) ? mInstr.mNumOutRegs : 1;
+        rec.mTotalPieces =  (rec.mInstr.mNumOutRegs > 0) ? rec.mInstr.mNumOutRegs : 1;
 
-        const bool base_update_present = mInstr.capture_base_update_log_reg();
+        const bool base_update_present = rec.mInstr.capture_base_update_log_reg();
 
         uint8_t base_upd_pos_in_out_regs = UINT8_MAX;
         uint64_t base_upd_val = UINT64_MAX;
 
-        for(auto i = 0; i != mInstr.mNumOutRegs; i++)
+        for(auto i = 0; i != rec.mInstr.mNumOutRegs; i++)
         {
             uint64_t val;
 
-            dpressed_input->read((char*) &val, sizeof(val));
+            input.read((char*) &val, sizeof(val));
 
-            const bool matching_base_upd = base_update_present && mInstr.mBaseUpdReg.value() == mInstr.mOutRegs[i];
+            const bool matching_base_upd = base_update_present && rec.mInstr.mBaseUpdReg.value() == rec.mInstr.mOutRegs[i];
             if(matching_base_upd) // capture base_upd_val and skip pushing it to OutRegVal
             {
                 assert(base_upd_pos_in_out_regs == UINT8_MAX);
@@ -786,35 +1039,35 @@ struct TraceReader
             }
             else
             {
-                mInstr.mOutRegsValues.push_back(val);
+                rec.mInstr.mOutRegsValues.push_back(val);
 
                 // if  writing to some FP/SIMD/SVE reg and upper half is non-zero
-                if(!reg_is_int(mInstr.mOutRegs[i]))
+                if(!reg_is_int(rec.mInstr.mOutRegs[i]))
                 {
-                    assert(!is_store(mInstr.mType) && "Stores don't expect base updates for FP/SIMD/SVE regs");
-                    dpressed_input->read((char*) &val, sizeof(val));
-                    mInstr.mOutRegsValues.push_back(val);
+                    assert(!is_store(rec.mInstr.mType) && "Stores don't expect base updates for FP/SIMD/SVE regs");
+                    input.read((char*) &val, sizeof(val));
+                    rec.mInstr.mOutRegsValues.push_back(val);
                     if(val != 0)
                     {
-                        mTotalPieces++;
+                        rec.mTotalPieces++;
                     }
                 }
             }
         }
 
-        const bool is_macro_op_mem = is_mem(mInstr.mType);
+        const bool is_macro_op_mem = is_mem(rec.mInstr.mType);
         // move dst/val to end of dst reg/vals 
         if(base_update_present)
         {
             assert(is_macro_op_mem);
             assert(base_upd_pos_in_out_regs != UINT8_MAX);
-            assert(mInstr.mOutRegs[base_upd_pos_in_out_regs] == mInstr.mBaseUpdReg.value());
-            if(mInstr.mOutRegs.size() > 1)
+            assert(rec.mInstr.mOutRegs[base_upd_pos_in_out_regs] == rec.mInstr.mBaseUpdReg.value());
+            if(rec.mInstr.mOutRegs.size() > 1)
             {
-                mInstr.mOutRegs.erase(mInstr.mOutRegs.begin() + base_upd_pos_in_out_regs);
-                mInstr.mOutRegs.push_back(mInstr.mBaseUpdReg.value());
+                rec.mInstr.mOutRegs.erase(rec.mInstr.mOutRegs.begin() + base_upd_pos_in_out_regs);
+                rec.mInstr.mOutRegs.push_back(rec.mInstr.mBaseUpdReg.value());
             }
-            mInstr.mOutRegsValues.push_back(base_upd_val);
+            rec.mInstr.mOutRegsValues.push_back(base_upd_val);
         }
         else
         {
@@ -822,57 +1075,52 @@ struct TraceReader
         }
 
 
-        if(is_store(mInstr.mType) ) // special handling of stores
+        if(is_store(rec.mInstr.mType) ) // special handling of stores
         {
             // allow 1 addr reg, 1 offset reg and 1 value sources for store operations
             // assumes first input register is the address register in populateNewInstr
-            const uint8_t str_val_regs = mInstr.mNumInRegs - (1 + mInstr.mHasRegOffset); // accounting for store address reg + offset
+            const uint8_t str_val_regs = rec.mInstr.mNumInRegs - (1 + rec.mInstr.mHasRegOffset); // accounting for store address reg + offset
             uint8_t true_str_val_regs = (str_val_regs  == 0) ? 1 : str_val_regs;
-            if(mInstr.mMemSize%true_str_val_regs != 0)
+            if(rec.mInstr.mMemSize%true_str_val_regs != 0)
             {
-                std::cout<<"Store! Size:"<<(uint64_t)mInstr.mMemSize<<" Expected value registers"<<(uint64_t)true_str_val_regs<<std::endl;
-                std::cout<<"str_val_regs:"<<(uint64_t)str_val_regs<<" InputRegCount:"<<(uint64_t)mInstr.mNumInRegs<<" REgOffset:"<<(uint64_t)mInstr.mHasRegOffset<<std::endl;
+                std::cout<<"Store! Size:"<<(uint64_t)rec.mInstr.mMemSize<<" Expected value registers"<<(uint64_t)true_str_val_regs<<std::endl;
+                std::cout<<"str_val_regs:"<<(uint64_t)str_val_regs<<" InputRegCount:"<<(uint64_t)rec.mInstr.mNumInRegs<<" REgOffset:"<<(uint64_t)rec.mInstr.mHasRegOffset<<std::endl;
             }
-            assert(mInstr.mMemSize%true_str_val_regs == 0); // all pieces should be of same size
-            mMemPieces = true_str_val_regs;
+            assert(rec.mInstr.mMemSize%true_str_val_regs == 0); // all pieces should be of same size
+            rec.mMemPieces = true_str_val_regs;
 
-            assert(mMemPieces > 0);
+            assert(rec.mMemPieces > 0);
 
-            mTotalPieces = mMemPieces + base_update_present;
-            mSizeFactor = mInstr.mMemSize/mMemPieces;
+            rec.mTotalPieces = rec.mMemPieces + base_update_present;
+            rec.mSizeFactor = rec.mInstr.mMemSize/rec.mMemPieces;
         }
-        else if(is_load(mInstr.mType))
+        else if(is_load(rec.mInstr.mType))
         {
             // for loads, total_pieces included base_update reg already
-            mMemPieces = mTotalPieces - base_update_present;
-            assert(mMemPieces > 0);
-            mSizeFactor = mInstr.mMemSize/mMemPieces;
+            rec.mMemPieces = rec.mTotalPieces - base_update_present;
+            assert(rec.mMemPieces > 0);
+            rec.mSizeFactor = rec.mInstr.mMemSize/rec.mMemPieces;
         }
         else
         {
-            mMemPieces = 0;
-            mSizeFactor = mInstr.mMemSize/mTotalPieces;
-            assert(mSizeFactor == 0);
+            rec.mMemPieces = 0;
+            rec.mSizeFactor = rec.mInstr.mMemSize/rec.mTotalPieces;
+            assert(rec.mSizeFactor == 0);
         }
 
-        assert(mTotalPieces >= 1);
+        assert(rec.mTotalPieces >= 1);
         if(base_update_present)
         {
             assert(is_macro_op_mem);
-            assert(mMemPieces >= 1);
-            assert(mTotalPieces == (mMemPieces+ base_update_present));
+            assert(rec.mMemPieces >= 1);
+            assert(rec.mTotalPieces == (rec.mMemPieces+ base_update_present));
         }
 
-        if(!is_store(mInstr.mType) )
+        if(!is_store(rec.mInstr.mType) )
         {
-            assert(mInstr.mNumInRegs <= 3);
+            assert(rec.mInstr.mNumInRegs <= 3);
         }
 
-        nInstr++;
-
-        if(nInstr % 5000000 == 0)
-            std::cout << nInstr << " instrs " << std::endl;
-
         return true;
     }
 };
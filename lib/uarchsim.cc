@@ -25,7 +25,7 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <stdio.h>
 #include <stdlib.h>
 #include <inttypes.h>
-#include <sstream>
+#include <numeric>
 #include <assert.h>
 //#include "cbp.h"
 #include "value_predictor_interface.h"
@@ -37,15 +37,19 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "resource_schedule.h"
 #include "uarchsim.h"
 #include "parameters.h"
+#include "alloc_counter.h"
 
 //uarchsim_t::uarchsim_t():window(WINDOW_SIZE),
 uarchsim_t::uarchsim_t()
-      :window_capacity(WINDOW_SIZE)
-      ,L3(L3_SIZE, L3_ASSOC, L3_BLOCKSIZE, L3_LATENCY, (cache_t *)NULL)
-      ,L2(L2_SIZE, L2_ASSOC, L2_BLOCKSIZE, L2_LATENCY, &L3)
-      ,L1(L1_SIZE, L1_ASSOC, L1_BLOCKSIZE, L1_LATENCY, &L2)
+      :window(WINDOW_SIZE)
+      ,window_capacity(WINDOW_SIZE)
+      ,SQ(WINDOW_SIZE)
+      ,DQ(WINDOW_SIZE)
+      ,L3(L3_SIZE, L3_ASSOC, L3_BLOCKSIZE, L3_LATENCY, (cache_t *)NULL, L3_REPL)
+      ,L2(L2_SIZE, L2_ASSOC, L2_BLOCKSIZE, L2_LATENCY, &L3, L2_REPL)
+      ,L1(L1_SIZE, L1_ASSOC, L1_BLOCKSIZE, L1_LATENCY, &L2, L1_REPL)
       ,BP()
-      ,IC(IC_SIZE, IC_ASSOC, IC_BLOCKSIZE, 0, &L2) 
+      ,IC(IC_SIZE, IC_ASSOC, IC_BLOCKSIZE, 0, &L2, IC_REPL) 
 {
    assert(WINDOW_SIZE != 0);
    //assert(FETCH_WIDTH);
@@ -60,6 +64,20 @@ uarchsim_t::uarchsim_t()
    ldst_lanes = ((NUM_LDST_LANES > 0) ? (new resource_schedule(NUM_LDST_LANES)) : ((resource_schedule *)NULL));
    alu_lanes = ((NUM_ALU_LANES > 0) ? (new resource_schedule(NUM_ALU_LANES)) : ((resource_schedule *)NULL));
 
+   // the event heaps never reallocate (each is moved its own reserved vector: a copy would not keep the capacity)
+   std::vector<event_t> aq_events, eq_events;
+   aq_events.reserve(WINDOW_SIZE);
+   eq_events.reserve(WINDOW_SIZE);
+   AQ = event_queue_t(std::greater<event_t>(), std::move(aq_events));
+   EQ = event_queue_t(std::greater<event_t>(), std::move(eq_events));
+
+   if (LOG_LEVEL != 0) {
+      if (!pipe_trace.open(LOG_FILE, LOG_START_CYCLE, LOG_END_CYCLE)) {
+         printf("Cannot create the pipeline event trace %s.\n", LOG_FILE);
+         exit(1);
+      }
+   }
+
    for (int i = 0; i < RFSIZE; i++)
       RF[i] = 0;
 
@@ -87,6 +105,8 @@ uarchsim_t::uarchsim_t()
 }
 
 uarchsim_t::~uarchsim_t() {
+   delete ldst_lanes;
+   delete alu_lanes;
 }
 
 void uarchsim_t::end_current_begin_new_epoch(const bool first_epoch, const bool last_epoch, const uint64_t epoch_end_cycle)
@@ -253,19 +273,6 @@ void uarchsim_t::populate_decode_info(db_t *inst)
     }
 }
 
-const window_t& uarchsim_t::locate_entry_in_window(uint64_t seq_no, uint8_t piece) const
-{
-    const auto window_entry_it = std::lower_bound(window.begin(), window.end(), seq_no, [](const auto& window_entry, const uint64_t _my_seq)
-    {
-        return window_entry.seq_no < _my_seq;
-    });
-    assert(window_entry_it != window.end());
-    assert(window_entry_it->seq_no == seq_no);
-    assert(window_entry_it->piece == piece);
-    return *window_entry_it;
-}
-
-
 #if 0
 void uarchsim_t::step(db_t *inst) 
 {
@@ -276,25 +283,45 @@ void uarchsim_t::step(db_t *inst)
 
 #if 1
 
+void uarchsim_t::trace_event(PipeEvent kind, uint64_t cycle, const window_t& entry, uint64_t wrong_path_cycles)
+{
+   pipe_event_t event = {};
+   event.cycle = cycle;
+   event.seq_no = entry.seq_no;
+   event.pc = entry.PC;
+   event.fetch_cycle = entry.fetch_cycle;
+   event.decode_cycle = entry.decode_cycle;
+   event.exec_cycle = entry.exec_cycle;
+   event.retire_cycle = entry.retire_cycle;
+   event.piece = entry.piece;
+   event.kind = (uint8_t)kind;
+   event.insn_class = (uint8_t)entry.exec_info.dec_info.insn_class;
+   if (entry.exec_info.taken.has_value())
+      event.flags = PIPE_EVENT_BRANCH | (entry.exec_info.taken.value() ? PIPE_EVENT_TAKEN : 0) | (entry.pred_taken ? PIPE_EVENT_PRED_TAKEN : 0);
+   event.wrong_path_cycles = (uint32_t)wrong_path_cycles;
+   pipe_trace.record(event);
+}
+
 ////////////////////////
 // Manage DQ
 ////////////////////////
-void uarchsim_t::eval_decode(std::ostream& activity_trace, bool& activity_observed, const uint64_t current_cycle) 
+void uarchsim_t::eval_decode(const uint64_t current_cycle) 
 {
    if(!DQ.empty())
    {
         bool process_dq = true;
         while(process_dq)
         {
-            auto dq_it = DQ.begin();
-            const auto [seq_no, piece, decode_cycle] = *dq_it;
+            const auto [slot, decode_cycle] = DQ.peekhead();
             assert(current_cycle <= decode_cycle);
             if(current_cycle == decode_cycle)
             {
-                const auto& window_entry = locate_entry_in_window(seq_no, piece);
+                const auto& window_entry = window.at(slot);
                 assert(decode_cycle == window_entry.decode_cycle);
-                notify_instr_decode(window_entry.seq_no, window_entry.piece, window_entry.PC, window_entry.exec_info.dec_info, current_cycle);
-                DQ.pop_front();
+                count_allocs(predictor_allocs, [&] { notify_instr_decode(window_entry.seq_no, window_entry.piece, window_entry.PC, window_entry.exec_info.dec_info, current_cycle); });
+                if (pipe_trace.active(current_cycle))
+                    trace_event(PipeEvent::Decode, current_cycle, window_entry);
+                DQ.pop();
                 process_dq = !DQ.empty();
             }
             else
@@ -309,28 +336,25 @@ void uarchsim_t::eval_decode(std::ostream& activity_trace, bool& activity_observ
 ////////////////////////
 // Manage AGEN
 ////////////////////////
-void uarchsim_t::eval_aq(std::ostream& activity_trace, bool& activity_observed, const uint64_t current_cycle) 
+void uarchsim_t::eval_aq(const uint64_t current_cycle) 
 {
-   auto aq_it = AQ.begin();
-   while(aq_it != AQ.end())
+   while(!AQ.empty())
    {
-       const auto [seq_no, piece, agen_cycle] = *aq_it;
+       const auto [agen_cycle, seq_no, piece, slot] = AQ.top();
        assert(current_cycle <= agen_cycle);
-       if(current_cycle == agen_cycle)
-       {
-           const auto& window_entry = locate_entry_in_window(seq_no, piece);
-           assert(is_mem(window_entry.exec_info.dec_info.insn_class));
-           assert(current_cycle > window_entry.decode_cycle);
-           assert(current_cycle <= window_entry.exec_cycle);
-           notify_agen_complete(window_entry.seq_no, window_entry.piece, window_entry.PC, window_entry.exec_info.dec_info, window_entry.exec_info.mem_va.value(), window_entry.exec_info.mem_sz.value(), current_cycle);
-           activity_trace<<current_cycle<<"::AGEN:"<<window_entry<<"\n";
-           activity_observed = true;
-           aq_it = AQ.erase(aq_it);
-       }
-       else
+       if(current_cycle != agen_cycle)
        {
-           ++aq_it;
+           break;
        }
+       const auto& window_entry = window.at(slot);
+       assert((window_entry.seq_no == seq_no) && (window_entry.piece == piece));
+       assert(is_mem(window_entry.exec_info.dec_info.insn_class));
+       assert(current_cycle > window_entry.decode_cycle);
+       assert(current_cycle <= window_entry.exec_cycle);
+       count_allocs(predictor_allocs, [&] { notify_agen_complete(window_entry.seq_no, window_entry.piece, window_entry.PC, window_entry.exec_info.dec_info, window_entry.exec_info.mem_va.value(), window_entry.exec_info.mem_sz.value(), current_cycle); });
+       if (pipe_trace.active(current_cycle))
+           trace_event(PipeEvent::Agen, current_cycle, window_entry);
+       AQ.pop();
    }
 }
 
@@ -338,73 +362,89 @@ void uarchsim_t::eval_aq(std::ostream& activity_trace, bool& activity_observed,
 ////////////////////////
 // Manage Execute
 ////////////////////////
-void uarchsim_t::eval_exec(std::ostream& activity_trace, bool& activity_observed, const uint64_t current_cycle) 
+void uarchsim_t::eval_exec(const uint64_t current_cycle) 
 {
-   auto eq_it = EQ.begin();
-   while(eq_it != EQ.end())
+   while(!EQ.empty())
    {
-       const auto [seq_no, piece, exec_cycle] = *eq_it;
+       const auto [exec_cycle, seq_no, piece, slot] = EQ.top();
        assert(current_cycle <= exec_cycle);
-       if(current_cycle == exec_cycle)
-       {
-           const auto& window_entry = locate_entry_in_window(seq_no, piece);
-           assert(window_entry.exec_cycle == exec_cycle);
-           notify_instr_execute_resolve(window_entry.seq_no, window_entry.piece, window_entry.PC, window_entry.pred_taken, window_entry.exec_info, current_cycle);
-           activity_trace<<current_cycle<<"::Executed:"<<window_entry<<"\n";
-           activity_observed = true;
-           eq_it = EQ.erase(eq_it);
-       }
-       else
+       if(current_cycle != exec_cycle)
        {
-           ++eq_it;
+           break;
        }
+       const auto& window_entry = window.at(slot);
+       assert((window_entry.seq_no == seq_no) && (window_entry.piece == piece));
+       assert(window_entry.exec_cycle == exec_cycle);
+       count_allocs(predictor_allocs, [&] { notify_instr_execute_resolve(window_entry.seq_no, window_entry.piece, window_entry.PC, window_entry.pred_taken, window_entry.exec_info, current_cycle); });
+       if (pipe_trace.active(current_cycle))
+           trace_event(PipeEvent::Execute, current_cycle, window_entry);
+       EQ.pop();
    }
 }
 
 /////////////////////////////
 // Manage window: retire.
 /////////////////////////////
-void uarchsim_t::eval_retire(std::ostream& activity_trace, bool& activity_observed, const uint64_t current_cycle) 
+void uarchsim_t::eval_retire(const uint64_t current_cycle) 
 {
-   while (!window.empty() && (current_cycle >= window.front().retire_cycle)) {
-      //window_t w = window.pop();
-      window_t w = window.front();
-      activity_trace<<current_cycle<<"::Retired:"<<w<<"\n";
-      activity_observed = true;
-
-      //window.pop();
-      window.pop_front();
-      notify_instr_commit(w.seq_no, w.piece, w.PC, w.pred_taken, w.exec_info, current_cycle);
+   while (!window.empty() && (current_cycle >= window.at(window.head_slot()).retire_cycle)) {
+      // the entry stays in its slot until the next push
+      const window_t& w = window.at(window.head_slot());
+      if (pipe_trace.active(current_cycle))
+         trace_event(PipeEvent::Retire, current_cycle, w);
+
+      window.pop();
+      count_allocs(predictor_allocs, [&] { notify_instr_commit(w.seq_no, w.piece, w.PC, w.pred_taken, w.exec_info, current_cycle); });
       if (VP_ENABLE && !VP_PERFECT)
          updatePredictor(w.seq_no, w.addr, w.value, w.latency);
    }
 }
 
+/////////////////////////////
+// Advance the pipe: dispatch, cycle by cycle, every pending event up to and including target_cycle.
+// Only cycles that have an event are visited; within a cycle the order is decode, AGEN, execute, retire.
+/////////////////////////////
+void uarchsim_t::eval_until(const uint64_t target_cycle) 
+{
+   while(true)
+   {
+      uint64_t next_cycle = UINT64_MAX;
+      if(!DQ.empty())
+         next_cycle = MIN(next_cycle, std::get<1>(DQ.peekhead()));
+      if(!AQ.empty())
+         next_cycle = MIN(next_cycle, std::get<0>(AQ.top()));
+      if(!EQ.empty())
+         next_cycle = MIN(next_cycle, std::get<0>(EQ.top()));
+      if(!window.empty())
+         next_cycle = MIN(next_cycle, window.at(window.head_slot()).retire_cycle);
+
+      if(next_cycle > target_cycle)
+      {
+         break;
+      }
+
+      eval_decode(next_cycle);
+      eval_aq(next_cycle);
+      eval_exec(next_cycle);
+      eval_retire(next_cycle);
+   }
+}
+
 void uarchsim_t::step(db_t *inst) 
 {
    spdlog::debug("Stepping, FC: {}",fetch_cycle);
-   bool activity_observed = false;
-   std::ostringstream activity_trace;
 
    // Preliminary step: determine which piece of the instruction this is.
-   static uint8_t piece = UINT8_MAX;
    //static uint64_t prev_pc = 0xdeadbeef;
-   piece = (piece == UINT8_MAX) ? 0 : (piece + 1);
+   fetch_piece = (fetch_piece == UINT8_MAX) ? 0 : (fetch_piece + 1);
+   const uint8_t piece = fetch_piece;
    //prev_pc = inst->pc;
 
    assert(previous_fetch_cycle <= fetch_cycle);
    // advancing the pipe for the cycles skipped due to mispred/flush etc
    if(previous_fetch_cycle != fetch_cycle)
    {
-       uint64_t temp_fetch_cycle = previous_fetch_cycle;
-       while(temp_fetch_cycle <= fetch_cycle)
-       {
-           eval_decode(activity_trace, activity_observed, temp_fetch_cycle);
-           eval_aq(activity_trace, activity_observed, temp_fetch_cycle);
-           eval_exec(activity_trace, activity_observed, temp_fetch_cycle);
-           eval_retire(activity_trace, activity_observed, temp_fetch_cycle);
-           temp_fetch_cycle++;
-       }
+       eval_until(fetch_cycle);
    }
 
  
@@ -416,8 +456,6 @@ void uarchsim_t::step(db_t *inst)
    // 
    // Schedule the instruction's execution cycle.
    //
-   uint64_t i;
-   uint64_t addr;
 
    if (FETCH_MODEL_ICACHE)
    {
@@ -426,19 +464,14 @@ void uarchsim_t::step(db_t *inst)
       // advancing the pipe for the cycles skipped due to L1I$ miss
       if(next_fetch_cycle != fetch_cycle)
       {
-          uint64_t temp_fetch_cycle = fetch_cycle;
-          while(temp_fetch_cycle <= next_fetch_cycle)
-          {
-              eval_decode(activity_trace, activity_observed, temp_fetch_cycle);
-              eval_aq(activity_trace, activity_observed, temp_fetch_cycle);
-              eval_exec(activity_trace, activity_observed, temp_fetch_cycle);
-              eval_retire(activity_trace, activity_observed, temp_fetch_cycle);
-              temp_fetch_cycle++;
-          }
+          eval_until(next_fetch_cycle);
           fetch_cycle = next_fetch_cycle;
       }
    }
 
+   // Stores that left the SQ by the fetch cycle can no longer forward to this or any later load.
+   SQ.evict(fetch_cycle);
+
    // Predict at fetch time
    if (VP_ENABLE)
    {
@@ -535,18 +568,7 @@ void uarchsim_t::step(db_t *inst)
       exec_cycle = (exec_cycle + 1);
 
       bool inc_sqmiss = false;
-      uint64_t temp_cycle = 0;
-      for (i = 0, addr = inst->addr; i < inst->size; i++, addr++) {
-         if ((SQ.find(addr) != SQ.end()) && (exec_cycle < SQ[addr].ret_cycle)) {
-            // SQ hit: the byte's timestamp is the later of load's execution cycle and store's execution cycle
-            temp_cycle = MAX(temp_cycle, MAX(exec_cycle, SQ[addr].exec_cycle));
-         }
-         else {
-            // SQ miss: the byte's timestamp is its availability in L1 D$
-            temp_cycle = MAX(temp_cycle, data_cache_cycle);
-            inc_sqmiss = true;
-         }
-      }
+      uint64_t temp_cycle = SQ.load(inst->addr, inst->size, exec_cycle, data_cache_cycle, inc_sqmiss);
 
       num_load++;                   // stat
       num_load_sqmiss += (inc_sqmiss ? 1 : 0);      // stat
@@ -570,8 +592,6 @@ void uarchsim_t::step(db_t *inst)
       exec_cycle += latency;
    }
 
-   activity_observed = true;
-
    // Drain prefetches from PF Queue
    // The idea is that a prefetch can go only if there is a free LDST slot "this" cycle
    // Here, "this" means all the cycles between the previous fetch cycle and the current one since all fetched ld/st will have been
@@ -628,23 +648,24 @@ void uarchsim_t::step(db_t *inst)
       {
          squash = (pred.speculate && (pred.predicted_value != inst->D.value));         
          RF[inst->D.log_reg] = ((pred.speculate && (pred.predicted_value == inst->D.value)) ? fetch_cycle : exec_cycle);
-         activity_observed = true;
       }
    }
 
    // Update SQ byte timestamps.
    if (inst->is_store) {
+      // The store dirties the L1$ block. Without write-allocate, a store miss is written around the
+      // L1$ and the store does not wait for it.
       uint64_t data_cache_cycle;
-      if (!WRITE_ALLOCATE || PERFECT_CACHE)
+      if (PERFECT_CACHE)
          data_cache_cycle = exec_cycle;
-      else
-         data_cache_cycle = L1.access(exec_cycle, true, inst->addr);
-
-      uint64_t ret_cycle = MAX(data_cache_cycle, (window.empty() ? 0 : window.back().retire_cycle));
-      for (i = 0, addr = inst->addr; i < inst->size; i++, addr++) {
-         SQ[addr].exec_cycle = exec_cycle;
-         SQ[addr].ret_cycle = ret_cycle;
+      else {
+         data_cache_cycle = L1.access(exec_cycle, false/*write*/, inst->addr);
+         if (!WRITE_ALLOCATE)
+            data_cache_cycle = exec_cycle;
       }
+
+      uint64_t ret_cycle = MAX(data_cache_cycle, (window.empty() ? 0 : window.at(window.tail_slot()).retire_cycle));
+      SQ.store(inst->addr, inst->size, exec_cycle, ret_cycle);
    }
 
    // CVP measurements
@@ -662,39 +683,42 @@ void uarchsim_t::step(db_t *inst)
      //      latency});
    //window_t (uint64_t _seq_no, uint64_t _PC, uint64_t _fetch_cycle, uint64_t _decode_cycle, uint64_t _exec_cycle, ExecuteInfo _exec_info, uint64_t _retire_cycle, uint64_t _addr, uint64_t _value, uint64_t _latency)
    const uint64_t decode_cycle = fetch_cycle+DQ_LATENCY;
+   const uint64_t alloc_mark = heap_alloc_count();
    populate_exec_info(inst);
+   exec_info_allocs += heap_alloc_count() - alloc_mark;
    assert(fetch_cycle < exec_cycle);
    const uint64_t predict_cycle = fetch_cycle;
-   window.push_back({seq_no,
+   const uint64_t slot = window.push({seq_no,
                piece,
                inst->pc,
                fetch_cycle,
                decode_cycle,
                exec_cycle,
                _current_execute_info,
-               MAX(exec_cycle, (window.empty() ? 0 : window.back().retire_cycle)), //retire_cycle
+               MAX(exec_cycle, (window.empty() ? 0 : window.at(window.tail_slot()).retire_cycle)), //retire_cycle
                ((inst->is_load || inst->is_store) ? inst->addr : 0xDEADBEEF), // addr
                ((inst->D.valid && (inst->D.log_reg != RFFLAGS)) ? inst->D.value : 0xDEADBEEF), //value
            latency}); //latency
-   activity_trace<<fetch_cycle<<"::Fetched:"<<window.back()<<" Inst:"<<*inst<<"\n";
-   activity_observed = true;
-   assert(window.size() <= window_capacity);
+   if (pipe_trace.active(fetch_cycle))
+      trace_event(PipeEvent::Fetch, fetch_cycle, window.at(slot));
+   assert(window.get_length() <= window_capacity);
 
-   notify_instr_fetch(seq_no, piece, inst->pc, fetch_cycle);
+   count_allocs(predictor_allocs, [&] { notify_instr_fetch(seq_no, piece, inst->pc, fetch_cycle); });
 
-   DQ.push_back(std::make_tuple(seq_no, piece, decode_cycle));
+   DQ.push(std::make_tuple(slot, decode_cycle));
    if(is_mem(inst->insn_class))
    {
-       AQ.push_back(std::make_tuple(seq_no, piece, agen_cycle));
+       AQ.push(std::make_tuple(agen_cycle, seq_no, piece, slot));
        assert(AQ.size() <= window_capacity);
    }
-   EQ.push_back(std::make_tuple(seq_no, piece, exec_cycle));
+   EQ.push(std::make_tuple(exec_cycle, seq_no, piece, slot));
+   assert(EQ.size() <= window_capacity);
 
    /////////////////////////////
    // Manage fetch cycle.
    /////////////////////////////
    previous_fetch_cycle = fetch_cycle;
-   assert(window.front().retire_cycle > fetch_cycle);
+   assert(window.at(window.head_slot()).retire_cycle > fetch_cycle);
 
    const bool is_branch = is_br(inst->insn_class);
    if (squash) // control dependency on the retire cycle of the value-mispredicted instruction
@@ -702,15 +726,17 @@ void uarchsim_t::step(db_t *inst)
       num_fetched = 0;          // new fetch bundle
       //assert(!window.empty() && (fetch_cycle < window.peektail().retire_cycle));
       //fetch_cycle = window.peektail().retire_cycle;
-      assert(!window.empty() && (fetch_cycle < window.back().retire_cycle));
-      fetch_cycle = window.back().retire_cycle;
+      assert(!window.empty() && (fetch_cycle < window.at(window.tail_slot()).retire_cycle));
+      fetch_cycle = window.at(window.tail_slot()).retire_cycle;
+      if (pipe_trace.active(predict_cycle))
+         trace_event(PipeEvent::Flush, predict_cycle, window.at(window.tail_slot()), fetch_cycle - predict_cycle);
    }
-   else if (window.size() == window_capacity) 
+   else if (window.full()) 
    {
-      if (fetch_cycle < window.front().retire_cycle) 
+      if (fetch_cycle < window.at(window.head_slot()).retire_cycle) 
       {
          num_fetched = 0;       // new fetch bundle
-         fetch_cycle = window.front().retire_cycle;
+         fetch_cycle = window.at(window.head_slot()).retire_cycle;
       }
    }
    else {               // fetch bundle constraints
@@ -748,7 +774,6 @@ void uarchsim_t::step(db_t *inst)
            const bool taken_branch = (is_cond_br(inst->insn_class) && (inst->next_pc != (inst->pc + 4))) || is_uncond_br(inst->insn_class);
            if(!taken_branch)
            {
-               std::cout<<activity_trace.str()<<std::endl;
                std::cout<<"FailingInstr"<<*inst<<std::endl;
            }
            assert(taken_branch);
@@ -795,8 +820,10 @@ void uarchsim_t::step(db_t *inst)
            }
            assert(_current_execute_info.taken.value());
        }
-       window.back().update_pred_taken(predicted_taken);
+       window.at(window.tail_slot()).update_pred_taken(predicted_taken);
    }
+   if (br_mispred && pipe_trace.active(predict_cycle))
+       trace_event(PipeEvent::Mispredict, predict_cycle, window.at(window.tail_slot()), fetch_cycle - predict_cycle);
 
    spdlog::debug("Updating base_cycle to {}", MIN(fetch_cycle, prefetcher.get_oldest_pf_cycle()));
 
@@ -804,15 +831,14 @@ void uarchsim_t::step(db_t *inst)
    // Note : We may have some prefetches to issue still that are older than the fetch cycle.
    if (ldst_lanes) ldst_lanes->advance_base_cycle(MIN(fetch_cycle, prefetcher.get_oldest_pf_cycle()));
    if (alu_lanes) alu_lanes->advance_base_cycle(MIN(fetch_cycle, prefetcher.get_oldest_pf_cycle()));
-   const bool dump_activity = LOG_LEVEL != 0 && (fetch_cycle>= LOG_START_CYCLE) && (fetch_cycle<=LOG_END_CYCLE);
-   if(dump_activity && activity_observed)
-   {
-       std::cout<<activity_trace.str();
-   }
+   IC.advance_base_cycle(MIN(fetch_cycle, prefetcher.get_oldest_pf_cycle()));
+   L1.advance_base_cycle(MIN(fetch_cycle, prefetcher.get_oldest_pf_cycle()));
+   L2.advance_base_cycle(MIN(fetch_cycle, prefetcher.get_oldest_pf_cycle()));
+   L3.advance_base_cycle(MIN(fetch_cycle, prefetcher.get_oldest_pf_cycle()));
 
    if(inst->is_last_piece)
    {
-       piece = UINT8_MAX;
+       fetch_piece = UINT8_MAX;
    }
 
    num_insts_per_epoch.back() += inst->is_last_piece;
@@ -827,6 +853,56 @@ void uarchsim_t::step(db_t *inst)
 
 
 
+// The hooks of cbp.h are called from fetch to commit at once, all in the current fetch cycle,
+// which does not advance: the predictor is updated in order, before the next uop is predicted.
+void uarchsim_t::warm(db_t *inst)
+{
+   assert(window.empty());
+   fetch_piece = (fetch_piece == UINT8_MAX) ? 0 : (fetch_piece + 1);
+   const uint8_t piece = fetch_piece;
+   const uint64_t seq_no = num_uop;
+
+   if (FETCH_MODEL_ICACHE)
+      IC.warm(true/*read*/, inst->pc);
+   if (!PERFECT_CACHE && inst->is_load)
+      L1.warm(true/*read*/, inst->addr);
+   if (!PERFECT_CACHE && inst->is_store)
+      L1.warm(false/*write*/, inst->addr);
+
+   populate_exec_info(inst);
+   count_allocs(predictor_allocs, [&] { notify_instr_fetch(seq_no, piece, inst->pc, fetch_cycle); });
+   const bool br_mispred = !PERFECT_BRANCH_PRED && BP.predict(seq_no, piece, inst->insn_class, inst->pc, inst->next_pc, fetch_cycle);
+   bool pred_taken = false;
+   if (is_br(inst->insn_class))
+      pred_taken = is_cond_br(inst->insn_class) ? (br_mispred ? !inst->is_taken : inst->is_taken) : true;
+
+   count_allocs(predictor_allocs, [&] { notify_instr_decode(seq_no, piece, inst->pc, _current_execute_info.dec_info, fetch_cycle); });
+   if (is_mem(inst->insn_class))
+      count_allocs(predictor_allocs, [&] { notify_agen_complete(seq_no, piece, inst->pc, _current_execute_info.dec_info, _current_execute_info.mem_va.value(), _current_execute_info.mem_sz.value(), fetch_cycle); });
+   count_allocs(predictor_allocs, [&] { notify_instr_execute_resolve(seq_no, piece, inst->pc, pred_taken, _current_execute_info, fetch_cycle); });
+   count_allocs(predictor_allocs, [&] { notify_instr_commit(seq_no, piece, inst->pc, pred_taken, _current_execute_info, fetch_cycle); });
+
+   num_uop += 1;
+   num_inst += inst->is_last_piece;
+   if (inst->is_last_piece)
+      fetch_piece = UINT8_MAX;
+}
+
+void uarchsim_t::drain()
+{
+   // cycle is the last retire cycle, and no event comes after the retirement of its uop
+   eval_until(cycle);
+   assert(window.empty() && DQ.empty() && AQ.empty() && EQ.empty());
+   fetch_cycle = MAX(fetch_cycle, cycle);
+   num_fetched = 0;
+   num_fetched_branch = 0;
+}
+
+sim_progress_t uarchsim_t::get_progress() const
+{
+   return {num_inst, fetch_cycle, BP.num_cond_mispredicted()};
+}
+
 #define KILOBYTE    (1<<10)
 #define MEGABYTE    (1<<20)
 #define SCALED_SIZE(size)   ((size/KILOBYTE >= KILOBYTE) ? (size/MEGABYTE) : (size/KILOBYTE))
@@ -837,9 +913,122 @@ uint64_t uarchsim_t::get_current_fetch_cycle() const {
     return fetch_cycle;
 }
 
-void uarchsim_t::output() 
+uint64_t uarchsim_t::get_exec_info_allocs() const {
+    return exec_info_allocs;
+}
+
+uint64_t uarchsim_t::get_predictor_allocs() const {
+    return predictor_allocs + BP.get_hook_allocs();
+}
+
+static void snapshot_field(snapshot_t& s, DecodeInfo& d)
+{
+   snapshot_fields(s, d.insn_class, d.src_reg_info, d.dst_reg_info);
+}
+
+static void snapshot_field(snapshot_t& s, ExecuteInfo& e)
+{
+   snapshot_fields(s, e.dec_info, e.taken, e.next_pc, e.taken_target, e.mem_va, e.mem_sz, e.dst_reg_value);
+}
+
+static void snapshot_field(snapshot_t& s, window_t& w)
+{
+   snapshot_fields(s, w.seq_no, w.piece, w.PC, w.fetch_cycle, w.decode_cycle, w.exec_cycle, w.exec_info,
+                   w.retire_cycle, w.pred_taken, w.addr, w.value, w.latency);
+}
+
+// The heap is saved in pop order and restored by pushing the events back: the events are all
+// distinct, so it pops them in the same order, whatever the layout of its vector.
+void uarchsim_t::snapshot_event_queue(snapshot_t& s, event_queue_t& q)
+{
+   std::vector<event_queue_t::value_type> events;
+   if (s.is_saving()) {
+      auto copy = q;
+      while (!copy.empty()) {
+         events.push_back(copy.top());
+         copy.pop();
+      }
+   }
+   snapshot_field(s, events);
+   if (!s.is_saving()) {
+      while (!q.empty())
+         q.pop();
+      for (const auto& e : events)
+         q.push(e);
+   }
+}
+
+void uarchsim_t::snapshot(snapshot_t& s)
+{
+   s.section("uarchsim");
+   snapshot_fields(s, num_fetched, num_fetched_branch, fetch_piece);
+   s.check(window_capacity, "window size");
+   window.snapshot(s);
+   s.section("lanes");
+   ldst_lanes->snapshot(s);
+   alu_lanes->snapshot(s);
+   snapshot_field(s, RF);
+   s.section("sq");
+   SQ.snapshot(s);
+   s.section("events");
+   DQ.snapshot(s);
+   snapshot_event_queue(s, AQ);
+   snapshot_event_queue(s, EQ);
+   s.section("caches");
+   L3.snapshot(s);
+   L2.snapshot(s);
+   L1.snapshot(s);
+   IC.snapshot(s);
+   snapshot_fields(s, fetch_cycle, previous_fetch_cycle);
+   BP.snapshot(s);
+   s.section("prefetcher");
+   prefetcher.snapshot(s);
+   s.section("stats");
+   snapshot_fields(s, num_inst, num_uop, cycle, num_insts_per_epoch, num_cycles_per_epoch, last_epoch_end_cycle,
+                   num_eligible, num_correct, num_incorrect, num_load, num_load_sqmiss, cycles_on_wrong_path,
+                   stat_pfs_issued_to_mem);
+}
+
+void uarchsim_t::finish()
 {
    end_current_begin_new_epoch(false/*first_epoch*/, true/*last_epoch*/, cycle);
+}
+
+cond_br_meas_t uarchsim_t::measure_cond_br(const bool last_half_only) const
+{
+   const uint64_t total_instr = std::accumulate(num_insts_per_epoch.begin(), num_insts_per_epoch.end(), (uint64_t)0);
+   return BP.measure_cond_br(num_insts_per_epoch, num_cycles_per_epoch, last_half_only ? (total_instr / 2) : total_instr);
+}
+
+void uarchsim_t::reset_measurements()
+{
+   // the epoch just begun is kept: last_epoch_end_cycle already starts it
+   assert(num_insts_per_epoch.back() == 0);
+   const size_t num_closed = num_insts_per_epoch.size() - 1;
+   num_insts_per_epoch.erase(num_insts_per_epoch.begin(), num_insts_per_epoch.begin() + num_closed);
+   num_cycles_per_epoch.erase(num_cycles_per_epoch.begin(), num_cycles_per_epoch.begin() + num_closed);
+   BP.drop_epochs(num_closed);
+}
+
+cond_br_meas_t uarchsim_t::measure_epoch(const size_t epoch) const
+{
+   return BP.measure_epoch(num_insts_per_epoch, num_cycles_per_epoch, epoch);
+}
+
+size_t uarchsim_t::get_num_epochs() const
+{
+   return num_insts_per_epoch.size();
+}
+
+void uarchsim_t::append_epochs(const size_t first, const size_t count, std::vector<uint64_t>& insts, std::vector<uint64_t>& cycles, bp_t& bp) const
+{
+   insts.insert(insts.end(), num_insts_per_epoch.begin() + first, num_insts_per_epoch.begin() + first + count);
+   cycles.insert(cycles.end(), num_cycles_per_epoch.begin() + first, num_cycles_per_epoch.begin() + first + count);
+   bp.append_epochs(BP, first, count);
+}
+
+void uarchsim_t::output() 
+{
    //auto get_track_name = [] (uint64_t track){
    //   static std::string track_names [] = {
    //      "ALL",
@@ -877,16 +1066,17 @@ void uarchsim_t::output()
    printf("\t* performed in the L1$. While buffered, conflicting loads get\n");
    printf("\t* the store's data as they would from the SQ.\n");
    if (FETCH_MODEL_ICACHE) {
-      printf("I$: %lu %s, %lu-way set-assoc., %luB block size\n",
-         SCALED_SIZE(IC_SIZE), SCALED_UNIT(IC_SIZE), IC_ASSOC, IC_BLOCKSIZE);
-   }
-   printf("L1$: %lu %s, %lu-way set-assoc., %luB block size, %lu-cycle search latency\n",
-      SCALED_SIZE(L1_SIZE), SCALED_UNIT(L1_SIZE), L1_ASSOC, L1_BLOCKSIZE, L1_LATENCY);
-   printf("L2$: %lu %s, %lu-way set-assoc., %luB block size, %lu-cycle search latency\n",
-      SCALED_SIZE(L2_SIZE), SCALED_UNIT(L2_SIZE), L2_ASSOC, L2_BLOCKSIZE, L2_LATENCY);
-   printf("L3$: %lu %s, %lu-way set-assoc., %luB block size, %lu-cycle search latency\n",
-      SCALED_SIZE(L3_SIZE), SCALED_UNIT(L3_SIZE), L3_ASSOC, L3_BLOCKSIZE, L3_LATENCY);
+      printf("I$: %lu %s, %lu-way set-assoc., %luB block size, %s replacement\n",
+         SCALED_SIZE(IC_SIZE), SCALED_UNIT(IC_SIZE), IC_ASSOC, IC_BLOCKSIZE, cache_repl_name(IC_REPL));
+   }
+   printf("L1$: %lu %s, %lu-way set-assoc., %luB block size, %lu-cycle search latency, %s replacement\n",
+      SCALED_SIZE(L1_SIZE), SCALED_UNIT(L1_SIZE), L1_ASSOC, L1_BLOCKSIZE, L1_LATENCY, cache_repl_name(L1_REPL));
+   printf("L2$: %lu %s, %lu-way set-assoc., %luB block size, %lu-cycle search latency, %s replacement\n",
+      SCALED_SIZE(L2_SIZE), SCALED_UNIT(L2_SIZE), L2_ASSOC, L2_BLOCKSIZE, L2_LATENCY, cache_repl_name(L2_REPL));
+   printf("L3$: %lu %s, %lu-way set-assoc., %luB block size, %lu-cycle search latency, %s replacement\n",
+      SCALED_SIZE(L3_SIZE), SCALED_UNIT(L3_SIZE), L3_ASSOC, L3_BLOCKSIZE, L3_LATENCY, cache_repl_name(L3_REPL));
    printf("Main Memory: %lu-cycle fixed search time\n", MAIN_MEMORY_LATENCY);
+   printf("Each cache sends one block request or writeback per cycle to the next level (write-back caches, writebacks allocate)\n");
    printf("---------------------------STORE QUEUE MEASUREMENTS (Full Simulation i.e. Counts Not Reset When Warmup Ends)---------------------------\n");
    printf("Number of loads: %lu\n", num_load);
    printf("Number of loads that miss in SQ: %lu (%.2f%%)\n", num_load_sqmiss, 100.0*(double)num_load_sqmiss/(double)num_load);
@@ -23,12 +23,14 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 
 #include <unordered_map>
-#include <list>
+#include <queue>
 #include "spdlog/spdlog.h"
 #include "spdlog/fmt/ostr.h"
 //#include "cbp.h"
 #include "value_predictor_interface.h"
 #include "stride_prefetcher.h"
+#include "store_queue.h"
+#include "pipe_trace.h"
 using namespace std;
 
 #ifndef _RISCV_UARCHSIM_H
@@ -104,9 +106,12 @@ struct window_t {
    }
 };
 
-struct store_queue_t {
-   uint64_t exec_cycle; // store's execution cycle
-   uint64_t ret_cycle;  // store's commit cycle
+// Where a simulation stands; the difference of two is the measurement of the instructions in between
+// (see cbp --sample).
+struct sim_progress_t {
+   uint64_t num_inst;
+   uint64_t fetch_cycle;
+   uint64_t num_cond_mispredicted;
 };
 
 // Class for a microarchitectural simulator.
@@ -118,8 +123,9 @@ class uarchsim_t {
       // Modeling resources: (1) finite fetch bundle, (2) finite window, and (3) finite execution lanes.
       uint64_t num_fetched;
       uint64_t num_fetched_branch;
-      //fifo_t<window_t> window;
-      std::deque<window_t> window;
+      uint8_t fetch_piece = UINT8_MAX;  // piece of the uop being fetched, UINT8_MAX between instructions
+      // The window is a ring of WINDOW_SIZE slots; pending hook events refer to their uop by slot.
+      fifo_t<window_t> window;
       uint64_t window_capacity;
       resource_schedule *alu_lanes;
       resource_schedule *ldst_lanes;
@@ -128,11 +134,18 @@ class uarchsim_t {
       uint64_t RF[RFSIZE];
 
       // store queue byte timestamps
-      unordered_map<uint64_t, store_queue_t> SQ;
-
-      std::deque<std::tuple<uint64_t/*seq_no*/, uint8_t/*piece*/, uint64_t/*decode_cycle*/>> DQ;
-      std::list<std::tuple<uint64_t/*seq_no*/, uint8_t/*piece*/, uint64_t/*agen_cycle*/>> AQ; // agen_queue
-      std::list<std::tuple<uint64_t/*seq_no*/, uint8_t/*piece*/, uint64_t/*exec_cycle*/>> EQ;
+      store_queue_t SQ;
+
+      // Pending hook events. Decode cycles are monotonic in fetch order, so DQ is a plain FIFO.
+      // AGEN/execute cycles are not: AQ/EQ are min-heaps ordered by (cycle, seq_no), so that events
+      // of one cycle are dispatched in fetch order, as a walk of a fetch-ordered list would.
+      // Every uop with a pending event is in the window, so none of them outgrows WINDOW_SIZE.
+      using event_t = std::tuple<uint64_t/*cycle*/, uint64_t/*seq_no*/, uint8_t/*piece*/, uint64_t/*window slot*/>;
+      using event_queue_t = std::priority_queue<event_t, std::vector<event_t>, std::greater<event_t>>;
+      fifo_t<std::tuple<uint64_t/*window slot*/, uint64_t/*decode_cycle*/>> DQ;
+      event_queue_t AQ; // agen_queue
+      event_queue_t EQ;
+      static void snapshot_event_queue(snapshot_t& s, event_queue_t& q);
 
       // memory block timestamps
       cache_t L3;
@@ -172,6 +185,12 @@ class uarchsim_t {
       uint64_t cycles_on_wrong_path;
 
       uint64_t stat_pfs_issued_to_mem = 0;
+      uint64_t exec_info_allocs = 0;   // heap allocations in populate_exec_info (expected: none)
+      uint64_t predictor_allocs = 0;   // heap allocations in the notify_* predictor hooks
+
+      // Pipeline events of the cycles chosen with -T (see pipe_trace.h).
+      pipe_trace_t pipe_trace;
+      void trace_event(PipeEvent kind, uint64_t cycle, const window_t& entry, uint64_t wrong_path_cycles = 0);
 
       // Helper for oracle hit/miss information
       uint64_t get_load_exec_cycle(db_t *inst) const;
@@ -180,7 +199,6 @@ class uarchsim_t {
       ExecuteInfo _current_execute_info;
       void populate_exec_info(db_t *inst); 
       void populate_decode_info(db_t *inst); 
-      const window_t& locate_entry_in_window(uint64_t seq_no, uint8_t piece) const;
       void end_current_begin_new_epoch(const bool first_epoch, const bool last_epoch, const uint64_t epoch_end_cycle);
 
    public:
@@ -189,12 +207,39 @@ class uarchsim_t {
 
       //void set_funcsim(processor_t *funcsim);
       void step(db_t *inst);
-      void eval_decode(std::ostream& activity_trace, bool& activity_observed, const uint64_t current_fetch_cycle) ;
-      void eval_aq(std::ostream& activity_trace, bool& activity_observed, const uint64_t current_fetch_cycle) ;
-      void eval_exec(std::ostream& activity_trace, bool& activity_observed, const uint64_t current_fetch_cycle) ;
-      void eval_retire(std::ostream& activity_trace, bool& activity_observed, const uint64_t current_fetch_cycle) ;
+      // Functional warming (cbp --sample): passes the uop to the branch predictors and the caches,
+      // without timing it. Only call it with the pipeline drained.
+      void warm(db_t *inst);
+      // Delivers every pending hook event and retires every uop; fetch resumes after the last retirement.
+      void drain();
+      sim_progress_t get_progress() const;
+      void eval_decode(const uint64_t current_cycle);
+      void eval_aq(const uint64_t current_cycle);
+      void eval_exec(const uint64_t current_cycle);
+      void eval_retire(const uint64_t current_cycle);
+      void eval_until(const uint64_t target_cycle);
+      // Closes the last epoch; call once after the last step(), before output()/measure_cond_br().
+      void finish();
       void output();
+      // Conditional branch measurements of the whole run, or of its last half ("50 Perc instructions" report).
+      cond_br_meas_t measure_cond_br(const bool last_half_only) const;
+      // Sharded simulation (cbp --shards). At an epoch boundary, drops the per-epoch measurements of
+      // the epochs simulated so far, which only warmed the simulator up; measure_epoch() and
+      // append_epochs() then count epochs from there.
+      void reset_measurements();
+      cond_br_meas_t measure_epoch(const size_t epoch) const;
+      // Epochs measured, the one under way included until finish().
+      size_t get_num_epochs() const;
+      // Appends the measurements of epochs [first, first + count) to the per-epoch vectors and to bp.
+      void append_epochs(const size_t first, const size_t count, std::vector<uint64_t>& insts, std::vector<uint64_t>& cycles, bp_t& bp) const;
       uint64_t get_current_fetch_cycle() const;
+      // Heap allocations made while filling in the DecodeInfo/ExecuteInfo of the uops.
+      uint64_t get_exec_info_allocs() const;
+      // Heap allocations made by the contestant's predictor hooks, the BP.predict() ones included.
+      uint64_t get_predictor_allocs() const;
+      // Saves or restores the whole timing state (see snapshot.h); the conditional branch
+      // predictor is saved separately (snapshotCondDirPredictor).
+      void snapshot(snapshot_t& s);
       PredictionRequest get_value_prediction_req_for_track(uint64_t cycle, uint64_t seq_no, uint8_t piece, db_t *inst);
 };
 
@@ -33,6 +33,13 @@ class SampleCondPredictor
         {
         }
 
+        // saves or restores the predictor state (see lib/snapshot.h)
+        template <class SNAPSHOT>
+        void snapshot(SNAPSHOT& s)
+        {
+            snapshot_fields(s, active_hist, pred_time_histories);
+        }
+
         // sample function to get unique instruction id
         uint64_t get_unique_inst_id(uint64_t seq_no, uint8_t piece) const
         {
@@ -80,4 +87,4 @@ class SampleCondPredictor
 // =================
 
 #endif
-static SampleCondPredictor cond_predictor_impl;
+static thread_local SampleCondPredictor cond_predictor_impl;
@@ -0,0 +1,185 @@
+// Microbenchmark of the CBP2016 TAGE-SC-L predictor alone.
+//
+// Replays the branches of a branch stream (.cbpb, see "trace_convert -b") through the 64KB and
+// 192KB configurations and reports predictions per second of CPU time. Every branch is predicted,
+// its history updated and, for conditional branches, the predictor trained right away: the measured
+// work is the per-branch cost of the predictor hooks, without any of the timing simulator around them.
+// The history update alone (HistoryUpdate) is also timed on all branches, and the TAGE lookup alone
+// (Tagepred), its tag match alone (find_hit_banks) and the statistical corrector alone (sc_predict +
+// sc_update) on the conditional branches, replayed with their prediction-time histories through the
+// trained predictor.
+
+#include <time.h>
+#include <algorithm>
+#include <memory>
+#include <vector>
+#include "cbp2016_tage_sc_l.h"
+#include "branch_stream.h"
+
+// CPU time of the calling thread, less sensitive than wall-clock time to other load on the machine
+static double thread_cpu_secs()
+{
+    timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// The 192KB configuration prints its storage budget on construction, i.e. on every run.
+struct bench_192kb_t : TAGE_SC_L_192KB
+{
+    static constexpr bool PRINTSIZE = false;
+};
+
+// Same predictors with the scalar TAGE tag match and statistical corrector code, to measure what
+// the SIMD ones save per branch (identical when the build has no SIMD, see NATIVE in the Makefile).
+struct bench_64kb_scalar_t : TAGE_SC_L_64KB
+{
+    static constexpr bool SCALAR_SC = true;
+    static constexpr bool SCALAR_TAG_MATCH = true;
+};
+
+struct bench_192kb_scalar_t : bench_192kb_t
+{
+    static constexpr bool SCALAR_SC = true;
+    static constexpr bool SCALAR_TAG_MATCH = true;
+};
+
+// br_type of the predictor's history update, as set by spec_update() in cond_branch_predictor_interface.cc
+static int get_br_type(InstClass insn_class)
+{
+    switch (insn_class)
+    {
+        case InstClass::condBranchInstClass:
+            return 1;
+        case InstClass::uncondIndirectBranchInstClass:
+        case InstClass::callIndirectInstClass:
+        case InstClass::ReturnInstClass:
+            return 2;
+        default:
+            return 0;
+    }
+}
+
+// A conditional branch, its prediction-time history and its TAGE indices and tags
+template <class CFG>
+struct kernel_sample_t
+{
+    using predictor_t = CBP2016_TAGE_SC_L<CFG>;
+
+    uint64_t pc;
+    bool taken;
+    cbp_ckpt_t hist;
+    std::array<int, predictor_t::TAG_LANES> GI;
+    std::array<uint, predictor_t::TAG_LANES> GTAG;
+
+    kernel_sample_t(uint64_t pc, bool taken, const predictor_t& predictor, const cbp_ckpt_t& hist)
+        : pc(pc), taken(taken), hist(hist)
+    {
+        std::copy(std::begin(predictor.GI), std::end(predictor.GI), GI.begin());
+        std::copy(std::begin(predictor.GTAG), std::end(predictor.GTAG), GTAG.begin());
+    }
+};
+
+// Conditional branches kept for the kernel timings, enough for the sample traces
+static const size_t MAX_KERNEL_SAMPLES = 1 << 17;
+
+// Fastest of repeats runs of kernel over the samples (or branches), in ns per sample
+template <class S, class F>
+static double time_kernel(const std::vector<S>& samples, int repeats, F kernel)
+{
+    double best_secs = 0.0;
+    for (int r = 0; r < repeats; r++)
+    {
+        const double start = thread_cpu_secs();
+        for (const S& smp : samples)
+            kernel(smp);
+        const double secs = thread_cpu_secs() - start;
+        if ((r == 0) || (secs < best_secs))
+            best_secs = secs;
+    }
+    return best_secs * 1e9 / samples.size();
+}
+
+template <class CFG>
+static void run(const char * name, const std::vector<cbpb_record_t>& branches, uint64_t num_insts, int repeats)
+{
+    double best_secs = 0.0;
+    uint64_t num_cond = 0;
+    uint64_t num_misp = 0;
+    std::unique_ptr<CBP2016_TAGE_SC_L<CFG>> predictor;
+    std::vector<kernel_sample_t<CFG>> samples;
+    for (int r = 0; r < repeats; r++)
+    {
+        predictor = std::make_unique<CBP2016_TAGE_SC_L<CFG>>();
+        num_cond = 0;
+        num_misp = 0;
+        const double start = thread_cpu_secs();
+        for (const cbpb_record_t& br : branches)
+        {
+            const int br_type = get_br_type(br.insn_class);
+            if (br.insn_class == InstClass::condBranchInstClass)
+            {
+                const bool pred = predictor->predict(br.seq_no, br.piece, br.pc);
+                if ((r == 0) && (samples.size() < MAX_KERNEL_SAMPLES))
+                    samples.emplace_back(br.pc, br.taken, *predictor, predictor->pred_time_ckpts.at(br.seq_no, br.piece));
+                predictor->history_update(br.seq_no, br.piece, br.pc, br_type, pred, br.taken, br.next_pc);
+                predictor->update(br.seq_no, br.piece, br.pc, br.taken, pred, br.next_pc);
+                num_cond++;
+                num_misp += (pred != br.taken);
+            }
+            else
+            {
+                predictor->TrackOtherInst(br.pc, br_type, true, br.taken, br.next_pc);
+            }
+        }
+        const double secs = thread_cpu_secs() - start;
+        if ((r == 0) || (secs < best_secs))
+            best_secs = secs;
+    }
+
+    // History update, TAGE lookup, tag match and SC alone, on the trained predictor of the last run
+    CBP2016_TAGE_SC_L<CFG>& p = *predictor;
+    const double hist_ns = time_kernel(branches, repeats, [&p](const cbpb_record_t& br) {
+        p.HistoryUpdate(br.pc, get_br_type(br.insn_class), br.taken, br.taken, br.next_pc);
+    });
+    const double tage_ns = time_kernel(samples, repeats, [&p](const kernel_sample_t<CFG>& smp) {
+        p.Tagepred(smp.pc, smp.hist);
+    });
+    const double match_ns = time_kernel(samples, repeats, [&p](const kernel_sample_t<CFG>& smp) {
+        std::copy(smp.GI.begin(), smp.GI.end(), p.GI);
+        std::copy(smp.GTAG.begin(), smp.GTAG.end(), p.GTAG);
+        p.find_hit_banks();
+    });
+    const double sc_ns = time_kernel(samples, repeats, [&p](const kernel_sample_t<CFG>& smp) {
+        p.LSUM = p.sc_predict(smp.pc, smp.hist);
+        p.sc_update(smp.pc, smp.taken);
+    });
+
+    printf("%-16s %10lu cond br %8lu misp (MPKI %.4f) %8.3f s %10.3f M pred/s\n", name, num_cond, num_misp,
+           1000.0 * num_misp / num_insts, best_secs, num_cond / best_secs / 1e6);
+    printf("%-16s ns/br: %7.1f history update, ns/cond br: %7.1f TAGE lookup %7.1f tag match (incl. copying GI/GTAG) %7.1f SC\n",
+           name, hist_ns, tage_ns, match_ns, sc_ns);
+}
+
+int main(int argc, char ** argv)
+{
+    if ((argc < 2) || (argc > 3))
+    {
+        printf("usage:\t%s\n"
+               "\t[REQUIRED: .cbpb branch stream]\n"
+               "\t[optional: number of runs, the fastest one is reported (default: 3)]\n", argv[0]);
+        exit(0);
+    }
+    const int repeats = (argc == 3) ? std::max(1, atoi(argv[2])) : 3;
+
+    std::vector<cbpb_record_t> branches;
+    cbpb_reader_t reader(argv[1]);
+    while (const cbpb_record_t * rec = reader.next())
+        branches.push_back(*rec);
+
+    run<TAGE_SC_L_64KB>("64KB", branches, reader.get_num_insts(), repeats);
+    run<bench_64kb_scalar_t>("64KB scalar", branches, reader.get_num_insts(), repeats);
+    run<bench_192kb_t>("192KB", branches, reader.get_num_insts(), repeats);
+    run<bench_192kb_scalar_t>("192KB scalar", branches, reader.get_num_insts(), repeats);
+    return 0;
+}